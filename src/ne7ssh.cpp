@@ -20,11 +20,11 @@
 
 std::shared_ptr<ne7ssh_impl> ne7ssh::s_ne7sshInst;
 
-void ne7ssh::create()
+void ne7ssh::create(bool benchmarkAlgos)
 {
     if (s_ne7sshInst == NULL)
     {
-        s_ne7sshInst = ne7ssh_impl::create();
+        s_ne7sshInst = ne7ssh_impl::create(benchmarkAlgos);
     }
 }
 
@@ -56,16 +56,46 @@ int ne7ssh::connectWithKey(const char* host, const short port, const char* usern
     return s_ne7sshInst->connectWithKey(host, port, username, privKeyFileName, shell, timeout);
 }
 
+int ne7ssh::connectWithKeyData(const char* host, const short port, const char* username, const char* privKey, size_t privKeyLen, bool shell, const int timeout)
+{
+    return s_ne7sshInst->connectWithKeyData(host, port, username, privKey, privKeyLen, shell, timeout);
+}
+
+int ne7ssh::openChannel(int channel, bool shell)
+{
+    return s_ne7sshInst->openChannel(channel, shell);
+}
+
 bool ne7ssh::send(const char* data, int channel)
 {
     return s_ne7sshInst->send(data, channel);
 }
 
+bool ne7ssh::send(const void* data, size_t len, int channel)
+{
+    return s_ne7sshInst->send(data, len, channel);
+}
+
+bool ne7ssh::sendv(const ne7ssh_iovec* iov, int count, int channel)
+{
+    return s_ne7sshInst->sendv(iov, count, channel);
+}
+
+bool ne7ssh::send(std::string&& data, int channel)
+{
+    return s_ne7sshInst->send(std::move(data), channel);
+}
+
 bool ne7ssh::sendCmd(const char* cmd, int channel, int timeout)
 {
     return s_ne7sshInst->sendCmd(cmd, channel, timeout);
 }
 
+std::shared_ptr<ne7ssh_cmd_result> ne7ssh::execCmd(const char* cmd, int channel, uint32 timeoutMs)
+{
+    return s_ne7sshInst->execCmd(cmd, channel, timeoutMs);
+}
+
 bool ne7ssh::close(int channel)
 {
     return s_ne7sshInst->close(channel);
@@ -76,26 +106,96 @@ const char* ne7ssh::read(int channel)
     return s_ne7sshInst->read(channel);
 }
 
+int ne7ssh::read(int channel, char* buffer, int size)
+{
+    return s_ne7sshInst->read(channel, buffer, size);
+}
+
+bool ne7ssh::consume(int channel, int size)
+{
+    return s_ne7sshInst->consume(channel, size);
+}
+
+const char* ne7ssh::readStderr(int channel)
+{
+    return s_ne7sshInst->readStderr(channel);
+}
+
+int ne7ssh::readStderr(int channel, char* buffer, int size)
+{
+    return s_ne7sshInst->readStderr(channel, buffer, size);
+}
+
+bool ne7ssh::consumeStderr(int channel, int size)
+{
+    return s_ne7sshInst->consumeStderr(channel, size);
+}
+
+int ne7ssh::getStderrSize(int channel)
+{
+    return s_ne7sshInst->getStderrSize(channel);
+}
+
+bool ne7ssh::setCallbacks(int channel, const ne7ssh_callbacks& callbacks)
+{
+    return s_ne7sshInst->setCallbacks(channel, callbacks);
+}
+
+bool ne7ssh::setReceiveLimit(int channel, uint32 limit)
+{
+    return s_ne7sshInst->setReceiveLimit(channel, limit);
+}
+
 int ne7ssh::getReceivedSize(int channel)
 {
     return s_ne7sshInst->getReceivedSize(channel);
 }
 
+bool ne7ssh::getPacketPoolStats(int channel, uint64& hits, uint64& misses)
+{
+    return s_ne7sshInst->getPacketPoolStats(channel, hits, misses);
+}
+
 bool ne7ssh::waitFor(int channel, const char* str, uint32 timeout)
 {
     return s_ne7sshInst->waitFor(channel, str, timeout);
 }
 
+bool ne7ssh::waitForMs(int channel, const char* str, uint32 timeoutMs)
+{
+    return s_ne7sshInst->waitForMs(channel, str, timeoutMs);
+}
+
 void ne7ssh::setOptions(const char* prefCipher, const char* prefHmac)
 {
     s_ne7sshInst->setOptions(prefCipher, prefHmac);
 }
 
+bool ne7ssh::setKnownHostsFile(const char* fileName, bool allowUnknown)
+{
+    return s_ne7sshInst->setKnownHostsFile(fileName, allowUnknown);
+}
+
+void ne7ssh::setPipelinedHandshake(bool enable)
+{
+    s_ne7sshInst->setPipelinedHandshake(enable);
+}
+
+void ne7ssh::setReceiveWindow(uint32 windowSize, uint32 maxPacketSize, bool autoTune)
+{
+    s_ne7sshInst->setReceiveWindow(windowSize, maxPacketSize, autoTune);
+}
+
 bool ne7ssh::generateKeyPair(const char* type, const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, uint16 keySize)
 {
     return s_ne7sshInst->generateKeyPair(type, fqdn, privKeyFileName, pubKeyFileName, keySize);
 }
 
+bool ne7ssh::generateKeyPair(const char* type, const char* fqdn, std::string& privKey, std::string& pubKey, uint16 keySize)
+{
+    return s_ne7sshInst->generateKeyPair(type, fqdn, privKey, pubKey, keySize);
+}
+
 bool ne7ssh::initSftp(Ne7SftpSubsystem& sftpSubsys, int channel)
 {
     return s_ne7sshInst->initSftp(sftpSubsys, channel);
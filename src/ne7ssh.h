@@ -28,7 +28,10 @@
 
 #include "ne7ssh_types.h"
 #include "ne7ssh_error.h"
+#include "ne7ssh_callbacks.h"
+#include "ne7ssh_cmd_result.h"
 #include <memory>
+#include <string>
 
 class Ne7SftpSubsystem;
 class ne7ssh_impl;
@@ -42,9 +45,10 @@ public:
     /**
     * Create the SSH working environment.
     * This funciton must only be called once during application initialization.
+    * @param benchmarkAlgos If set to true, all supported cipher and hmac algorithms are timed on the local CPU and advertised to the remote side fastest first.
     */
 
-    SSH_EXPORT static void create();
+    SSH_EXPORT static void create(bool benchmarkAlgos = false);
 
     /**
     * Destroy the SSH working environment.
@@ -85,6 +89,31 @@ public:
      */
     SSH_EXPORT static int connectWithKey(const char* host, const short port, const char* username, const char* privKeyFileName, bool shell = true, const int timeout = 0);
 
+    /**
+     * Connect to remote host using SSH2 protocol, with publickey authentication, using a private key held in memory.
+     * <p> Nothing is read from or written to the filesystem.
+     * @param host Hostname or IP to connect to.
+     * @param port Port to connect to.
+     * @param username Username to use in authentication.
+     * @param privKey Private key, either PEM encoded as in a private key file, or the raw DER encoded key.
+     * @param privKeyLen Length of the private key data.
+     * @param shell Set this to true if you wish to launch the shell on the remote end. By default set to true.
+     * @param timeout Timeout for the connection procedure, in seconds.
+     * @return Returns newly assigned channel ID, or -1 if connection failed.
+     */
+    SSH_EXPORT static int connectWithKeyData(const char* host, const short port, const char* username, const char* privKey, size_t privKeyLen, bool shell = true, const int timeout = 0);
+
+    /**
+     * Opens an additional session channel on the connection of an already open channel.
+     * <p> The new channel is multiplexed over the existing TCP connection, so no new key exchange or authentication takes place, only a single CHANNEL_OPEN round trip.
+     * It has its own ID, and is used and closed like any channel returned by the connect functions. The connection stays up until all its channels are closed.
+     * Fails while the SFTP subsystem runs on the connection.
+     * @param channel Channel whose connection is used.
+     * @param shell Set this to true if you wish to launch the shell on the remote end. By default set to true.
+     * @return Returns newly assigned channel ID, or -1 if the channel could not be opened.
+     */
+    SSH_EXPORT static int openChannel(int channel, bool shell = true);
+
     /**
      * Retreives count of current connections
      * <p> For internal use only.
@@ -100,6 +129,34 @@ public:
      */
     SSH_EXPORT static bool send(const char* data, int channel);
 
+    /**
+     * Sends binary data on specified channel. The data may contain any byte, including NUL.
+     * <p>As much as the remote window allows is encrypted straight from the given buffer, the rest is copied to the channel's queue.
+     * @param data Pointer to the data.
+     * @param len Length of the data.
+     * @param channel Channel to send data on.
+     * @return Returns true if the send was successful, otherwise false returned.
+     */
+    SSH_EXPORT static bool send(const void* data, size_t len, int channel);
+
+    /**
+     * Sends several blocks of data on specified channel, as if they were a single buffer, so they share packets without being joined first.
+     * @param iov Array of data blocks.
+     * @param count Number of blocks.
+     * @param channel Channel to send data on.
+     * @return Returns true if the send was successful, otherwise false returned.
+     */
+    SSH_EXPORT static bool sendv(const ne7ssh_iovec* iov, int count, int channel);
+
+    /**
+     * Sends a buffer on specified channel, taking it over.
+     * <p>Data the remote window does not allow right away stays in the buffer until it is sent, instead of being copied to the channel's queue.
+     * @param data Buffer to send. It is left empty.
+     * @param channel Channel to send data on.
+     * @return Returns true if the send was successful, otherwise false returned.
+     */
+    SSH_EXPORT static bool send(std::string&& data, int channel);
+
     /**
     * Can be used to send a single command and disconnect, similiar behavior to openssh when one appends a command to the end of ssh command.
     * @param cmd Remote command to execute. Can be used to read files on unix with 'cat [filename]'.
@@ -109,6 +166,17 @@ public:
     */
     SSH_EXPORT static bool sendCmd(const char* cmd, int channel, int timeout);
 
+    /**
+    * Executes a command on specified channel, and waits for it to complete, collecting its output, exit status and timing.
+    * <p>The calling thread sleeps until the remote side finishes the command, so many commands can be awaited without polling.
+    * The command's standard output is taken from the receive buffer, data passed to a data callback is not part of the result.
+    * @param cmd Remote command to execute.
+    * @param channel Channel to execute the command on.
+    * @param timeoutMs Timeout in milliseconds, 0 waits until the command completes.
+    * @return Returns the result of the command, or an empty pointer if the command could not be sent.
+    */
+    SSH_EXPORT static std::shared_ptr<ne7ssh_cmd_result> execCmd(const char* cmd, int channel, uint32 timeoutMs = 0);
+
     /**
      * Closes specified channel.
      * @param channel Channel to close.
@@ -117,19 +185,99 @@ public:
     SSH_EXPORT static bool close(int channel);
 
     /**
-    * Reads all data from receiving buffer on specified channel.
+    * Reads all unread data from receiving buffer on specified channel.
+    * <p>The data stays in the buffer until it is released with consume().
     * @param channel Channel to read data on.
     * @return Returns string read from receiver buffer or 0 if buffer is empty.
     */
     SSH_EXPORT static const char* read(int channel);
 
     /**
-     * Returns the size of all data read. Used to read buffer passed 0x0.
+    * Copies unread data from receiving buffer on specified channel, and releases the copied bytes.
+    * @param channel Channel to read data on.
+    * @param buffer Buffer the data is copied to.
+    * @param size Size of the buffer.
+    * @return Returns number of bytes copied, 0 if receive buffer is empty, or -1 on error.
+    */
+    SSH_EXPORT static int read(int channel, char* buffer, int size);
+
+    /**
+    * Releases data returned by read(int) from receiving buffer on specified channel.
+    * @param channel Channel to release data on.
+    * @param size Number of bytes to release.
+    * @return Returns true if the channel was found, otherwise false is returned.
+    */
+    SSH_EXPORT static bool consume(int channel, int size);
+
+    /**
+    * Reads all unread standard error data received on specified channel.
+    * <p>The data stays in the buffer until it is released with consumeStderr().
+    * @param channel Channel to read data on.
+    * @return Returns string read from the standard error buffer or 0 if buffer is empty.
+    */
+    SSH_EXPORT static const char* readStderr(int channel);
+
+    /**
+    * Copies unread standard error data received on specified channel, and releases the copied bytes.
+    * @param channel Channel to read data on.
+    * @param buffer Buffer the data is copied to.
+    * @param size Size of the buffer.
+    * @return Returns number of bytes copied, 0 if the standard error buffer is empty, or -1 on error.
+    */
+    SSH_EXPORT static int readStderr(int channel, char* buffer, int size);
+
+    /**
+    * Releases data returned by readStderr(int) from the standard error buffer on specified channel.
+    * @param channel Channel to release data on.
+    * @param size Number of bytes to release.
+    * @return Returns true if the channel was found, otherwise false is returned.
+    */
+    SSH_EXPORT static bool consumeStderr(int channel, int size);
+
+    /**
+    * Returns the size of the unread standard error data on specified channel.
+    * @param channel Channel number which buffer size to check.
+    * @return Return size of the buffer, not counting the NUL terminator added by readStderr(), or 0x0 if the buffer is empty.
+    */
+    SSH_EXPORT static int getStderrSize(int channel);
+
+    /**
+    * Registers functions called from the connection's reading thread when data, extended data, EOF, exit status or close arrive on specified channel.
+    * <p>While a data callback is set, received data is passed to it instead of the receive buffer, so read() and waitFor() do not see it.
+    * Likewise, extended data passed to its callback is not added to the standard error buffer.
+    * Data already buffered is passed to the new data callback right away.
+    * @param channel Channel to register the callbacks on.
+    * @param callbacks Set of callbacks, empty functions are not called. Passing an empty set goes back to buffering.
+    * @return Returns true if the channel was found, otherwise false is returned.
+    */
+    SSH_EXPORT static bool setCallbacks(int channel, const ne7ssh_callbacks& callbacks);
+
+    /**
+    * Limits the amount of unread data buffered on specified channel, so long running sessions run in constant memory.
+    * <p>Once the limit is reached, the remote side is not allowed to send more data until the buffered data is consumed.
+    * @param channel Channel to limit.
+    * @param limit Maximum number of unread bytes, 0 for no limit.
+    * @return Returns true if the channel was found, otherwise false is returned.
+    */
+    SSH_EXPORT static bool setReceiveLimit(int channel, uint32 limit);
+
+    /**
+     * Returns the size of the unread data. Used to read buffer passed 0x0.
      * @param channel Channel number which buffer size to check.
-     * @return Return size of the buffer, or 0x0 if receive buffer empty.
+     * @return Return size of the buffer, not counting the NUL terminator added by read(), or 0x0 if receive buffer empty.
      */
     SSH_EXPORT static int getReceivedSize(int channel);
 
+    /**
+     * Retrieves the hit and miss counters of the packet buffer pool used by a connection.
+     * <p> Once a connection is warmed up, packets are sent and received without allocating, so misses should stop growing.
+     * @param channel Channel number of the connection.
+     * @param hits Number of packet buffers reused from the pool will be stored here.
+     * @param misses Number of packet buffers the pool had to allocate will be stored here.
+     * @return True if the channel was found, otherwise false is returned.
+     */
+    SSH_EXPORT static bool getPacketPoolStats(int channel, uint64& hits, uint64& misses);
+
     /**
      * Wait until receiving buffer contains a string passed in str, or until the function timeouts as specified in timeout.
      * @param channel Channel to wait on.
@@ -139,6 +287,17 @@ public:
      */
     SSH_EXPORT static bool waitFor(int channel, const char* str, uint32 timeout = 0);
 
+    /**
+     * Wait until receiving buffer contains a string passed in str, or until the function timeouts as specified in timeout.
+     * <p>Blocks until the reading thread signals new data, and only searches data not searched before, so the cost depends on the amount of new data rather than the size of the buffer.
+     * The library lock must not be held by the calling thread, so this function cannot be called from a callback.
+     * @param channel Channel to wait on.
+     * @param str String to wait for.
+     * @param timeoutMs Timeout in milliseconds, 0 waits until the string is received or the channel is closed.
+     * @return Returns true if string specified in str variable has been received, otherwise false returned.
+     */
+    SSH_EXPORT static bool waitForMs(int channel, const char* str, uint32 timeoutMs = 0);
+
     /**
      * Sets prefered cipher and hmac algorithms.
      * <p> This function as to be executed before connection functions, just after initialization of ne7ssh class.
@@ -147,6 +306,34 @@ public:
      */
     SSH_EXPORT static void setOptions(const char* prefCipher, const char* prefHmac);
 
+    /**
+     * Enables host key verification against an OpenSSH known_hosts file, for all connections made afterwards.
+     * <p>Plain and hashed (|1|) entries, wildcard patterns and @revoked markers are supported. The file is reloaded when its modification time changes.
+     * @param fileName Full path to the known_hosts file, NULL disables host key verification.
+     * @param allowUnknown If true, hosts without a key of the offered type in the file are accepted, otherwise the connection is refused.
+     * @return True if the file was loaded, otherwise false is returned.
+     */
+    SSH_EXPORT static bool setKnownHostsFile(const char* fileName, bool allowUnknown = false);
+
+    /**
+     * Enables pipelined handshake for connections made afterwards, to save several round trips on high latency links.
+     * <p> The version string, KEXINIT and a guessed KEXDH_INIT (first_kex_packet_follows) are sent in a single write.
+     * With password authentication the service request and the authentication request are sent together with NEWKEYS.
+     * @param enable If true, pipelined handshake is used. Disabled by default.
+     */
+    SSH_EXPORT static void setPipelinedHandshake(bool enable);
+
+    /**
+     * Sets the receive window and maximum packet size advertised by channels opened afterwards.
+     * <p> The window is replenished once half of it has been consumed, so a sender with enough data in flight never waits for a WINDOW_ADJUST.
+     * On high latency links the window has to hold at least one bandwidth-delay product, with auto-tuning enabled it is doubled, up to 16 MB,
+     * whenever half of it arrives within one round trip, as measured when the channel was opened.
+     * @param windowSize Initial receive window in bytes. 0 restores the default of 2 MB.
+     * @param maxPacketSize Largest data packet the remote side may send, in bytes, at most 255 kB. 0 restores the default of 34 kB.
+     * @param autoTune If true, the window grows with the measured bandwidth-delay product. Enabled by default.
+     */
+    SSH_EXPORT static void setReceiveWindow(uint32 windowSize, uint32 maxPacketSize = 0, bool autoTune = true);
+
     /**
      * Generate key pair.
      * @param type String specifying key type. Currently "dsa" and "rsa" are supported.
@@ -158,8 +345,21 @@ public:
      */
     SSH_EXPORT static bool generateKeyPair(const char* type, const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, uint16 keySize = 0);
 
+    /**
+     * Generate key pair into memory buffers.
+     * @param type String specifying key type. Currently "dsa" and "rsa" are supported.
+     * @param fqdn User id. Usually an Email. For example "test@netsieben.com"
+     * @param privKey PEM encoded private key will be stored here. It can be passed to connectWithKeyData() as is.
+     * All intermediate copies of the key are wiped, the caller should wipe this string once done with it.
+     * @param pubKey Public key line, in authorized_keys format, will be stored here.
+     * @param keySize Desired key size in bits. If not specified will default to 2048.
+     * @return Return true if keys generated. Otherwise false is returned.
+     */
+    SSH_EXPORT static bool generateKeyPair(const char* type, const char* fqdn, std::string& privKey, std::string& pubKey, uint16 keySize = 0);
+
     /**
      * This method is used to initialize a new SFTP subsystem.
+     * <p> Fails if other channels are open on the channel's connection.
      * @param _sftp Reference to SFTP subsystem to be initialized.
      * @param channel Channel ID returned by one of the connect methods.
      * @return True if the new subsystem successfully initialized. False on any error.
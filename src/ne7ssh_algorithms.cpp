@@ -0,0 +1,165 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#include "ne7ssh_algorithms.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace Botan;
+
+typedef struct
+{
+    const char* name;
+    uint32 length;
+    uint8 category;
+} algorithmEntry;
+
+// Indexed by ne7ssh_algorithms::ids.
+static const algorithmEntry s_algorithms[ne7ssh_algorithms::ID_COUNT] =
+{
+    { "diffie-hellman-group1-sha1", 26, ne7ssh_algorithms::KEX },
+    { "diffie-hellman-group14-sha1", 27, ne7ssh_algorithms::KEX },
+    { "ssh-dss", 7, ne7ssh_algorithms::HOSTKEY },
+    { "ssh-rsa", 7, ne7ssh_algorithms::HOSTKEY },
+    { "rsa-sha2-256", 12, ne7ssh_algorithms::HOSTKEY },
+    { "rsa-sha2-512", 12, ne7ssh_algorithms::HOSTKEY },
+    { "3des-cbc", 8, ne7ssh_algorithms::CIPHER },
+    { "aes128-cbc", 10, ne7ssh_algorithms::CIPHER },
+    { "aes192-cbc", 10, ne7ssh_algorithms::CIPHER },
+    { "aes256-cbc", 10, ne7ssh_algorithms::CIPHER },
+    { "blowfish-cbc", 12, ne7ssh_algorithms::CIPHER },
+    { "cast128-cbc", 11, ne7ssh_algorithms::CIPHER },
+    { "twofish-cbc", 11, ne7ssh_algorithms::CIPHER },
+    { "twofish256-cbc", 14, ne7ssh_algorithms::CIPHER },
+    { "hmac-sha1", 9, ne7ssh_algorithms::MAC },
+    { "hmac-md5", 8, ne7ssh_algorithms::MAC },
+    { "none", 4, ne7ssh_algorithms::MAC },
+    { "none", 4, ne7ssh_algorithms::COMPRESSION },
+    { "zlib", 4, ne7ssh_algorithms::COMPRESSION }
+};
+
+bool ne7ssh_algorithms::find(uint8 category, const Botan::byte* name, uint32 len, uint8& id)
+{
+    for (uint8 i = 0; i < ID_COUNT; i++)
+    {
+        if ((s_algorithms[i].category == category) && (s_algorithms[i].length == len) && !memcmp(s_algorithms[i].name, name, len))
+        {
+            id = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+ne7ssh_algorithms::idSet ne7ssh_algorithms::parse(uint8 category, const Botan::byte* list, uint32 len)
+{
+    idSet result;
+    uint32 start = 0, end;
+    uint8 id;
+
+    while (start <= len)
+    {
+        for (end = start; (end < len) && (list[end] != ','); end++)
+        {
+        }
+        if (find(category, list + start, end - start, id))
+        {
+            result.set(id);
+        }
+        start = end + 1;
+    }
+    return result;
+}
+
+const char* ne7ssh_algorithms::getName(uint8 id)
+{
+    return (id < ID_COUNT) ? s_algorithms[id].name : "";
+}
+
+ne7ssh_algorithm_list::ne7ssh_algorithm_list(uint8 category, const char* names, const char* preferred) : _category(category)
+{
+    const Botan::byte* list = (const Botan::byte*)names;
+    uint32 len = strlen(names);
+    uint32 start = 0, end;
+    uint8 id, preferredId;
+
+    while (start <= len)
+    {
+        for (end = start; (end < len) && (names[end] != ','); end++)
+        {
+        }
+        if (ne7ssh_algorithms::find(category, list + start, end - start, id) && (std::find(_ids.begin(), _ids.end(), id) == _ids.end()))
+        {
+            _ids.push_back(id);
+        }
+        start = end + 1;
+    }
+
+    if (preferred && ne7ssh_algorithms::find(category, (const Botan::byte*)preferred, strlen(preferred), preferredId))
+    {
+        std::vector<uint8>::iterator found = std::find(_ids.begin(), _ids.end(), preferredId);
+        if (found != _ids.end())
+        {
+            _ids.erase(found);
+            _ids.insert(_ids.begin(), preferredId);
+        }
+    }
+
+    for (size_t i = 0; i < _ids.size(); i++)
+    {
+        if (i)
+        {
+            _names.push_back(',');
+        }
+        _names += ne7ssh_algorithms::getName(_ids[i]);
+    }
+}
+
+bool ne7ssh_algorithm_list::agree(uint8& result, const ne7ssh_algorithms::idSet& remote) const
+{
+    for (size_t i = 0; i < _ids.size(); i++)
+    {
+        if (remote.test(_ids[i]))
+        {
+            result = _ids[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+ne7ssh_local_algorithms::ne7ssh_local_algorithms(const char* kex, const char* hostkey, const char* ciphers, const char* macs, const char* compression, const std::string& preferedCipher, const std::string& preferedMac)
+    : _kex(ne7ssh_algorithms::KEX, kex),
+    _hostkey(ne7ssh_algorithms::HOSTKEY, hostkey),
+    _ciphers(ne7ssh_algorithms::CIPHER, ciphers, preferedCipher.empty() ? 0 : preferedCipher.c_str()),
+    _macs(ne7ssh_algorithms::MAC, macs, preferedMac.empty() ? 0 : preferedMac.c_str()),
+    _compression(ne7ssh_algorithms::COMPRESSION, compression)
+{
+    ne7ssh_string lists;
+
+    // ext-info-c only signals support for SSH_MSG_EXT_INFO, it is never negotiated.
+    lists.addString((_kex.getNames() + ",ext-info-c").c_str());
+    lists.addString(_hostkey.getNames().c_str());
+    lists.addString(_ciphers.getNames().c_str());
+    lists.addString(_ciphers.getNames().c_str());
+    lists.addString(_macs.getNames().c_str());
+    lists.addString(_macs.getNames().c_str());
+    lists.addString(_compression.getNames().c_str());
+    lists.addString(_compression.getNames().c_str());
+    lists.addInt(0);
+    lists.addInt(0);
+    _kexInitLists = lists.value();
+}
@@ -0,0 +1,199 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_ALGORITHMS_H
+#define NE7SSH_ALGORITHMS_H
+
+#include "ne7ssh_string.h"
+#include <bitset>
+#include <string>
+#include <vector>
+
+/**
+ * Table of all algorithm names known to the library.
+ * <p>Every name is interned as a small integer ID, so negotiation works on sets of IDs instead of strings.
+ */
+class ne7ssh_algorithms
+{
+public:
+    enum categories { KEX, HOSTKEY, CIPHER, MAC, COMPRESSION };
+
+    enum ids
+    {
+        KEX_DH_GROUP1_SHA1, KEX_DH_GROUP14_SHA1,
+        HOSTKEY_SSH_DSS, HOSTKEY_SSH_RSA, HOSTKEY_RSA_SHA2_256, HOSTKEY_RSA_SHA2_512,
+        CIPHER_3DES_CBC, CIPHER_AES128_CBC, CIPHER_AES192_CBC, CIPHER_AES256_CBC, CIPHER_BLOWFISH_CBC, CIPHER_CAST128_CBC, CIPHER_TWOFISH_CBC, CIPHER_TWOFISH256_CBC,
+        MAC_HMAC_SHA1, MAC_HMAC_MD5, MAC_NONE,
+        CMPRS_NONE, CMPRS_ZLIB,
+        ID_COUNT
+    };
+
+    typedef std::bitset<ID_COUNT> idSet;
+
+    /**
+     * Looks up the ID of an algorithm name.
+     * @param category Category the name belongs to. The same name, like "none", may exist in several categories.
+     * @param name Pointer to the name, not NUL terminated.
+     * @param len Length of the name.
+     * @param id Reference to a variable where the ID will be stored.
+     * @return True if the name is known, otherwise false is returned.
+     */
+    static bool find(uint8 category, const Botan::byte* name, uint32 len, uint8& id);
+
+    /**
+     * Parses a comma separated name-list in a single pass. Unknown names are skipped.
+     * @param category Category of the listed algorithms.
+     * @param list Pointer to the name-list.
+     * @param len Length of the name-list.
+     * @return Set of IDs of all known names in the list.
+     */
+    static idSet parse(uint8 category, const Botan::byte* list, uint32 len);
+
+    /**
+     * Gets the name of an algorithm.
+     * @param id Algorithm ID.
+     * @return Algorithm name.
+     */
+    static const char* getName(uint8 id);
+};
+
+/**
+ * Ordered list of locally supported algorithms of one category.
+ */
+class ne7ssh_algorithm_list
+{
+private:
+    uint8 _category;
+    std::vector<uint8> _ids;
+    std::string _names;
+
+public:
+    /**
+     * Constructor.
+     * @param category Category of the listed algorithms.
+     * @param names Comma separated list of algorithm names, most preferred first. Unknown names are dropped.
+     * @param preferred Name of an algorithm to move in front of the list, if the list contains it.
+     */
+    ne7ssh_algorithm_list(uint8 category, const char* names, const char* preferred = 0);
+
+    /**
+     * Picks the first local algorithm which is also supported by the remote side.
+     * @param result Reference to a variable where the ID of the agreed algorithm will be stored.
+     * @param remote Set of algorithms supported by the remote side.
+     * @return True if a common algorithm was found, otherwise false is returned.
+     */
+    bool agree(uint8& result, const ne7ssh_algorithms::idSet& remote) const;
+
+    /**
+     * Gets the category of the listed algorithms.
+     * @return Category.
+     */
+    uint8 getCategory() const
+    {
+        return _category;
+    }
+
+    /**
+     * Gets the most preferred algorithm.
+     * @return Algorithm ID. Only valid if the list is not empty.
+     */
+    uint8 first() const
+    {
+        return _ids.front();
+    }
+
+    /**
+     * Checks if the list holds any algorithm.
+     * @return True if the list is empty, otherwise false is returned.
+     */
+    bool empty() const
+    {
+        return _ids.empty();
+    }
+
+    /**
+     * Gets the list in name-list form, as sent in 'KEX_INIT'.
+     * @return Comma separated list of algorithm names.
+     */
+    const std::string& getNames() const
+    {
+        return _names;
+    }
+};
+
+/**
+ * Local algorithm preferences and the name-list part of the local 'KEX_INIT' payload.
+ * <p>Built once per configuration change, and shared by all key exchanges started until the next change.
+ */
+class ne7ssh_local_algorithms
+{
+private:
+    ne7ssh_algorithm_list _kex;
+    ne7ssh_algorithm_list _hostkey;
+    ne7ssh_algorithm_list _ciphers;
+    ne7ssh_algorithm_list _macs;
+    ne7ssh_algorithm_list _compression;
+    ne7ssh_buffer _kexInitLists;
+
+public:
+    /**
+     * Constructor.
+     * @param kex Comma separated list of key exchange algorithms.
+     * @param hostkey Comma separated list of host key algorithms.
+     * @param ciphers Comma separated list of cipher algorithms.
+     * @param macs Comma separated list of HMAC algorithms.
+     * @param compression Comma separated list of compression algorithms.
+     * @param preferedCipher Cipher to move in front of the cipher list, may be empty.
+     * @param preferedMac HMAC to move in front of the HMAC list, may be empty.
+     */
+    ne7ssh_local_algorithms(const char* kex, const char* hostkey, const char* ciphers, const char* macs, const char* compression, const std::string& preferedCipher, const std::string& preferedMac);
+
+    const ne7ssh_algorithm_list& getKex() const
+    {
+        return _kex;
+    }
+
+    const ne7ssh_algorithm_list& getHostkey() const
+    {
+        return _hostkey;
+    }
+
+    const ne7ssh_algorithm_list& getCiphers() const
+    {
+        return _ciphers;
+    }
+
+    const ne7ssh_algorithm_list& getMacs() const
+    {
+        return _macs;
+    }
+
+    const ne7ssh_algorithm_list& getCompression() const
+    {
+        return _compression;
+    }
+
+    /**
+     * Gets the encoded name-list fields of the 'KEX_INIT' payload, from the key exchange algorithms up to and including the language lists.
+     * @return Reference to a vector containing the fields.
+     */
+    const ne7ssh_buffer& getKexInitLists() const
+    {
+        return _kexInitLists;
+    }
+};
+
+#endif
@@ -0,0 +1,54 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#include "ne7ssh_buffer_pool.h"
+
+ne7ssh_buffer_pool::ne7ssh_buffer_pool(uint32 bufferSize, size_t maxFree)
+    : _bufferSize(bufferSize),
+    _free(0),
+    _hits(0),
+    _misses(0)
+{
+    for (size_t i = 0; i < maxFree; i++)
+    {
+        _slots.push_back(std::unique_ptr<ne7ssh_buffer>(new ne7ssh_buffer));
+    }
+}
+
+void ne7ssh_buffer_pool::acquire(ne7ssh_buffer& buffer)
+{
+    if (_free)
+    {
+        _hits++;
+        buffer.swap(*_slots[--_free]);
+    }
+    else
+    {
+        ne7ssh_buffer fresh(_bufferSize);
+        _misses++;
+        buffer.swap(fresh);
+    }
+    buffer.clear();
+}
+
+void ne7ssh_buffer_pool::release(ne7ssh_buffer& buffer)
+{
+    if (_free < _slots.size())
+    {
+        buffer.clear();
+        _slots[_free++]->swap(buffer);
+    }
+}
@@ -0,0 +1,119 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_BUFFER_POOL_H
+#define NE7SSH_BUFFER_POOL_H
+
+#include "ne7ssh_string.h"
+#include <memory>
+#include <vector>
+
+/**
+ * Free list of packet sized buffers, owned by a single connection.
+ * <p>Buffers are handed out and taken back by swapping their storage with the caller's vector, so neither operation allocates or copies.
+ * Every pooled buffer was allocated with at least the pool's buffer size, and since resizing within that size keeps the allocation, packets built or decrypted in it never reallocate.
+ * The pool is not locked, it is only used while the owning transport's lock is held.
+ */
+class ne7ssh_buffer_pool
+{
+private:
+    const uint32 _bufferSize;
+    std::vector<std::unique_ptr<ne7ssh_buffer> > _slots;
+    size_t _free;
+    uint64 _hits;
+    uint64 _misses;
+
+public:
+    /**
+     * Constructor.
+     * @param bufferSize Capacity of every buffer handed out by the pool.
+     * @param maxFree Maximum number of idle buffers kept for reuse.
+     */
+    ne7ssh_buffer_pool(uint32 bufferSize, size_t maxFree = 4);
+
+    /**
+     * Hands out an empty buffer able to hold bufferSize bytes without reallocating.
+     * <p>Takes an idle buffer if there is one, otherwise a new one is allocated and counted as a miss.
+     * @param buffer Vector which receives the buffer. Its previous contents are discarded.
+     */
+    void acquire(ne7ssh_buffer& buffer);
+
+    /**
+     * Returns a buffer to the pool. If the pool already holds maxFree idle buffers, the buffer is left with the caller.
+     * @param buffer Vector obtained from acquire(), or swapped with one. It is left empty.
+     */
+    void release(ne7ssh_buffer& buffer);
+
+    /**
+     * Gets the number of acquire() calls served from idle buffers.
+     * @return Number of hits.
+     */
+    uint64 getHits() const
+    {
+        return _hits;
+    }
+
+    /**
+     * Gets the number of acquire() calls that had to allocate a new buffer.
+     * @return Number of misses.
+     */
+    uint64 getMisses() const
+    {
+        return _misses;
+    }
+};
+
+/**
+ * Scoped buffer taken from a ne7ssh_buffer_pool, and given back when it goes out of scope.
+ */
+class ne7ssh_pooled_buffer
+{
+private:
+    ne7ssh_buffer_pool& _pool;
+    ne7ssh_buffer _buffer;
+
+    ne7ssh_pooled_buffer(const ne7ssh_pooled_buffer&);
+    ne7ssh_pooled_buffer& operator=(const ne7ssh_pooled_buffer&);
+
+public:
+    /**
+     * Constructor.
+     * @param pool Pool to take the buffer from.
+     */
+    ne7ssh_pooled_buffer(ne7ssh_buffer_pool& pool) : _pool(pool)
+    {
+        _pool.acquire(_buffer);
+    }
+
+    /**
+     * Destructor. Returns the buffer to the pool.
+     */
+    ~ne7ssh_pooled_buffer()
+    {
+        _pool.release(_buffer);
+    }
+
+    /**
+     * Gets the pooled buffer.
+     * @return Reference to the buffer.
+     */
+    ne7ssh_buffer& value()
+    {
+        return _buffer;
+    }
+};
+
+#endif
@@ -0,0 +1,65 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_CALLBACKS_H
+#define NE7SSH_CALLBACKS_H
+
+#include "ne7ssh_types.h"
+#include <cstddef>
+#include <functional>
+
+/**
+ * Set of functions called when events arrive on a channel, registered with ne7ssh::setCallbacks().
+ * <p>The functions are called from the thread reading the connection, while the library lock is held.
+ * They should return quickly, as no other channel is served until they do.
+ * <p>Functions that do not wait for the remote side, such as send(), read(), close() or setCallbacks(), may be called from a callback.
+ * Functions that wait for it, waitFor(), waitForMs(), sendCmd(), execCmd() and openChannel(), would wait for the very thread running the callback, so they fail right away there.
+ * Any of them may be left empty.
+ */
+struct ne7ssh_callbacks
+{
+    /**
+     * Called for data received on the channel. While set, received data is not added to the receive buffer.
+     * <p>Arguments: channel number, pointer to the data, length of the data. The data is only valid during the call.
+     */
+    std::function<void(int, const char*, size_t)> onData;
+
+    /**
+     * Called for extended data received on the channel, usually the standard error stream of the remote process. While set, extended data is not added to the standard error buffer.
+     * <p>Arguments: channel number, data type code, pointer to the data, length of the data. The data is only valid during the call.
+     */
+    std::function<void(int, uint32, const char*, size_t)> onExtendedData;
+
+    /**
+     * Called when the remote side signals the end of its output.
+     * <p>Arguments: channel number.
+     */
+    std::function<void(int)> onEof;
+
+    /**
+     * Called when the remote process exits with a status code.
+     * <p>Arguments: channel number, exit status.
+     */
+    std::function<void(int, uint32)> onExitStatus;
+
+    /**
+     * Called once when the channel is closed, either by the remote side or because the connection was lost.
+     * <p>Arguments: channel number.
+     */
+    std::function<void(int)> onClose;
+};
+
+#endif
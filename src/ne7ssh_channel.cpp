@@ -15,22 +15,46 @@
  ***************************************************************************/
 
 #include "ne7ssh_channel.h"
+#include "ne7ssh_reader.h"
+#include "ne7ssh_message.h"
 #include "ne7ssh_transport.h"
 #include "ne7ssh_session.h"
 #include "ne7ssh_impl.h"
 #include "ne7ssh.h"
+#include <algorithm>
 
 using namespace Botan;
 
+// Connection protocol messages, RFC 4254.
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_OPEN, ne7ssh_string_field, ne7ssh_uint32_field, ne7ssh_uint32_field, ne7ssh_uint32_field> channelOpenMsg;
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_OPEN_CONFIRMATION, ne7ssh_uint32_field, ne7ssh_uint32_field, ne7ssh_uint32_field, ne7ssh_uint32_field> channelOpenConfirmMsg;
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_WINDOW_ADJUST, ne7ssh_uint32_field, ne7ssh_uint32_field> windowAdjustMsg;
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_DATA, ne7ssh_uint32_field, ne7ssh_string_field> channelDataMsg;
+// Header of a 'DATA' packet, the data itself is copied in behind it, with the length field standing in for the string prefix.
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_DATA, ne7ssh_uint32_field, ne7ssh_uint32_field> channelDataHeaderMsg;
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_EOF, ne7ssh_uint32_field> channelEofMsg;
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_CLOSE, ne7ssh_uint32_field> channelCloseMsg;
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_REQUEST, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_bool_field> channelRequestMsg;
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_REQUEST, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_bool_field, ne7ssh_string_field> execRequestMsg;
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_REQUEST, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_bool_field, ne7ssh_string_field,
+                       ne7ssh_uint32_field, ne7ssh_uint32_field, ne7ssh_uint32_field, ne7ssh_uint32_field, ne7ssh_string_field> ptyRequestMsg;
+
 //uint32 ne7ssh_channel::channelCount = 0;
 
 ne7ssh_channel::ne7ssh_channel(std::shared_ptr<ne7ssh_session> session)
     : _eof(false),
     _closed(false),
     _cmdComplete(false),
+    _exitReceived(false),
     _shellSpawned(false),
+    _closeNotified(false),
     _session(session),
+    _rtt(std::chrono::steady_clock::duration::zero()),
+    _windowGranted(0),
+    _openPending(false),
+    _recvLimit(0),
     _windowRecv(0),
+    _windowSize(0),
     _windowSend(0),
     _channelOpened(false)
 {
@@ -42,95 +66,123 @@ ne7ssh_channel::~ne7ssh_channel()
 
 uint32 ne7ssh_channel::open(uint32 channelID)
 {
-    ne7ssh_string packet;
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
+    ne7ssh_span payload;
 
-    packet.addChar(SSH2_MSG_CHANNEL_OPEN);
-    packet.addString("session");
-    packet.addInt(channelID);
 //  ne7ssh_channel::channelCount++;
-    _windowSend = 0;
-    _windowRecv = MAX_PACKET_LEN - 2400;
-    packet.addInt(_windowRecv);
-    packet.addInt(MAX_PACKET_LEN);
-
-    if (!transport->sendPacket(packet.value()))
+    if (!requestOpen(channelID))
     {
         return 0;
     }
-    if (!transport->waitForPacket(SSH2_MSG_CHANNEL_OPEN_CONFIRMATION))
+    // Other channels on the connection keep receiving data while the confirmation is outstanding.
+    while (isOpening())
+    {
+        if ((transport->waitForPacket(0) <= 0) || !transport->getPayload(payload))
+        {
+            break;
+        }
+        dispatch(payload);
+    }
+    if (!_channelOpened)
     {
         ne7ssh::errors()->push(-1, "New channel: %i could not be open.", channelID);
         return 0;
     }
-    if (handleChannelConfirm())
-    {
-        _channelOpened = true;
-        return channelID;
+    return channelID;
 //    return (ne7ssh_channel::channelCount - 1);
-    }
-    else
+}
+
+bool ne7ssh_channel::requestOpen(uint32 channelID)
+{
+    ne7ssh_string packet;
+    std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
+
+    _windowSend = 0;
+    _windowSize = ne7ssh_impl::RECV_WINDOW_SIZE;
+    _windowRecv = _windowSize;
+    _windowGranted = _windowRecv;
+    _closed = false;
+    _closeNotified = false;
+    channelOpenMsg::encode(packet, "session", channelID, _windowRecv, ne7ssh_impl::RECV_MAX_PACKET);
+
+    _openStart = std::chrono::steady_clock::now();
+    if (!transport->sendPacket(packet.value()))
     {
-        return 0;
+        return false;
     }
+    _openPending = true;
+    return true;
 }
 
-bool ne7ssh_channel::handleChannelConfirm()
+bool ne7ssh_channel::handleChannelConfirm(ne7ssh_reader& packet)
 {
-    std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
-    SecureVector<Botan::byte> packet;
-    transport->getPacket(packet);
-    ne7ssh_string channelConfirm(packet, 1);
-    uint32 field;
-
-    // Receive Channel
-    channelConfirm.getInt();
-    // Send Channel
-    field = channelConfirm.getInt();
-    _session->setSendChannel(field);
-
-    // Window Size
-    field = channelConfirm.getInt();
-    _windowSend = field;
-
-    // Max Packet
-    field = channelConfirm.getInt();
-    _session->setMaxPacket(field);
+    uint32 recvChannel, sendChannel, windowSize, maxPacket;
+
+    if (!channelOpenConfirmMsg::decode(packet, recvChannel, sendChannel, windowSize, maxPacket))
+    {
+        return false;
+    }
+    _session->setSendChannel(sendChannel);
+    _windowSend = windowSize;
+    _session->setMaxPacket(maxPacket);
+    _channelOpened = true;
+    _openPending = false;
+    // The open request is answered right away, which makes it a round trip time sample for window auto-tuning.
+    _lastAdjust = std::chrono::steady_clock::now();
+    _rtt = _lastAdjust - _openStart;
+    wakeWaiters();
     return true;
 }
 
-bool ne7ssh_channel::adjustWindow(Botan::SecureVector<Botan::byte>& packet)
+bool ne7ssh_channel::handleChannelFailure(ne7ssh_reader& packet)
 {
-    ne7ssh_string adjustWindow(packet, 0);
-    ne7ssh_string newPacket;
-    uint32 field;
+    uint32 reasonCode = 0;
+    ne7ssh_buffer description;
+
+    packet.skip(sizeof(uint32));
+    packet.getInt(reasonCode);
+    packet.getString(description);
+    _closed = true;
+    _openPending = false;
+    wakeWaiters();
 
-    // channel number
-    adjustWindow.getInt();
+    ne7ssh::errors()->push(_session->getSshChannel(), "Remote side refused to open the channel, reason: %i, %B.", reasonCode, &description);
+    return false;
+}
+
+bool ne7ssh_channel::adjustWindow(ne7ssh_reader& packet)
+{
+    uint32 channel, bytesToAdd;
 
-    // add bytes to the window
-    field = adjustWindow.getInt();
-    _windowSend += field;
+    if (!windowAdjustMsg::decode(packet, channel, bytesToAdd))
+    {
+        return false;
+    }
+    _windowSend += bytesToAdd;
     return true;
 }
 
-bool ne7ssh_channel::handleEof(Botan::SecureVector<Botan::byte>& packet)
+bool ne7ssh_channel::handleEof(ne7ssh_reader& packet)
 {
     UNREF_PARAM(packet);
-    this->_cmdComplete = true;
+    // The remote side still sends exit status and CLOSE, so the channel is left open for them.
+    if (_exitReceived)
+    {
+        _cmdComplete = true;
+    }
     _windowRecv = 0;
     _eof = true;
-    if (!_closed)
+    ne7ssh::errors()->push(_session->getSshChannel(), "Remote side responded with EOF.");
+    wakeWaiters();
+    if (_callbacks && _callbacks->onEof)
     {
-        sendClose();
+        std::shared_ptr<const ne7ssh_callbacks> callbacks = _callbacks;
+        callbacks->onEof(_session->getSshChannel());
     }
-    _closed = true;
-    _channelOpened = false;
-    ne7ssh::errors()->push(_session->getSshChannel(), "Remote side responded with EOF.");
     return false;
 }
 
-void ne7ssh_channel::handleClose(Botan::SecureVector<Botan::byte>& newPacket)
+void ne7ssh_channel::handleClose(ne7ssh_reader& newPacket)
 {
     UNREF_PARAM(newPacket);
     if (!_closed)
@@ -140,23 +192,42 @@ void ne7ssh_channel::handleClose(Botan::SecureVector<Botan::byte>& newPacket)
     _windowRecv = 0;
     _closed = true;
     _channelOpened = false;
+    _cmdComplete = true;
+    notifyClose();
 }
 
-bool ne7ssh_channel::handleDisconnect(Botan::SecureVector<Botan::byte>& packet)
+bool ne7ssh_channel::handleDisconnect(ne7ssh_reader& packet)
 {
-    ne7ssh_string message(packet, 0);
 //  uint32 reasonCode = message.getInt ();
-    SecureVector<Botan::byte> description;
+    ne7ssh_buffer description;
 
-    message.getString(description);
+    packet.skip(sizeof(uint32));
+    packet.getString(description);
     _windowSend = _windowRecv = 0;
     _closed = true;
     _channelOpened = false;
 
     ne7ssh::errors()->push(_session->getSshChannel(), "Remote Site disconnected with Error: %B.", &description);
+    notifyClose();
     return false;
 }
 
+void ne7ssh_channel::notifyClose()
+{
+    wakeWaiters();
+    if (_closeNotified)
+    {
+        return;
+    }
+    _closeNotified = true;
+    if (_callbacks && _callbacks->onClose)
+    {
+        // Holding a reference keeps the functions alive, should the callback replace them.
+        std::shared_ptr<const ne7ssh_callbacks> callbacks = _callbacks;
+        callbacks->onClose(_session->getSshChannel());
+    }
+}
+
 bool ne7ssh_channel::sendClose()
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
@@ -166,8 +237,7 @@ bool ne7ssh_channel::sendClose()
     {
         return false;
     }
-    packet.addChar(SSH2_MSG_CHANNEL_CLOSE);
-    packet.addInt(_session->getSendChannel());
+    channelCloseMsg::encode(packet, _session->getSendChannel());
 
     if (!transport->sendPacket(packet.value()))
     {
@@ -176,6 +246,7 @@ bool ne7ssh_channel::sendClose()
     _windowSend = 0;
     _windowRecv = 0;
     _closed = true;
+    wakeWaiters();
     return true;
 }
 
@@ -188,8 +259,7 @@ bool ne7ssh_channel::sendEof()
     {
         return false;
     }
-    packet.addChar(SSH2_MSG_CHANNEL_EOF);
-    packet.addInt(_session->getSendChannel());
+    channelEofMsg::encode(packet, _session->getSendChannel());
 
     if (!transport->sendPacket(packet.value()))
     {
@@ -203,99 +273,150 @@ bool ne7ssh_channel::sendEof()
 
 void ne7ssh_channel::sendAdjustWindow()
 {
-    uint32 len = _session->getMaxPacket() - _windowRecv - 2400;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    uint64 elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - _lastAdjust).count();
+    uint64 rtt = std::chrono::duration_cast<std::chrono::microseconds>(_rtt).count();
+    uint64 consumed = (_windowGranted > _windowRecv) ? _windowGranted - _windowRecv : 0;
+    uint64 target;
+    uint32 room;
     ne7ssh_string packet;
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
 
-    packet.addChar(SSH2_MSG_CHANNEL_WINDOW_ADJUST);
-    packet.addInt(_session->getSendChannel());
-    packet.addInt(len);
-    _windowRecv = len;
+    if (ne7ssh_impl::RECV_WINDOW_AUTOTUNE && rtt)
+    {
+        // Twice the bandwidth-delay product keeps the sender busy while the adjustment is on its way, growth is limited to doubling per step.
+        target = elapsed ? (2 * consumed * rtt / elapsed) : NE7SSH_MAX_WINDOW;
+        target = std::min(target, (uint64)_windowSize * 2);
+        target = std::min(target, (uint64)NE7SSH_MAX_WINDOW);
+        if (target > _windowSize)
+        {
+            _windowSize = (uint32)target;
+        }
+    }
+
+    room = windowRoom();
+    if (room <= _windowRecv)
+    {
+        // The receive buffer is full, the window is refilled once the application consumes data.
+        return;
+    }
+    windowAdjustMsg::encode(packet, _session->getSendChannel(), room - _windowRecv);
+    _windowRecv = room;
+    _windowGranted = room;
+    _lastAdjust = now;
 
     transport->sendPacket(packet.value());
 }
 
-bool ne7ssh_channel::handleData(Botan::SecureVector<Botan::byte>& packet)
+bool ne7ssh_channel::handleData(ne7ssh_reader& packet)
 {
-    ne7ssh_string handleData(packet, 0);
-    SecureVector<Botan::byte> data;
+    uint32 channel;
+    ne7ssh_span data;
 
-    handleData.getInt();
-
-    if (!handleData.getString(data))
+    if (!channelDataMsg::decode(packet, channel, data))
     {
         return false;
     }
-    if (!data.size())
+    if (!data.length)
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "Abnormal. End of stream detected.");
     }
 
-    if (_chanInBuffer.length())
-    {
-        _chanInBuffer.chop(1);
-    }
-    _chanInBuffer.addVector(data);
-    if (_chanInBuffer.length())
+    if (_callbacks && _callbacks->onData)
     {
-        _chanInBuffer.addChar(0x00);
+        std::shared_ptr<const ne7ssh_callbacks> callbacks = _callbacks;
+        callbacks->onData(_session->getSshChannel(), (const char*)data.data, data.length);
     }
-    _windowRecv -= data.size();
-    if (_windowRecv == 0)
+    else
     {
-        sendAdjustWindow();
+        _chanInBuffer.append(data.data, data.length);
+        wakeWaiters();
     }
-    return true;
+    return adjustRecvWindow(data.length);
 }
 
-bool ne7ssh_channel::handleExtendedData(Botan::SecureVector<Botan::byte>& packet)
+bool ne7ssh_channel::handleExtendedData(ne7ssh_reader& packet)
 {
-    ne7ssh_string handleData(packet, 0);
-    uint32 dataType;
-    SecureVector<Botan::byte> data;
+    uint32 dataType = 0;
+    ne7ssh_span data;
 
-    handleData.getInt();
-    dataType = handleData.getInt();
+    packet.skip(sizeof(uint32));
+    packet.getInt(dataType);
     if (dataType != 1)
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "Unable to handle received request.");
         return false;
     }
 
-    if (handleData.getString(data))
+    if (!packet.getString(data))
+    {
+        return false;
+    }
+    if (_callbacks && _callbacks->onExtendedData)
     {
-        ne7ssh::errors()->push(_session->getSshChannel(), "Remote side returned the following error: %B", &data);
+        std::shared_ptr<const ne7ssh_callbacks> callbacks = _callbacks;
+        callbacks->onExtendedData(_session->getSshChannel(), dataType, (const char*)data.data, data.length);
     }
     else
     {
-        return false;
+        _chanErrBuffer.append(data.data, data.length);
+        wakeWaiters();
     }
 
-    _windowRecv -= data.size();
-    if (_windowRecv == 0)
+    return adjustRecvWindow(data.length);
+}
+
+void ne7ssh_channel::setExitReceived()
+{
+    _exitReceived = true;
+    if (_eof)
     {
-        sendAdjustWindow();
+        _cmdComplete = true;
+        wakeWaiters();
     }
-    return true;
 }
 
-void ne7ssh_channel::handleRequest(Botan::SecureVector<Botan::byte>& packet)
+void ne7ssh_channel::handleRequest(ne7ssh_reader& packet)
 {
-    ne7ssh_string handleRequest(packet, 0);
-    SecureVector<Botan::byte> field;
+    ne7ssh_span field;
     uint32 signal;
 
-    handleRequest.getInt();
-    handleRequest.getString(field);
-    if (!memcmp((char*)field.begin(), "exit-signal", 11))
+    if (!packet.skip(sizeof(uint32)) || !packet.getString(field) || (field.length != 11))
     {
-        ne7ssh::errors()->push(_session->getSshChannel(), "exit-signal ignored.");
+        return;
+    }
+    if (!memcmp(field.data, "exit-signal", 11))
+    {
+        setExitReceived();
+        if (_cmdResult && packet.skip(sizeof(Botan::byte)) && packet.getString(field))
+        {
+            _cmdResult->exitSignal.assign((const char*)field.data, field.length);
+        }
+        else if (!_cmdResult)
+        {
+            ne7ssh::errors()->push(_session->getSshChannel(), "exit-signal ignored.");
+        }
     }
-    else if (!memcmp((char*)field.begin(), "exit-status", 11))
+    else if (!memcmp(field.data, "exit-status", 11))
     {
-        handleRequest.getByte();
-        signal = handleRequest.getInt();
-        ne7ssh::errors()->push(_session->getSshChannel(), "Remote side exited with status: %i.", signal);
+        if (packet.skip(sizeof(Botan::byte)) && packet.getInt(signal))
+        {
+            setExitReceived();
+            if (_cmdResult)
+            {
+                _cmdResult->exitStatusReceived = true;
+                _cmdResult->exitStatus = signal;
+            }
+            if (_callbacks && _callbacks->onExitStatus)
+            {
+                std::shared_ptr<const ne7ssh_callbacks> callbacks = _callbacks;
+                callbacks->onExitStatus(_session->getSshChannel(), signal);
+            }
+            else if (!_cmdResult)
+            {
+                ne7ssh::errors()->push(_session->getSshChannel(), "Remote side exited with status: %i.", signal);
+            }
+        }
     }
 
 //  handleRequest.getByte();
@@ -313,12 +434,7 @@ bool ne7ssh_channel::execCmd(const char* cmd)
         return false;
     }
 
-    packet.clear();
-    packet.addChar(SSH2_MSG_CHANNEL_REQUEST);
-    packet.addInt(_session->getSendChannel());
-    packet.addString("exec");
-    packet.addChar(0);
-    packet.addString(cmd);
+    execRequestMsg::encode(packet, _session->getSendChannel(), "exec", false, cmd);
 
     if (!transport->sendPacket(packet.value()))
     {
@@ -326,6 +442,7 @@ bool ne7ssh_channel::execCmd(const char* cmd)
     }
 
     _cmdComplete = false;
+    _exitReceived = false;
     return true;
 }
 
@@ -334,27 +451,14 @@ void ne7ssh_channel::getShell()
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
     ne7ssh_string packet;
 
-    packet.clear();
-    packet.addChar(SSH2_MSG_CHANNEL_REQUEST);
-    packet.addInt(_session->getSendChannel());
-    packet.addString("pty-req");
-    packet.addChar(0);
-    packet.addString("dumb");
-    packet.addInt(80);
-    packet.addInt(24);
-    packet.addInt(0);
-    packet.addInt(0);
-    packet.addString("");
+    ptyRequestMsg::encode(packet, _session->getSendChannel(), "pty-req", false, "dumb", 80, 24, 0, 0, "");
     if (!transport->sendPacket(packet.value()))
     {
         return;
     }
 
     packet.clear();
-    packet.addChar(SSH2_MSG_CHANNEL_REQUEST);
-    packet.addInt(_session->getSendChannel());
-    packet.addString("shell");
-    packet.addChar(0);
+    channelRequestMsg::encode(packet, _session->getSendChannel(), "shell", false);
     if (!transport->sendPacket(packet.value()))
     {
         return;
@@ -365,15 +469,16 @@ void ne7ssh_channel::getShell()
 void ne7ssh_channel::receive()
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
-    SecureVector<Botan::byte> packet;
+    ne7ssh_span payload;
     bool notFirst = false;
     short status;
 
-    if (_eof)
+    if (_eof && _closed)
     {
         return;
     }
 
+    std::unique_lock<std::recursive_mutex> lock(transport->getMutex());
     do
     {
         status = transport->waitForPacket(0, notFirst);
@@ -382,6 +487,7 @@ void ne7ssh_channel::receive()
             _eof = true;
             _closed = true;
             _channelOpened = false;
+            notifyClose();
             return;
         }
         if (status != 0)
@@ -390,50 +496,62 @@ void ne7ssh_channel::receive()
             {
                 notFirst = true;
             }
-            transport->getPacket(packet);
-            handleReceived(packet);
+            if (transport->getPayload(payload))
+            {
+                dispatch(payload);
+            }
         }
     } while (status != 0);
 }
 
-bool ne7ssh_channel::handleReceived(Botan::SecureVector<Botan::byte>& _packet)
+bool ne7ssh_channel::handleReceived(const ne7ssh_span& payload)
 {
-    ne7ssh_string newPacket;
+    ne7ssh_reader newPacket(payload);
     Botan::byte cmd;
 
-    newPacket.addVector(_packet);
-    cmd = newPacket.getByte();
+    if (!newPacket.getByte(cmd))
+    {
+        return false;
+    }
     switch (cmd)
     {
+        case SSH2_MSG_CHANNEL_OPEN_CONFIRMATION:
+            return handleChannelConfirm(newPacket);
+            break;
+
+        case SSH2_MSG_CHANNEL_OPEN_FAILURE:
+            return handleChannelFailure(newPacket);
+            break;
+
         case SSH2_MSG_CHANNEL_WINDOW_ADJUST:
-            adjustWindow(newPacket.value());
+            adjustWindow(newPacket);
             break;
 
         case SSH2_MSG_CHANNEL_DATA:
-            return handleData(newPacket.value());
+            return handleData(newPacket);
             break;
 
         case SSH2_MSG_CHANNEL_EXTENDED_DATA:
-            handleExtendedData(newPacket.value());
+            handleExtendedData(newPacket);
             break;
 
         case SSH2_MSG_CHANNEL_EOF:
-            return handleEof(newPacket.value());
+            return handleEof(newPacket);
             break;
 
         case SSH2_MSG_CHANNEL_CLOSE:
-            handleClose(newPacket.value());
+            handleClose(newPacket);
             break;
 
         case SSH2_MSG_CHANNEL_REQUEST:
-            handleRequest(newPacket.value());
+            handleRequest(newPacket);
             break;
 
         case SSH2_MSG_IGNORE:
             break;
 
         case SSH2_MSG_DISCONNECT:
-            return handleDisconnect(newPacket.value());
+            return handleDisconnect(newPacket);
             break;
 
         default:
@@ -443,109 +561,371 @@ bool ne7ssh_channel::handleReceived(Botan::SecureVector<Botan::byte>& _packet)
     return true;
 }
 
-void ne7ssh_channel::write(Botan::SecureVector<Botan::byte>& data)
+bool ne7ssh_channel::routeToOwner(const ne7ssh_span& payload)
 {
-    SecureVector<Botan::byte> dataBuff, outBuff, delayedBuff;
-    uint32 len, maxBytes, i, dataStart;
+    std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
+    std::shared_ptr<ne7ssh_channel> owner;
+    std::vector<std::shared_ptr<ne7ssh_channel> > channels;
+    ne7ssh_reader packet(payload);
+    Botan::byte cmd;
+    uint32 recipient;
 
-    if (_delayedBuffer.length())
+    if (!packet.getByte(cmd))
     {
-        dataBuff = _delayedBuffer.value();
-        _delayedBuffer.clear();
+        return false;
+    }
+    if (cmd == SSH2_MSG_DISCONNECT)
+    {
+        channels = transport->getChannels();
+        for (size_t i = 0; i < channels.size(); i++)
+        {
+            if (channels[i].get() != this)
+            {
+                channels[i]->handleReceived(payload);
+            }
+        }
+        return false;
+    }
+    if ((cmd < SSH2_MSG_CHANNEL_OPEN_CONFIRMATION) || (cmd > SSH2_MSG_CHANNEL_FAILURE) || !packet.getInt(recipient))
+    {
+        return false;
     }
-    dataBuff += data;
 
-    if (!_windowSend)
+    owner = transport->findChannel(recipient);
+    if (owner.get() == this)
     {
-        delayedBuff = dataBuff;
+        return false;
     }
-    else if (_windowSend < dataBuff.size())
+    if (owner)
     {
-        outBuff += SecureVector<Botan::byte>(dataBuff.begin(), _windowSend);
-        delayedBuff = SecureVector<Botan::byte>(dataBuff.begin() + _windowSend, dataBuff.size() - _windowSend);
+        // Errors on another channel are reported on that channel, they do not concern this one.
+        owner->handleReceived(payload);
     }
-    else
+    return true;
+}
+
+bool ne7ssh_channel::dispatch(const ne7ssh_span& payload)
+{
+    if (routeToOwner(payload))
     {
-        outBuff += dataBuff;
+        return true;
     }
+    return handleReceived(payload);
+}
+
+bool ne7ssh_channel::write(const Botan::byte* data, size_t len, bool sendNow)
+{
+    ne7ssh_iovec iov;
+
+    iov.data = data;
+    iov.length = len;
+    return write(&iov, 1, sendNow);
+}
+
+bool ne7ssh_channel::write(const ne7ssh_iovec* iov, int count, bool sendNow)
+{
+    size_t total = 0, sent = 0, skip;
+    bool status = true;
+    int i;
 
-    if (delayedBuff.size())
+    for (i = 0; i < count; i++)
     {
-        _delayedBuffer.addVector(delayedBuff);
+        total += iov[i].length;
     }
-    if (!outBuff.size())
+    if (sendNow && _chanOutBuffer.empty())
     {
-        return;
+        status = sendDirect(iov, count, total, sent);
     }
 
-    len = outBuff.size();
-    _windowSend -= len;
+    if (sent == total)
+    {
+        return status;
+    }
+    // Whatever did not fit into the send window waits for the next selectThread pass.
+    for (i = 0; i < count; i++)
+    {
+        skip = std::min(sent, iov[i].length);
+        _chanOutBuffer.append((const Botan::byte*)iov[i].data + skip, iov[i].length - skip);
+        sent -= skip;
+    }
+    return status;
+}
+
+bool ne7ssh_channel::write(std::string&& data, bool sendNow)
+{
+    ne7ssh_iovec iov;
+    size_t sent = 0;
+    bool status = true;
 
-    maxBytes = _session->getMaxPacket();
-    for (i = 0; len > maxBytes - 64; i++)
+    iov.data = data.data();
+    iov.length = data.size();
+    if (sendNow && _chanOutBuffer.empty())
     {
-        dataStart = maxBytes * i;
-        if (i)
-        {
-            dataStart -= 64;
-        }
-        dataBuff = SecureVector<Botan::byte>(outBuff.begin() + dataStart, maxBytes - 64);
-        _chanOutBuffer.addVector(dataBuff);
-        len -= maxBytes - 64;
+        status = sendDirect(&iov, 1, iov.length, sent);
+    }
+    if (sent < iov.length)
+    {
+        // The queue was empty if anything was sent, so the buffer becomes its front segment.
+        _chanOutBuffer.append(std::move(data));
+        _chanOutBuffer.consume(sent);
+    }
+    else if (!data.empty())
+    {
+        // Sent in full, the buffer is wiped and emptied just like a queued one.
+        Botan::clear_mem(&data[0], data.size());
+        data.clear();
+    }
+    return status;
+}
+
+uint32 ne7ssh_channel::maxDataLength()
+{
+    uint32 maxBytes = _session->getMaxPacket();
+
+    return (maxBytes > 64) ? maxBytes - 64 : maxBytes;
+}
+
+Botan::byte* ne7ssh_channel::beginDataFrame(uint32 len)
+{
+    if (!_frame.length())
+    {
+        // Sized for the largest packet, so every packet reuses the same buffer, including the room for padding and MAC.
+        _frame.reserve(SSH_FRAME_HEADROOM + channelDataHeaderMsg::fixedSize + maxDataLength() + SSH_FRAME_TAILROOM);
+    }
+    _frame.clear();
+    _frame.grow(SSH_FRAME_HEADROOM);
+    channelDataHeaderMsg::encode(_frame, _session->getSendChannel(), len);
+    return _frame.grow(len);
+}
+
+bool ne7ssh_channel::sendDirect(const ne7ssh_iovec* iov, int count, size_t total, size_t& sent)
+{
+    std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
+    size_t batched = 0, offset = 0, part;
+    uint32 len, filled;
+    Botan::byte* out;
+    bool status = true;
+    int i = 0;
+
+    sent = 0;
+    if (!_channelOpened || _closed)
+    {
+        return true;
     }
-    if (len)
+
+    // Held across the batch, so frames of another channel cannot end up in the corked write.
+    std::unique_lock<std::recursive_mutex> lock(transport->getMutex());
+    transport->cork();
+    while ((sent + batched < total) && (_windowSend > batched))
     {
-        dataStart = maxBytes * i;
-        if (i)
+        len = (uint32)std::min(std::min((size_t)_windowSend - batched, (size_t)maxDataLength()), total - sent - batched);
+        if (!len)
+        {
+            break;
+        }
+        out = beginDataFrame(len);
+        for (filled = 0; filled < len; )
+        {
+            if (offset == iov[i].length)
+            {
+                i++;
+                offset = 0;
+                continue;
+            }
+            part = std::min((size_t)(len - filled), iov[i].length - offset);
+            memcpy(out + filled, (const Botan::byte*)iov[i].data + offset, part);
+            filled += (uint32)part;
+            offset += part;
+        }
+        if (!transport->sendFrame(_frame.value()))
         {
-            dataStart -= 64;
+            status = false;
+            break;
         }
-        dataBuff = SecureVector<Botan::byte>(outBuff.begin() + dataStart, len);
-        _chanOutBuffer.addVector(dataBuff);
-        //_inBuffer.clear();
+        batched += len;
+        if (batched >= NE7SSH_SEND_BATCH)
+        {
+            if (!flushBatch(batched))
+            {
+                return false;
+            }
+            sent += batched;
+            batched = 0;
+            transport->cork();
+        }
+    }
+    if (!flushBatch(batched))
+    {
+        return false;
     }
+    sent += batched;
+    return status;
 }
 
-void ne7ssh_channel::sendAll()
+bool ne7ssh_channel::flushBatch(size_t len)
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
-    SecureVector<Botan::byte> tmpVar;
-    ne7ssh_string packet;
 
-    if (!_chanOutBuffer.length() && _delayedBuffer.length())
+    if (!transport->uncork())
     {
-        tmpVar.swap(_delayedBuffer.value());
-        _delayedBuffer.clear();
-        write(tmpVar);
+        ne7ssh::errors()->push(_session->getSshChannel(), "Failed to send data on the channel.");
+        return false;
     }
-    if (!_chanOutBuffer.length())
+    // Only data that reached the socket is taken off the send window.
+    _windowSend -= (uint32)len;
+    return true;
+}
+
+bool ne7ssh_channel::sendAll()
+{
+    std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
+    size_t batched = 0;
+    uint32 len;
+    bool status = true;
+
+    if (_chanOutBuffer.empty() || !_windowSend)
     {
-        return;
+        return true;
     }
-    packet.clear();
-    packet.addChar(SSH2_MSG_CHANNEL_DATA);
-    packet.addInt(_session->getSendChannel());
-    packet.addVectorField(_chanOutBuffer.value());
 
-    _windowSend -= _chanOutBuffer.length();
-    //_inBuffer.clear();
-    if (!transport->sendPacket(packet.value()))
+    // Small writes queued since the last pass are coalesced into full size packets, which leave in bounded batches.
+    std::unique_lock<std::recursive_mutex> lock(transport->getMutex());
+    transport->cork();
+    while ((batched < _chanOutBuffer.length()) && (_windowSend > batched))
     {
-        return;
+        len = (uint32)std::min(std::min((size_t)_windowSend - batched, (size_t)maxDataLength()), _chanOutBuffer.length() - batched);
+        if (!len)
+        {
+            break;
+        }
+        _chanOutBuffer.copy(beginDataFrame(len), len, batched);
+        if (!transport->sendFrame(_frame.value()))
+        {
+            status = false;
+            break;
+        }
+        batched += len;
+        if (batched >= NE7SSH_SEND_BATCH)
+        {
+            if (!flushBatch(batched))
+            {
+                return false;
+            }
+            _chanOutBuffer.consume(batched);
+            batched = 0;
+            transport->cork();
+        }
     }
-    else
+    if (!flushBatch(batched))
     {
-        _chanOutBuffer.clear();
+        return false;
     }
+    _chanOutBuffer.consume(batched);
+    return status;
 }
 
 bool ne7ssh_channel::adjustRecvWindow(int bufferSize)
 {
-    _windowRecv -= bufferSize;
-    if (_windowRecv == 0)
+    _windowRecv = ((uint32)bufferSize < _windowRecv) ? _windowRecv - bufferSize : 0;
+    replenishRecvWindow();
+    return true;
+}
+
+uint32 ne7ssh_channel::windowRoom()
+{
+    size_t buffered = _chanInBuffer.length() + _chanErrBuffer.length();
+
+    if (!_recvLimit)
+    {
+        return _windowSize;
+    }
+    if (buffered >= _recvLimit)
+    {
+        return 0;
+    }
+    return (uint32)std::min((size_t)_windowSize, _recvLimit - buffered);
+}
+
+void ne7ssh_channel::replenishRecvWindow()
+{
+    uint32 room = windowRoom();
+
+    // Replenishing at half the window, rather than at zero, leaves the sender enough room to keep sending while the adjustment travels.
+    if (!_closed && (room > _windowRecv) && (_windowRecv <= room / 2))
     {
         sendAdjustWindow();
     }
-    return true;
+}
+
+size_t ne7ssh_channel::readReceived(Botan::byte* out, size_t len)
+{
+    size_t copied = _chanInBuffer.read(out, len);
+
+    if (copied)
+    {
+        replenishRecvWindow();
+    }
+    return copied;
+}
+
+void ne7ssh_channel::consumeReceived(size_t len)
+{
+    _chanInBuffer.consume(len);
+    replenishRecvWindow();
+}
+
+size_t ne7ssh_channel::readStderr(Botan::byte* out, size_t len)
+{
+    size_t copied = _chanErrBuffer.read(out, len);
+
+    if (copied)
+    {
+        replenishRecvWindow();
+    }
+    return copied;
+}
+
+void ne7ssh_channel::consumeStderr(size_t len)
+{
+    _chanErrBuffer.consume(len);
+    replenishRecvWindow();
+}
+
+void ne7ssh_channel::setCallbacks(std::shared_ptr<const ne7ssh_callbacks> callbacks)
+{
+    const Botan::byte* data;
+    size_t len;
+
+    _callbacks = callbacks;
+    if (callbacks && callbacks->onData && !_chanInBuffer.empty())
+    {
+        len = _chanInBuffer.length();
+        data = _chanInBuffer.contiguous();
+        callbacks->onData(_session->getSshChannel(), (const char*)data, len);
+        consumeReceived(len);
+    }
+    if (callbacks && callbacks->onExtendedData && !_chanErrBuffer.empty())
+    {
+        len = _chanErrBuffer.length();
+        data = _chanErrBuffer.contiguous();
+        callbacks->onExtendedData(_session->getSshChannel(), 1, (const char*)data, len);
+        consumeStderr(len);
+    }
+}
+
+void ne7ssh_channel::setReceiveLimit(uint32 limit)
+{
+    _recvLimit = limit;
+    replenishRecvWindow();
+}
+
+void ne7ssh_channel::takeOverWindows(const ne7ssh_channel& channel)
+{
+    _windowRecv = channel._windowRecv;
+    _windowSize = channel._windowSize;
+    _windowGranted = channel._windowGranted;
+    _windowSend = channel._windowSend;
+    _rtt = channel._rtt;
+    _lastAdjust = channel._lastAdjust;
 }
 
@@ -18,9 +18,27 @@
 #define NE7SSH_CHANNEL_H
 
 #include "ne7ssh_string.h"
+#include "ne7ssh_reader.h"
+#include "ne7ssh_chunked_buffer.h"
+#include "ne7ssh_send_queue.h"
+#include "ne7ssh_transport.h"
+#include "ne7ssh_callbacks.h"
+#include "ne7ssh_cmd_result.h"
 #include <memory>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 class ne7ssh_session;
 
+// Receive window advertised in 'CHANNEL_OPEN' unless configured otherwise.
+#define NE7SSH_DEFAULT_WINDOW (2 * 1024 * 1024)
+// Upper limit for the configured and the auto-tuned receive window.
+#define NE7SSH_MAX_WINDOW (16 * 1024 * 1024)
+// Largest data packet the remote side may send unless configured otherwise.
+#define NE7SSH_DEFAULT_MAX_PACKET MAX_PACKET_LEN
+// Amount of outgoing data held back by cork() before it is written, so a large send window is flushed in bounded writes.
+#define NE7SSH_SEND_BATCH (64 * 1024)
+
 /**
 @author Andrew Useckas
 */
@@ -30,82 +48,169 @@ private:
     bool _eof;
     bool _closed;
     bool _cmdComplete;
+    bool _exitReceived;
     bool _shellSpawned;
+    bool _closeNotified;
 
     std::shared_ptr<ne7ssh_session> _session;
-    ne7ssh_string _chanInBuffer;
-    ne7ssh_string _chanOutBuffer;
-    ne7ssh_string _delayedBuffer;
+    std::shared_ptr<const ne7ssh_callbacks> _callbacks;
+    std::condition_variable_any _dataCond;
+    std::shared_ptr<ne7ssh_cmd_result> _cmdResult;
+    ne7ssh_chunked_buffer _chanInBuffer;
+    ne7ssh_chunked_buffer _chanErrBuffer;
+    ne7ssh_send_queue _chanOutBuffer;
+    ne7ssh_string _frame;
+
+    /**
+     * Gets the largest amount of data sent in a single 'DATA' packet.
+     * @return Maximum data length.
+     */
+    uint32 maxDataLength();
+
+    /**
+     * Starts a 'DATA' packet in the reusable frame buffer, with room for the packet header in front.
+     * @param len Length of the data the packet carries.
+     * @return Pointer to the room for the data.
+     */
+    Botan::byte* beginDataFrame(uint32 len);
+
+    /**
+     * Sends data straight from the given blocks, packing them into as few packets as the send window and the maximum packet size allow.
+     * <p>Each byte is copied once, into the frame that is encrypted in place.
+     * @param iov Array of data blocks.
+     * @param count Number of blocks.
+     * @param total Total length of all blocks.
+     * @param sent Set to the number of bytes written to the socket.
+     * @return False if writing failed, otherwise true is returned.
+     */
+    bool sendDirect(const ne7ssh_iovec* iov, int count, size_t total, size_t& sent);
+
+    /**
+     * Writes the packets held back since cork() was called, and takes their data off the send window.
+     * @param len Length of the channel data in the held back packets.
+     * @return False if writing failed, otherwise true is returned.
+     */
+    bool flushBatch(size_t len);
 
     /**
      * This function is used to handle the 'CHANNEL_OPEN_CONFIRMATION' packet.
      * <p> After parsing the payload, send channel ID is assigned, along with send windows size and maximum packer size.
-     * @return Always returns true.
+     * @param packet Reader positioned behind the command byte of the 'CHANNEL_OPEN_CONFIRMATION' packet.
+     * @return True if parsing of payload is successful, otherwise false is returned.
      */
-    bool handleChannelConfirm();
+    bool handleChannelConfirm(ne7ssh_reader& packet);
+
+    /**
+     * This function is used to handle the 'CHANNEL_OPEN_FAILURE' packet.
+     * @param packet Reader positioned behind the command byte of the 'CHANNEL_OPEN_FAILURE' packet.
+     * @return Always returns false.
+     */
+    bool handleChannelFailure(ne7ssh_reader& packet);
 
     /**
      * This function is used to handle the 'WINDOWS_ADJUST' packet.
      * <p>It's used to increase our sending window size.
-     * @param packet Reference to vector containing WINDOW_ADJUST packet.
+     * @param packet Reader positioned behind the command byte of the WINDOW_ADJUST packet.
      * @return If parsing of payload is successful, returns true, otherwise false is returned.
      */
-    bool adjustWindow(Botan::SecureVector<Botan::byte>& packet);
+    bool adjustWindow(ne7ssh_reader& packet);
 
     /**
      * This function is used to handle the 'DATA' packet.
      * <p>It's used to parse the payload, and add received data to the buffer.
-     * @param packet Reference to vector containing 'DATA' packet.
+     * @param packet Reader positioned behind the command byte of the 'DATA' packet.
      * @return If parsing of payload is successful, returns true, otherwise false is returned.
      */
-    virtual bool handleData(Botan::SecureVector<Botan::byte>& packet);
+    virtual bool handleData(ne7ssh_reader& packet);
 
     /**
-     * This function is used to handle 'EXTENDED_DATA' packet. This packet is mostly used to transmit remote side errors.
-     * @param packet Reference to vector containing 'EXTENDED_DATA' packet.
+     * This function is used to handle 'EXTENDED_DATA' packet. This packet carries the standard error stream of the remote process, which is added to its own buffer.
+     * @param packet Reader positioned behind the command byte of the 'EXTENDED_DATA' packet.
      * @return If parsing of payload is successful, returns true, otherwise false is returned.
      */
-    bool handleExtendedData(Botan::SecureVector<Botan::byte>& packet);
+    bool handleExtendedData(ne7ssh_reader& packet);
 
     /**
      * This function is used to handle the 'EOF' packet.
-     * <p>It's  used  to close the receiving window and channel.
-     * @param packet Reference to vector containing EOF packet.
+     * <p>Closes the receiving window. The channel stays readable, as exit status and 'CLOSE' usually follow the end of the output.
+     * A command counts as complete once both EOF and its exit status or signal have arrived.
+     * @param packet Reader positioned behind the command byte of the EOF packet.
      */
-    bool handleEof(Botan::SecureVector<Botan::byte>& packet);
+    bool handleEof(ne7ssh_reader& packet);
 
     /**
      * This function is used to handle the 'CLOSE' packet.
      * <p> If the close action wasn't initiated on this end, we also send a 'CLOSE' packet to the remote side, prompting the closing of remote side's receiving channel.
-     * @param packet Reference to vector containing the 'CLOSE' packet.
+     * @param packet Reader positioned behind the command byte of the 'CLOSE' packet.
      */
-    void handleClose(Botan::SecureVector<Botan::byte>& packet);
+    void handleClose(ne7ssh_reader& packet);
 
     /**
      * This function is used to handle the 'REQUEST' packet.
      * <p> At this point only two requests are supported, namely "exit-signal" and "exit-status". For the most part we ignore this packet, which is safe to do according to SSH specs.
-     * @param packet Reference to vector containing the 'REQUEST' packet.
+     * @param packet Reader positioned behind the command byte of the 'REQUEST' packet.
+     */
+    void handleRequest(ne7ssh_reader& packet);
+
+    /**
+     * Records that the exit status or signal of the remote process arrived, which completes a command whose output already ended.
      */
-    void handleRequest(Botan::SecureVector<Botan::byte>& packet);
+    void setExitReceived();
 
     /**
      * This function is used to handle the 'DISCONNECT' packet.
      * <p> In normal operation we should not get this packet. Only if some serious error occurs, and makes remote side drop the connection, will this packet be received. And at that point we disconnect right away, and throw an error.
-     * @param packet Reference to vector containing the 'DISCONNECT' packet.
+     * @param packet Reader positioned behind the command byte of the 'DISCONNECT' packet.
      */
-    bool handleDisconnect(Botan::SecureVector<Botan::byte>& packet);
+    bool handleDisconnect(ne7ssh_reader& packet);
+
+    std::chrono::steady_clock::duration _rtt;
+    std::chrono::steady_clock::time_point _lastAdjust;
+    std::chrono::steady_clock::time_point _openStart;
+    // Receive window as of the last grant, a receive limit may have kept it below _windowSize.
+    uint32 _windowGranted;
+    bool _openPending;
+    uint32 _recvLimit;
+
+    /**
+     * Calls the registered close callback, the first time the channel is found closed.
+     */
+    void notifyClose();
+
+    /**
+     * Gets the size the receive window may be refilled to.
+     * <p>Without a receive limit this is the full window size. With a limit, data still unread in the receive buffer is deducted, so the remote side stops sending once the buffer is full.
+     * @return Size the receive window may be refilled to.
+     */
+    uint32 windowRoom();
+
+    /**
+     * Sends a window adjust request if less than half of the room returned by windowRoom() is left in the receive window.
+     */
+    void replenishRecvWindow();
 
 protected:
     uint32 _windowRecv;
+    uint32 _windowSize;
     uint32 _windowSend;
 
     bool _channelOpened;
 
     /**
      * Request adjustment of the send window size on the remote end, so we can receive more data.
+     * <p> Refills the receive window to its full size, or to the room left below the receive limit. With auto-tuning enabled, the size is first raised towards twice the bandwidth-delay product,
+     * estimated from the data received since the previous adjustment and the round trip time measured when the channel was opened.
      */
     void sendAdjustWindow();
 
+    /**
+     * Hands a packet addressed to another channel on the same connection to that channel.
+     * <p> Channel messages carry the recipient channel ID, which is looked up in the transport's channel table. A 'DISCONNECT' is passed to every channel, as all of them are gone.
+     * @param payload View of the packet payload.
+     * @return True if the packet was handed to another channel, or is addressed to a channel no longer open, false if this channel has to handle it.
+     */
+    bool routeToOwner(const ne7ssh_span& payload);
+
 public:
     /**
      * ne7ssh_channel class consturctor.
@@ -125,6 +230,14 @@ public:
      */
     uint32 open(uint32 channelID);
 
+    /**
+     * Sends 'CHANNEL_OPEN' to the remote side without waiting for the reply.
+     * <p> The reply is handled by whichever thread receives next on the connection, isOpening() turns false once it arrives.
+     * @param channelID New receiving channel ID.
+     * @return False if sending fails. Otherwise true is returned.
+     */
+    bool requestOpen(uint32 channelID);
+
     /**
      * Requests shell from remote side. Does not wait for or expect a reply. According to SSH specs that's an acceptable behavior.
      */
@@ -144,21 +257,55 @@ public:
 
     /**
     * Handle a packet received from remote side.
-    * @param _packet Reference to a newly received packet.
+    * <p>The payload is parsed where the transport decrypted it, data is only copied once it is added to the receive buffer.
+    * @param payload View of the packet payload returned by ne7ssh_transport::getPayload().
     * @return True if the packet successfully processed. False on any error.
     */
-    bool handleReceived(Botan::SecureVector<Botan::byte>& _packet);
+    bool handleReceived(const ne7ssh_span& payload);
 
     /**
-     * Pushes a new command to the buffer where the selectThread will catch and send it.
-     * @param data Reference to vector containing a command to be added to the buffer.
+    * Handles a packet received from remote side on the connection this channel is multiplexed over.
+    * <p>Packets addressed to other channels on the same connection are routed to them, everything else is handled by this channel.
+    * @param payload View of the packet payload returned by ne7ssh_transport::getPayload().
+    * @return True if the packet successfully processed. False on any error on this channel.
+    */
+    bool dispatch(const ne7ssh_span& payload);
+
+    /**
+     * Sends data on the channel.
+     * <p>If nothing is queued yet, as much as the send window allows is framed straight from the given buffer. The rest is queued for the selectThread, small writes are coalesced.
+     * @param data Pointer to the data.
+     * @param len Length of the data.
+     * @param sendNow If false, all data is queued.
+     * @return False if writing to the socket failed, otherwise true is returned.
+     */
+    bool write(const Botan::byte* data, size_t len, bool sendNow = true);
+
+    /**
+     * Sends several blocks of data on the channel, as if they were a single buffer.
+     * @param iov Array of data blocks.
+     * @param count Number of blocks.
+     * @param sendNow If false, all data is queued.
+     * @return False if writing to the socket failed, otherwise true is returned.
      */
-    void write(Botan::SecureVector<Botan::byte>& data);
+    bool write(const ne7ssh_iovec* iov, int count, bool sendNow = true);
 
     /**
-     * Sends the entire buffer. Most often called from selectThread via ne7ssh_connection class.
+     * Sends a buffer on the channel, taking it over.
+     * <p>Data that cannot be sent right away is queued without being copied.
+     * @param data Buffer to send. It is left empty.
+     * @param sendNow If false, all data is queued.
+     * @return False if writing to the socket failed, otherwise true is returned.
      */
-    void sendAll();
+    bool write(std::string&& data, bool sendNow = true);
+
+    /**
+     * Sends as much of the buffer as the send window allows, split into packets of the maximum size accepted by the remote side.
+     * <p>Packets are written to the socket in batches of NE7SSH_SEND_BATCH bytes. Data is only released from the buffer once its batch was written.
+     * Most often called from selectThread via ne7ssh_connection class.
+     * @return False if writing failed, otherwise true is returned.
+     */
+    bool sendAll();
 
     /**
      * Checks if there is any data waiting to be sent. Most often called from selectThread via ne7ssh_connection class.
@@ -166,14 +313,7 @@ public:
      */
     bool data2Send()
     {
-        if (_chanOutBuffer.length() || _chanOutBuffer.length())
-        {
-            return true;
-        }
-        else
-        {
-            return false;
-        }
+        return !_chanOutBuffer.empty();
     }
 
     /**
@@ -185,6 +325,15 @@ public:
         return _channelOpened;
     }
 
+    /**
+     * Checks if an open request is still waiting for the remote side's reply.
+     * @return True if neither a confirmation nor a failure was received yet.
+     */
+    bool isOpening()
+    {
+        return _openPending && !_closed;
+    }
+
     /**
      * When closing a channel, initiates the closing procedure.
      * @return False if sending fails. Otherwise true is returned.
@@ -198,16 +347,107 @@ public:
     bool sendEof();
 
     /**
-     * Gets last received packet.
-     * @return Reference to a vector containing the last received packet.
+     * Gets all unread data received on the channel.
+     * @return Reference to the receive buffer.
+     */
+    ne7ssh_chunked_buffer& getReceived()
+    {
+        return _chanInBuffer;
+    }
+
+    /**
+     * Gets all unread standard error data received on the channel.
+     * @return Reference to the standard error buffer.
+     */
+    ne7ssh_chunked_buffer& getReceivedStderr()
+    {
+        return _chanErrBuffer;
+    }
+
+    /**
+     * Copies data from the front of the receive buffer, and releases the copied bytes.
+     * <p>If the receive window was held back by the receive limit, it is refilled.
+     * @param out Destination buffer.
+     * @param len Size of the destination buffer.
+     * @return Number of bytes copied.
+     */
+    size_t readReceived(Botan::byte* out, size_t len);
+
+    /**
+     * Releases data from the front of the receive buffer, after it was read through getReceived().
+     * <p>If the receive window was held back by the receive limit, it is refilled.
+     * @param len Number of bytes to release.
+     */
+    void consumeReceived(size_t len);
+
+    /**
+     * Blocks until data is received on the channel, or the channel is closed.
+     * @param lock Lock on the library mutex, released while waiting. It must be the only lock the calling thread holds on the mutex.
+     */
+    void waitForData(std::unique_lock<std::recursive_mutex>& lock)
+    {
+        _dataCond.wait(lock);
+    }
+
+    /**
+     * Blocks until data is received on the channel, the channel is closed, or the deadline passes.
+     * @param lock Lock on the library mutex, released while waiting. It must be the only lock the calling thread holds on the mutex.
+     * @param deadline Point in time to give up at.
+     */
+    void waitForData(std::unique_lock<std::recursive_mutex>& lock, const std::chrono::steady_clock::time_point& deadline)
+    {
+        _dataCond.wait_until(lock, deadline);
+    }
+
+    /**
+     * Wakes all threads blocked in waitForData().
+     */
+    void wakeWaiters()
+    {
+        _dataCond.notify_all();
+    }
+
+    /**
+     * Sets the result object collecting the exit status and exit signal of a command executed on the channel.
+     * @param result Shared pointer to the result, or an empty pointer to stop collecting.
      */
-    Botan::SecureVector<Botan::byte>& getReceived()
+    void setCmdResult(std::shared_ptr<ne7ssh_cmd_result> result)
     {
-        return _chanInBuffer.value();
+        _cmdResult = result;
     }
 
+    /**
+     * Registers the functions called when events arrive on the channel.
+     * <p>If a data or extended data callback is set, data already waiting in the matching buffer is passed to it right away.
+     * @param callbacks Shared pointer to the callbacks, or an empty pointer to go back to buffering.
+     */
+    void setCallbacks(std::shared_ptr<const ne7ssh_callbacks> callbacks);
+
+    /**
+     * Copies data from the front of the standard error buffer, and releases the copied bytes.
+     * @param out Destination buffer.
+     * @param len Size of the destination buffer.
+     * @return Number of bytes copied.
+     */
+    size_t readStderr(Botan::byte* out, size_t len);
+
+    /**
+     * Releases data from the front of the standard error buffer, after it was read through getReceivedStderr().
+     * @param len Number of bytes to release.
+     */
+    void consumeStderr(size_t len);
+
+    /**
+     * Limits the amount of unread data buffered on the channel.
+     * <p>Standard output and standard error data count towards the same limit.
+     * The receive window is not refilled beyond the limit, so the buffers never grow past the limit plus the window already granted to the remote side.
+     * @param limit Maximum number of unread bytes, 0 for no limit.
+     */
+    void setReceiveLimit(uint32 limit);
+
     /**
     * When executing a single command with ne7ssh::sendCmd this command is used to determine when remote side finishes the execution.
+    * <p>Execution is complete once the channel is closed, or once both EOF and the exit status or signal were received.
     * @return True if execution of the command is complete. Otherwise false.
     */
     bool getCmdComplete()
@@ -225,12 +465,18 @@ public:
     }
 
     /**
-    * Checks if receive window needs adjusting, if so send a window adjust request.
-    * @param bufferSize Current buffer size.
+    * Accounts for data received on the channel, and sends a window adjust request once half of the receive window is consumed.
+    * @param bufferSize Length of the data received.
     * @return False on any error, otherwise true.
     */
     bool adjustRecvWindow(int bufferSize);
 
+    /**
+    * Takes over the window state of another channel. Used when a subsystem takes over an open channel.
+    * @param channel Channel to copy the window state from.
+    */
+    void takeOverWindows(const ne7ssh_channel& channel);
+
     /**
     * Gets the current size of the receive window.
     * @return Size of the revceive window.
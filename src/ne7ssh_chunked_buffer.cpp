@@ -0,0 +1,155 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#include "ne7ssh_chunked_buffer.h"
+#include <algorithm>
+
+ne7ssh_chunked_buffer::ne7ssh_chunked_buffer() : _flatStart(0), _chunkStart(0), _length(0), _released(0)
+{
+}
+
+void ne7ssh_chunked_buffer::append(const Botan::byte* data, size_t len)
+{
+    size_t used, count;
+
+    _length += len;
+    while (len)
+    {
+        if (_chunks.empty() || (_chunks.back()->size() == NE7SSH_CHUNK_SIZE))
+        {
+            if (_spare)
+            {
+                _chunks.push_back(std::move(_spare));
+            }
+            else
+            {
+                _chunks.push_back(std::unique_ptr<ne7ssh_buffer>(new ne7ssh_buffer(NE7SSH_CHUNK_SIZE)));
+                _chunks.back()->clear();
+            }
+        }
+        ne7ssh_buffer& chunk = *_chunks.back();
+        used = chunk.size();
+        count = std::min(len, (size_t)NE7SSH_CHUNK_SIZE - used);
+        // The chunk was allocated at full size, growing it within that size does not reallocate.
+        chunk.resize(used + count);
+        memcpy(chunk.begin() + used, data, count);
+        data += count;
+        len -= count;
+    }
+}
+
+const Botan::byte* ne7ssh_chunked_buffer::contiguous()
+{
+    if (!_length)
+    {
+        return NULL;
+    }
+    if (!_chunks.empty())
+    {
+        ne7ssh_buffer& flat = _flat.value();
+        size_t unread = flatLength() - _flatStart;
+
+        // Moves the unread part of the copy to the front, dropping the NUL terminator.
+        if (_flatStart)
+        {
+            memmove(flat.begin(), flat.begin() + _flatStart, unread);
+            _flatStart = 0;
+        }
+        flat.resize(unread);
+        // Appends at least double the capacity when it runs out, so polling a growing buffer stays amortized linear.
+        while (!_chunks.empty())
+        {
+            _flat.addBytes(_chunks.front()->begin() + _chunkStart, _chunks.front()->size() - _chunkStart);
+            recycleChunk();
+        }
+        _flat.addChar(0x00);
+    }
+    return _flat.value().begin() + _flatStart;
+}
+
+size_t ne7ssh_chunked_buffer::read(Botan::byte* out, size_t len)
+{
+    size_t copied = 0, count, start;
+
+    len = std::min(len, _length);
+    count = std::min(len, flatLength() - _flatStart);
+    if (count)
+    {
+        memcpy(out, _flat.value().begin() + _flatStart, count);
+        copied = count;
+    }
+    for (size_t i = 0; (copied < len) && (i < _chunks.size()); i++)
+    {
+        start = i ? 0 : _chunkStart;
+        count = std::min(len - copied, _chunks[i]->size() - start);
+        memcpy(out + copied, _chunks[i]->begin() + start, count);
+        copied += count;
+    }
+    consume(copied);
+    return copied;
+}
+
+void ne7ssh_chunked_buffer::consume(size_t len)
+{
+    size_t count;
+
+    if (len >= _length)
+    {
+        clear();
+        return;
+    }
+    _length -= len;
+    _released += len;
+
+    count = std::min(len, flatLength() - _flatStart);
+    _flatStart += count;
+    len -= count;
+    if (_flatStart && (_flatStart == flatLength()))
+    {
+        _flat.clear();
+        _flatStart = 0;
+    }
+    while (len)
+    {
+        count = std::min(len, _chunks.front()->size() - _chunkStart);
+        _chunkStart += count;
+        len -= count;
+        if (_chunkStart == _chunks.front()->size())
+        {
+            recycleChunk();
+        }
+    }
+}
+
+void ne7ssh_chunked_buffer::recycleChunk()
+{
+    _spare = std::move(_chunks.front());
+    _spare->clear();
+    _chunks.pop_front();
+    _chunkStart = 0;
+}
+
+void ne7ssh_chunked_buffer::clear()
+{
+    while (!_chunks.empty())
+    {
+        recycleChunk();
+    }
+    _flat.clear();
+    _flatStart = 0;
+    _released += _length;
+    _length = 0;
+}
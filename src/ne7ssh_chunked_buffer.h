@@ -0,0 +1,126 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_CHUNKED_BUFFER_H
+#define NE7SSH_CHUNKED_BUFFER_H
+
+#include "ne7ssh_string.h"
+#include <deque>
+#include <memory>
+
+// Capacity of a single chunk of channel data.
+#define NE7SSH_CHUNK_SIZE 32768
+
+/**
+ * Byte buffer for data received on a channel.
+ * <p>Data is appended to a list of fixed size chunks, so an append never moves data received earlier.
+ * A contiguous, NUL terminated copy is only assembled when contiguous() is called, and only the chunks appended since the previous call are copied into it.
+ * Data read by the application is released from the front with consume(), so the buffer only holds unread data.
+ */
+class ne7ssh_chunked_buffer
+{
+private:
+    std::deque<std::unique_ptr<ne7ssh_buffer> > _chunks;
+    std::unique_ptr<ne7ssh_buffer> _spare;
+    ne7ssh_string _flat;
+    size_t _flatStart;
+    size_t _chunkStart;
+    size_t _length;
+    uint64 _released;
+
+    /**
+     * Gets the length of the data in the contiguous copy, including data already consumed.
+     * @return Length of the data, not counting the NUL terminator.
+     */
+    size_t flatLength()
+    {
+        return _flat.length() ? _flat.length() - 1 : 0;
+    }
+
+    /**
+     * Moves the first chunk to the spare slot, so the next append reuses its memory.
+     */
+    void recycleChunk();
+
+public:
+    /**
+     * Constructor.
+     */
+    ne7ssh_chunked_buffer();
+
+    /**
+     * Appends data to the end of the buffer.
+     * @param data Pointer to the data.
+     * @param len Length of the data.
+     */
+    void append(const Botan::byte* data, size_t len);
+
+    /**
+     * Gets a contiguous view of all data in the buffer, followed by a NUL character.
+     * <p>The view is only valid until the buffer is modified.
+     * @return Pointer to the data, or NULL if the buffer is empty.
+     */
+    const Botan::byte* contiguous();
+
+    /**
+     * Copies data from the front of the buffer, and releases the copied bytes.
+     * @param out Destination buffer.
+     * @param len Size of the destination buffer.
+     * @return Number of bytes copied.
+     */
+    size_t read(Botan::byte* out, size_t len);
+
+    /**
+     * Releases data from the front of the buffer.
+     * @param len Number of bytes to release. Larger values release all data.
+     */
+    void consume(size_t len);
+
+    /**
+     * Drops all data.
+     */
+    void clear();
+
+    /**
+     * Gets the length of the unread data in the buffer, not counting the NUL terminator added by contiguous().
+     * @return Length of the data.
+     */
+    size_t length() const
+    {
+        return _length;
+    }
+
+    /**
+     * Gets the number of bytes released from the front of the buffer since it was created.
+     * <p>Adding it to an index into the unread data gives a position in the stream, which stays valid when data is consumed.
+     * @return Number of released bytes.
+     */
+    uint64 offset() const
+    {
+        return _released;
+    }
+
+    /**
+     * Checks if the buffer holds any data.
+     * @return True if the buffer is empty, otherwise false is returned.
+     */
+    bool empty() const
+    {
+        return !_length;
+    }
+};
+
+#endif
@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_CMD_RESULT_H
+#define NE7SSH_CMD_RESULT_H
+
+#include "ne7ssh_types.h"
+#include <chrono>
+#include <string>
+
+/**
+ * Outcome of a remote command executed with ne7ssh::execCmd().
+ */
+struct ne7ssh_cmd_result
+{
+    /**
+     * True if the remote side finished the command before the timeout, otherwise false.
+     */
+    bool completed;
+
+    /**
+     * True if the remote side reported an exit status.
+     */
+    bool exitStatusReceived;
+
+    /**
+     * Exit status of the remote command, only valid if exitStatusReceived is set.
+     */
+    uint32 exitStatus;
+
+    /**
+     * Name of the signal that terminated the remote command, without the "SIG" prefix. Empty if the command was not terminated by a signal.
+     */
+    std::string exitSignal;
+
+    /**
+     * Data the command wrote to its standard output.
+     */
+    std::string stdOut;
+
+    /**
+     * Data the command wrote to its standard error.
+     */
+    std::string stdErr;
+
+    /**
+     * Wall clock time the command was sent at.
+     */
+    std::chrono::system_clock::time_point started;
+
+    /**
+     * Time from sending the command until it completed, or until the timeout.
+     */
+    std::chrono::microseconds elapsed;
+
+    /**
+     * Constructor.
+     */
+    ne7ssh_cmd_result() : completed(false), exitStatusReceived(false), exitStatus(0), elapsed(0)
+    {
+    }
+};
+
+#endif
@@ -30,69 +30,88 @@ ne7ssh_connection::ne7ssh_connection()
     _channel(new ne7ssh_channel(_session)),
     _connected(false),
     _cmdRunning(false),
-    _cmdClosed(false)
+    _cmdClosed(false),
+    _servicePending(false)
 {
     _session->_transport = _transport;
     _session->_crypto = _crypto;
 }
 
-ne7ssh_connection::~ne7ssh_connection()
+ne7ssh_connection::ne7ssh_connection(std::shared_ptr<ne7ssh_session> session, SOCKET sock)
+    : _session(session),
+    _sock(sock),
+    _thisChannel(0),
+    _crypto(session->_crypto),
+    _transport(session->_transport),
+    _channel(new ne7ssh_channel(session)),
+    _connected(false),
+    _cmdRunning(false),
+    _cmdClosed(false),
+    _servicePending(false)
 {
 }
 
-int ne7ssh_connection::connectWithPassword(uint32 channelID, const char* host, short port, const char* username, const char* password, bool shell, int timeout)
+ne7ssh_connection::~ne7ssh_connection()
 {
-    _sock = _transport->establish(host, port, timeout);
-    if (_sock == -1)
-    {
-        return -1;
-    }
+    std::shared_ptr<ne7ssh_channel> owner;
 
-    if (!checkRemoteVersion())
-    {
-        return -1;
-    }
-    if (!sendLocalVersion())
+    if (_thisChannel)
     {
-        return -1;
+        // The ID may already be reused by a channel opened after this one was closed.
+        owner = _transport->findChannel(_thisChannel);
+        if (!owner || (owner == _channel) || (owner == _sftp))
+        {
+            _transport->unregisterChannel(_thisChannel);
+        }
     }
+}
 
-    ne7ssh_kex kex(_session);
-    if (!kex.sendInit())
-    {
-        return -1;
-    }
-    if (!kex.handleInit())
+int ne7ssh_connection::startChannel(uint32 channelID, bool shell)
+{
+    _transport->registerChannel(channelID, _channel);
+    _thisChannel = _channel->open(channelID);
+    if (!_thisChannel)
     {
+        _transport->unregisterChannel(channelID);
         return -1;
     }
 
-    if (!kex.sendKexDHInit())
-    {
-        return -1;
-    }
-    if (!kex.handleKexDHReply())
+    if (shell)
     {
-        return -1;
+        _channel->getShell();
     }
 
-    if (!kex.sendKexNewKeys())
-    {
-        return -1;
-    }
+    _connected = true;
+    this->_session->setSshChannel(_thisChannel);
+    return _thisChannel;
+}
 
-    if (!requestService("ssh-userauth"))
+std::shared_ptr<ne7ssh_connection> ne7ssh_connection::openChannel(uint32 channelID)
+{
+    std::shared_ptr<ne7ssh_connection> con;
+
+    if (!_connected)
     {
-        return -1;
+        ne7ssh::errors()->push(_session->getSshChannel(), "Not connected. Cannot open a new channel.");
+        return con;
     }
-    if (!authWithPassword(username, password))
+    // Version strings, session ID and server extensions carry over, channel IDs are replaced once the channel is open.
+    con.reset(new ne7ssh_connection(std::shared_ptr<ne7ssh_session>(new ne7ssh_session(*_session)), _sock));
+    _transport->registerChannel(channelID, con->_channel);
+    // Set before the request goes out, so the destructor unregisters the channel again, whatever the outcome.
+    con->_thisChannel = channelID;
+    if (!con->_channel->requestOpen(channelID))
     {
-        return -1;
+        con.reset();
     }
+    return con;
+}
 
-    _thisChannel = _channel->open(channelID);
-    if (!_thisChannel)
+int ne7ssh_connection::completeChannel(bool shell)
+{
+    if (!_channel->isOpen())
     {
+        ne7ssh::errors()->push(-1, "New channel: %i could not be open.", _thisChannel);
         return -1;
     }
 
@@ -106,43 +125,64 @@ int ne7ssh_connection::connectWithPassword(uint32 channelID, const char* host, s
     return _thisChannel;
 }
 
-int ne7ssh_connection::connectWithKey(uint32 channelID, const char* host, short port, const char* username, const char* privKeyFileName, bool shell, int timeout)
+int ne7ssh_connection::connectWithPassword(uint32 channelID, const char* host, short port, const char* username, const char* password, bool shell, int timeout)
 {
+    _session->setRemoteHost(host, (uint16)port);
     _sock = _transport->establish(host, port, timeout);
     if (_sock == -1)
     {
         return -1;
     }
 
-    if (!checkRemoteVersion())
+    if (!keyExchange())
     {
         return -1;
     }
-    if (!sendLocalVersion())
+
+    if (!requestService("ssh-userauth", ne7ssh_impl::PIPELINED_HANDSHAKE))
     {
         return -1;
     }
-
-    ne7ssh_kex kex(_session);
-    if (!kex.sendInit())
+    if (!authWithPassword(username, password))
     {
         return -1;
     }
-    if (!kex.handleInit())
+
+    return startChannel(channelID, shell);
+}
+
+int ne7ssh_connection::connectWithKey(uint32 channelID, const char* host, short port, const char* username, const char* privKeyFileName, bool shell, int timeout)
+{
+    ne7ssh_keys keyPair;
+
+    if (!keyPair.getKeyPairFromFile(privKeyFileName))
     {
         return -1;
     }
+    return connectWithKeyPair(channelID, host, port, username, keyPair, shell, timeout);
+}
 
-    if (!kex.sendKexDHInit())
+int ne7ssh_connection::connectWithKeyData(uint32 channelID, const char* host, short port, const char* username, const char* privKey, size_t privKeyLen, bool shell, int timeout)
+{
+    ne7ssh_keys keyPair;
+
+    if (!keyPair.getKeyPairFromMemory(privKey, privKeyLen))
     {
         return -1;
     }
-    if (!kex.handleKexDHReply())
+    return connectWithKeyPair(channelID, host, port, username, keyPair, shell, timeout);
+}
+
+int ne7ssh_connection::connectWithKeyPair(uint32 channelID, const char* host, short port, const char* username, ne7ssh_keys& keyPair, bool shell, int timeout)
+{
+    _session->setRemoteHost(host, (uint16)port);
+    _sock = _transport->establish(host, port, timeout);
+    if (_sock == -1)
     {
         return -1;
     }
 
-    if (!kex.sendKexNewKeys())
+    if (!keyExchange())
     {
         return -1;
     }
@@ -151,29 +191,80 @@ int ne7ssh_connection::connectWithKey(uint32 channelID, const char* host, short
     {
         return -1;
     }
-    if (!authWithKey(username, privKeyFileName))
+    if (!authWithKey(username, keyPair))
     {
         return -1;
     }
 
-    _thisChannel = _channel->open(channelID);
-    if (!_thisChannel)
+    return startChannel(channelID, shell);
+}
+
+bool ne7ssh_connection::keyExchange()
+{
+    ne7ssh_kex kex(_session);
+
+    if (ne7ssh_impl::PIPELINED_HANDSHAKE)
     {
-        return -1;
+        _transport->cork();
+        if (!sendLocalVersion())
+        {
+            return false;
+        }
+        if (!kex.sendInitWithGuess())
+        {
+            return false;
+        }
+        if (!_transport->uncork())
+        {
+            return false;
+        }
+        if (!checkRemoteVersion())
+        {
+            return false;
+        }
+        if (!kex.waitForInit())
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (!checkRemoteVersion())
+        {
+            return false;
+        }
+        if (!sendLocalVersion())
+        {
+            return false;
+        }
+        if (!kex.sendInit())
+        {
+            return false;
+        }
     }
 
-    if (shell)
+    if (!kex.handleInit())
     {
-        _channel->getShell();
+        return false;
     }
 
-    _connected = true;
+    if (!kex.sendKexDHInit())
+    {
+        return false;
+    }
+    if (!kex.handleKexDHReply())
+    {
+        return false;
+    }
 
-    this->_session->setSshChannel(_thisChannel);
-    return _thisChannel;
+    if (!kex.sendKexNewKeys())
+    {
+        return false;
+    }
+    return true;
 }
 
-bool ne7ssh_connection::requestService(const char* service)
+bool ne7ssh_connection::requestService(const char* service, bool pipeline)
 {
     ne7ssh_string packet;
     packet.addChar(SSH2_MSG_SERVICE_REQUEST);
@@ -183,7 +274,12 @@ bool ne7ssh_connection::requestService(const char* service)
     {
         return false;
     }
-    if (!_transport->waitForPacket(SSH2_MSG_SERVICE_ACCEPT))
+    if (pipeline)
+    {
+        _servicePending = true;
+        return true;
+    }
+    if (waitForReply() != SSH2_MSG_SERVICE_ACCEPT)
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "Service request failed.");
         return false;
@@ -191,12 +287,55 @@ bool ne7ssh_connection::requestService(const char* service)
     return true;
 }
 
+bool ne7ssh_connection::handleExtInfo()
+{
+    ne7ssh_buffer response, name, value;
+    uint32 nExtensions;
+
+    _transport->getPacket(response);
+    ne7ssh_string message(response, 1);
+
+    nExtensions = message.getInt();
+    while (nExtensions--)
+    {
+        if (!message.getString(name) || !message.getString(value))
+        {
+            ne7ssh::errors()->push(_session->getSshChannel(), "Malformed SSH_MSG_EXT_INFO packet.");
+            return false;
+        }
+        if ((name.size() == 15) && !memcmp(name.begin(), "server-sig-algs", 15))
+        {
+            _session->setServerSigAlgs(value);
+        }
+    }
+    return true;
+}
+
+short ne7ssh_connection::waitForReply()
+{
+    short cmd = _transport->waitForPacket(0);
+
+    while ((cmd == SSH2_MSG_EXT_INFO) || (_servicePending && (cmd == SSH2_MSG_SERVICE_ACCEPT)))
+    {
+        if (cmd == SSH2_MSG_SERVICE_ACCEPT)
+        {
+            _servicePending = false;
+        }
+        else if (!handleExtInfo())
+        {
+            return -1;
+        }
+        cmd = _transport->waitForPacket(0);
+    }
+    return cmd;
+}
+
 bool ne7ssh_connection::authWithPassword(const char* username, const char* password)
 {
     short cmd;
-    ne7ssh_string packet;
-    SecureVector<Botan::byte> response;
-    SecureVector<Botan::byte> methods;
+    ne7ssh_secure_string packet;
+    ne7ssh_buffer response;
+    ne7ssh_buffer methods;
 
     packet.addChar(SSH2_MSG_USERAUTH_REQUEST);
     packet.addString(username);
@@ -205,22 +344,22 @@ bool ne7ssh_connection::authWithPassword(const char* username, const char* passw
     packet.addChar('\0');
     packet.addString(password);
 
-    if (!_transport->sendPacket(packet.value()))
+    if (!_transport->sendSecurePacket(packet.value()))
     {
         return false;
     }
-    cmd = _transport->waitForPacket(0);
+    cmd = waitForReply();
     if (cmd == SSH2_MSG_USERAUTH_SUCCESS)
     {
         return true;
     }
     else if (cmd == SSH2_MSG_USERAUTH_BANNER)
     {
-        if (!_transport->sendPacket(packet.value()))
+        if (!_transport->sendSecurePacket(packet.value()))
         {
             return false;
         }
-        cmd = _transport->waitForPacket(0);
+        cmd = waitForReply();
         if (cmd == SSH2_MSG_USERAUTH_SUCCESS)
         {
             return true;
@@ -242,18 +381,16 @@ bool ne7ssh_connection::authWithPassword(const char* username, const char* passw
     }
 }
 
-bool ne7ssh_connection::authWithKey(const char* username, const char* privKeyFileName)
+bool ne7ssh_connection::authWithKey(const char* username, ne7ssh_keys& keyPair)
 {
-    ne7ssh_keys keyPair;
     ne7ssh_string packet, packetBegin, packetEnd;
-    SecureVector<Botan::byte> pubKeyBlob, sigBlob;
-    if (!keyPair.getKeyPairFromFile(privKeyFileName))
-    {
-        return false;
-    }
+    ne7ssh_buffer pubKeyBlob, sigBlob;
     short cmd;
-    SecureVector<Botan::byte> response;
-    SecureVector<Botan::byte> methods;
+    ne7ssh_buffer response;
+    ne7ssh_buffer methods;
+    ne7ssh_buffer& serverSigAlgs = _session->getServerSigAlgs();
+    uint8 agreed;
+    std::string sigAlgo;
 
     packetBegin.addChar(SSH2_MSG_USERAUTH_REQUEST);
     packetBegin.addString(username);
@@ -263,11 +400,18 @@ bool ne7ssh_connection::authWithKey(const char* username, const char* privKeyFil
     switch (keyPair.getKeyAlgo())
     {
         case ne7ssh_keys::DSA:
-            packetEnd.addString("ssh-dss");
+            sigAlgo = "ssh-dss";
             break;
 
         case ne7ssh_keys::RSA:
-            packetEnd.addString("ssh-rsa");
+            if (!serverSigAlgs.empty() && _crypto->agree(agreed, ne7ssh_algorithm_list(ne7ssh_algorithms::HOSTKEY, "rsa-sha2-512,rsa-sha2-256"), serverSigAlgs.begin(), serverSigAlgs.size()))
+            {
+                sigAlgo = ne7ssh_algorithms::getName(agreed);
+            }
+            else
+            {
+                sigAlgo = "ssh-rsa";
+            }
             break;
 
         default:
@@ -280,30 +424,34 @@ bool ne7ssh_connection::authWithKey(const char* username, const char* privKeyFil
         ne7ssh::errors()->push(_session->getSshChannel(), "Invallid public key.");
         return false;
     }
+    packetEnd.addString(sigAlgo.c_str());
     packetEnd.addVectorField(pubKeyBlob);
 
-    packet.addVector(packetBegin.value());
-    packet.addChar(0x0);
-    packet.addVector(packetEnd.value());
-
-    if (!_transport->sendPacket(packet.value()))
+    if (serverSigAlgs.empty() || !_crypto->agree(agreed, ne7ssh_algorithm_list(ne7ssh_algorithms::HOSTKEY, sigAlgo.c_str()), serverSigAlgs.begin(), serverSigAlgs.size()))
     {
-        return false;
-    }
+        packet.addVector(packetBegin.value());
+        packet.addChar(0x0);
+        packet.addVector(packetEnd.value());
 
-    cmd = _transport->waitForPacket(0);
-    if (cmd == SSH2_MSG_USERAUTH_FAILURE)
-    {
-        _transport->getPacket(response);
-        ne7ssh_string message(response, 1);
-        message.getString(methods);
-        message.getByte();
-        ne7ssh::errors()->push(-1, "Authentication failed. Supported methods are: %B", &methods);
-        return false;
-    }
-    else if (cmd != SSH2_MSG_USERAUTH_PK_OK)
-    {
-        return false;
+        if (!_transport->sendPacket(packet.value()))
+        {
+            return false;
+        }
+
+        cmd = waitForReply();
+        if (cmd == SSH2_MSG_USERAUTH_FAILURE)
+        {
+            _transport->getPacket(response);
+            ne7ssh_string message(response, 1);
+            message.getString(methods);
+            message.getByte();
+            ne7ssh::errors()->push(-1, "Authentication failed. Supported methods are: %B", &methods);
+            return false;
+        }
+        else if (cmd != SSH2_MSG_USERAUTH_PK_OK)
+        {
+            return false;
+        }
     }
 
     packet.clear();
@@ -311,7 +459,7 @@ bool ne7ssh_connection::authWithKey(const char* username, const char* privKeyFil
     packet.addChar(0x1);
     packet.addVector(packetEnd.value());
 
-    sigBlob = keyPair.generateSignature(_session->getSessionID(), packet.value());
+    sigBlob = keyPair.generateSignature(_session->getSessionID(), packet.value(), sigAlgo.c_str());
     if (!sigBlob.size())
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "Failure while generating the signature.");
@@ -324,7 +472,7 @@ bool ne7ssh_connection::authWithKey(const char* username, const char* privKeyFil
         return false;
     }
 
-    cmd = _transport->waitForPacket(0);
+    cmd = waitForReply();
     if (cmd == SSH2_MSG_USERAUTH_SUCCESS)
     {
         return true;
@@ -346,10 +494,27 @@ bool ne7ssh_connection::authWithKey(const char* username, const char* privKeyFil
 
 bool ne7ssh_connection::checkRemoteVersion()
 {
-    SecureVector<Botan::byte> remoteVer, tmpVar;
-    if (!_transport->receive(remoteVer))
+    ne7ssh_buffer remoteVer, tmpVar;
+    Botan::byte* eol = 0;
+
+    // Binary packets may follow the version string in the same read, hand them back to the transport.
+    while (!eol)
     {
-        return false;
+        if (!_transport->receive(remoteVer))
+        {
+            return false;
+        }
+        eol = (Botan::byte*)memchr(remoteVer.begin(), '\n', remoteVer.size());
+        if (!eol && (remoteVer.size() > 255))
+        {
+            ne7ssh::errors()->push(_session->getSshChannel(), "Remote SSH version string is too long.");
+            return false;
+        }
+    }
+    if (eol + 1 < remoteVer.end())
+    {
+        _transport->pushBack(ne7ssh_buffer(eol + 1, remoteVer.end() - eol - 1));
+        remoteVer.resize(eol + 1 - remoteVer.begin());
     }
 
     if (remoteVer.size() < 4 || \
@@ -366,7 +531,7 @@ bool ne7ssh_connection::checkRemoteVersion()
         {
             pos--;
         }
-        tmpVar = SecureVector<Botan::byte>(remoteVer.begin(), pos - remoteVer.begin() + 1);
+        tmpVar = ne7ssh_buffer(remoteVer.begin(), pos - remoteVer.begin() + 1);
         _session->setRemoteVersion(tmpVar);
         return true;
     }
@@ -374,9 +539,9 @@ bool ne7ssh_connection::checkRemoteVersion()
 
 bool ne7ssh_connection::sendLocalVersion()
 {
-    SecureVector<Botan::byte> localVer((const Botan::byte*)ne7ssh_impl::SSH_VERSION, (uint32_t)strlen(ne7ssh_impl::SSH_VERSION));
+    ne7ssh_buffer localVer((const Botan::byte*)ne7ssh_impl::SSH_VERSION, (uint32_t)strlen(ne7ssh_impl::SSH_VERSION));
     _session->setLocalVersion(localVer);
-    localVer += SecureVector<Botan::byte>((const Botan::byte*)"\r\n", 2);
+    localVer += ne7ssh_buffer((const Botan::byte*)"\r\n", 2);
 
     if (!_transport->send(localVer))
     {
@@ -393,10 +558,25 @@ void ne7ssh_connection::handleData()
     _channel->receive();
 }
 
-void ne7ssh_connection::sendData(const char* data)
+bool ne7ssh_connection::sendData(const char* data)
+{
+    return sendData(data, strlen(data));
+}
+
+bool ne7ssh_connection::sendData(const void* data, size_t len)
+{
+    // While the sftp subsystem owns the channel, data waits in the queue as before.
+    return _channel->write((const Botan::byte*)data, len, !isSftpActive());
+}
+
+bool ne7ssh_connection::sendData(const ne7ssh_iovec* iov, int count)
+{
+    return _channel->write(iov, count, !isSftpActive());
+}
+
+bool ne7ssh_connection::sendData(std::string&& data)
 {
-    SecureVector<Botan::byte> cmd((const Botan::byte*) data, (uint32_t)strlen(data));
-    _channel->write(cmd);
+    return _channel->write(std::move(data), !isSftpActive());
 }
 
 bool ne7ssh_connection::sendCmd(const char* cmd)
@@ -413,6 +593,8 @@ std::shared_ptr<Ne7sshSftp> ne7ssh_connection::startSftp()
         return 0;
     }
     _sftp.reset(new Ne7sshSftp(_session, _channel));
+    // The subsystem takes over all packets addressed to this channel.
+    _transport->registerChannel(_thisChannel, _sftp);
 
     if (_sftp->init())
     {
@@ -420,6 +602,7 @@ std::shared_ptr<Ne7sshSftp> ne7ssh_connection::startSftp()
     }
     else
     {
+        _transport->registerChannel(_thisChannel, _channel);
         ne7ssh::errors()->push(_session->getSshChannel(), "Failure to launch remote sftp subsystem.");
     }
 
@@ -440,6 +623,7 @@ bool ne7ssh_connection::sendClose()
     if (isSftpActive())
     {
         _sftp.reset();
+        _transport->registerChannel(_thisChannel, _channel);
         status = _channel->sendClose();
         return status;
     }
@@ -22,6 +22,8 @@
 #include "ne7ssh_channel.h"
 #include "ne7ssh_sftp.h"
 
+class ne7ssh_keys;
+
 /**
 @author Andrew Useckas
 */
@@ -40,6 +42,22 @@ private:
     bool _connected;
     bool _cmdRunning;
     bool _cmdClosed;
+    bool _servicePending;
+
+    /**
+     * Constructs a connection object for an additional channel, multiplexed over the transport of an already authenticated connection.
+     * @param session Session of the new channel. Shares transport and crypto with the authenticated connection.
+     * @param sock Socket of the authenticated connection.
+     */
+    ne7ssh_connection(std::shared_ptr<ne7ssh_session> session, SOCKET sock);
+
+    /**
+     * Registers the channel with the transport, opens it, and optionally starts a shell.
+     * @param channelID ID assigned to the new channel.
+     * @param shell Set this to true if you wish to launch the shell on the remote end.
+     * @return A newly assigned channel ID, or -1 if the channel could not be opened.
+     */
+    int startChannel(uint32 channelID, bool shell);
 
     /**
      * Checks if remote side is returning a correctly formated SSH version string, and makes sure that version 2 of SSH protocol is supported by the remote side.
@@ -53,12 +71,33 @@ private:
      */
     bool sendLocalVersion();
 
+    /**
+     * Exchanges version strings and performs the key exchange.
+     * <p> With pipelined handshake enabled, the local version, KEXINIT and a guessed KEXDH_INIT are sent before the remote version is read,
+     * and the local NEWKEYS is held back to leave together with the following requests.
+     * @return True if the key exchange was successful, otherwise false is returned.
+     */
+    bool keyExchange();
+
     /**
      * Sends an SSH service request, waits for 'SERVICE_ACCEPT' packet.
      * @param service pointer to a string containing the requested SSH service. For example "ssh-userauth".
+     * @param pipeline If true, does not wait for 'SERVICE_ACCEPT'; it is consumed by the next waitForReply() call instead.
      * @return True If SERVICE_ACCEPT packet was received, otherwise false is returned.
      */
-    bool requestService(const char* service);
+    bool requestService(const char* service, bool pipeline = false);
+
+    /**
+     * Parses SSH_MSG_EXT_INFO packet received from the server, and stores the "server-sig-algs" extension with the session.
+     * @return True if the packet was parsed, otherwise false is returned.
+     */
+    bool handleExtInfo();
+
+    /**
+     * Waits for the next packet from the server, processing any SSH_MSG_EXT_INFO packets, and a pending 'SERVICE_ACCEPT', received before it.
+     * @return Command of the received packet, or -1 on communication errors.
+     */
+    short waitForReply();
 
     /**
      * Sends an authentication request of "password" type. Waits for packet 'USERAUTH_SUCESS'.
@@ -71,12 +110,27 @@ private:
     /**
      * Sends a test message to check if "publickey" authentication is allowed fo specified user.
      * If succesfull proceeds wtih generating a signature and sending real authentication packet
-     * of "publickey" type.
+     * of "publickey" type. If the server announced the chosen signature algorithm in "server-sig-algs",
+     * the test message is skipped and the signed request is sent right away.
+     * <p>RSA keys are signed with rsa-sha2-512 or rsa-sha2-256 when the server supports them, otherwise ssh-rsa is used.
      * @param username Username used for authentication.
-     * @param privKeyFileName Full path to file containing private key to be used in authentication.
+     * @param keyPair Reference to the key pair used in authentication.
      * @return True if authentication was successful, otherwise false is returned.
      */
-    bool authWithKey(const char* username, const char* privKeyFileName);
+    bool authWithKey(const char* username, ne7ssh_keys& keyPair);
+
+    /**
+     * Connects to a remote host using SSH protocol version 2, with publickey based authentication using an already loaded key pair.
+     * @param channelID ID assigned to the new channel.
+     * @param host Hostname / IP of the remote host.
+     * @param port Connection port.
+     * @param username Username to use in the authentication.
+     * @param keyPair Reference to the key pair used in authentication.
+     * @param shell Set this to true if you wish to launch the shell on the remote end.
+     * @param timeout Timeout for the connection procedure, in seconds.
+     * @return A newly assigned channel ID, or -1 if connection failed.
+     */
+    int connectWithKeyPair(uint32 channelID, const char* host, short port, const char* username, ne7ssh_keys& keyPair, bool shell, int timeout);
 
 public:
     /**
@@ -115,6 +169,36 @@ public:
      */
     int connectWithKey(uint32 channelID, const char* host, short port, const char* username, const char* privKeyFileName, bool shell = true, int timeout = 0);
 
+    /**
+     * Connects to a remote host using SSH protocol version 2, with publickey based authentication, using a private key held in memory.
+     * @param channelID ID assigned to the new channel.
+     * @param host Hostname / IP of the remote host.
+     * @param port Connection port.
+     * @param username Username to use in the authentication.
+     * @param privKey Private key, either PEM encoded or raw DER.
+     * @param privKeyLen Length of the private key data.
+     * @param shell Set this to true if you wish to launch the shell on the remote end. By default set to true.
+     * @param timeout Timeout for the connection procedure, in seconds.
+     * @return A newly assigned channel ID, or -1 if connection failed.
+     */
+    int connectWithKeyData(uint32 channelID, const char* host, short port, const char* username, const char* privKey, size_t privKeyLen, bool shell = true, int timeout = 0);
+
+    /**
+     * Requests an additional session channel on this connection. No new TCP connection, key exchange or authentication takes place.
+     * <p> The new channel has its own remote channel ID, windows and buffers, and is used through its own connection object.
+     * The call does not wait for the remote side, the confirmation is received like any other packet, and the channel is finished with completeChannel().
+     * @param channelID ID assigned to the new channel.
+     * @return Connection object of the new channel, or an empty pointer if the request could not be sent.
+     */
+    std::shared_ptr<ne7ssh_connection> openChannel(uint32 channelID);
+
+    /**
+     * Finishes a channel requested by openChannel(), once its open request was answered.
+     * @param shell Set this to true if you wish to launch the shell on the remote end.
+     * @return The channel ID, or -1 if the remote side refused the channel.
+     */
+    int completeChannel(bool shell);
+
     /**
      * Retrieves the tcp socket number.
      * @return Socket, or -1 if not connected.
@@ -132,8 +216,32 @@ public:
     /**
      * This function is used to write commands to the buffer, later to be sent to the remote site for execution.
      * @param data Pointer to a string, containing command to be written to the buffer.
+     * @return False if writing to the socket failed, otherwise true is returned.
      */
-    void sendData(const char* data);
+    bool sendData(const char* data);
+
+    /**
+     * Sends binary data on the channel. Whatever the send window does not allow right away is queued for the selectThread.
+     * @param data Pointer to the data.
+     * @param len Length of the data.
+     * @return False if writing to the socket failed, otherwise true is returned.
+     */
+    bool sendData(const void* data, size_t len);
+
+    /**
+     * Sends several blocks of data on the channel, as if they were a single buffer.
+     * @param iov Array of data blocks.
+     * @param count Number of blocks.
+     * @return False if writing to the socket failed, otherwise true is returned.
+     */
+    bool sendData(const ne7ssh_iovec* iov, int count);
+
+    /**
+     * Sends a buffer on the channel, taking it over, so queued data is not copied.
+     * @param data Buffer to send. It is left empty.
+     * @return False if writing to the socket failed, otherwise true is returned.
+     */
+    bool sendData(std::string&& data);
 
     /**
      * Sets the current SSH channel number.
@@ -164,10 +272,11 @@ public:
     /**
      * Sends the content of the buffer.,
      *<p>Usually used after data2Send returns true, executed by selectThread.
+     * @return False if writing to the socket failed, otherwise true is returned.
      */
-    void sendData()
+    bool sendData()
     {
-        _channel->sendAll();
+        return _channel->sendAll();
     }
 
     /**
@@ -193,6 +302,15 @@ public:
         return _channel->isOpen();
     }
 
+    /**
+     * Checks if the channel's open request is still waiting for the remote side's reply.
+     * @return True if the channel is still being opened.
+     */
+    bool isOpening()
+    {
+        return _channel->isOpening();
+    }
+
     /**
      * Checks if process is connected and authenticated to the remote side.
      * @return True if connected, otherwise false is returned.
@@ -203,14 +321,101 @@ public:
     }
 
     /**
-     * Retrieves the last received packet.
-     * @return A reference to a buffer containing the last received packet.
+     * Retrieves all unread data received on the channel.
+     * @return A reference to the channel's receive buffer.
      */
-    Botan::SecureVector<Botan::byte>& getReceived()
+    ne7ssh_chunked_buffer& getReceived()
     {
         return _channel->getReceived();
     }
 
+    /**
+     * Retrieves all unread standard error data received on the channel.
+     * @return A reference to the channel's standard error buffer.
+     */
+    ne7ssh_chunked_buffer& getReceivedStderr()
+    {
+        return _channel->getReceivedStderr();
+    }
+
+    /**
+     * Copies received data into a buffer, and releases the copied bytes.
+     * @param out Destination buffer.
+     * @param len Size of the destination buffer.
+     * @return Number of bytes copied.
+     */
+    size_t readReceived(Botan::byte* out, size_t len)
+    {
+        return _channel->readReceived(out, len);
+    }
+
+    /**
+     * Releases received data, after it was read through getReceived().
+     * @param len Number of bytes to release.
+     */
+    void consumeReceived(size_t len)
+    {
+        _channel->consumeReceived(len);
+    }
+
+    /**
+     * Gets the channel carrying the connection's data.
+     * @return Reference to the channel.
+     */
+    ne7ssh_channel& getChannel()
+    {
+        return *_channel;
+    }
+
+    /**
+     * Copies received standard error data into a buffer, and releases the copied bytes.
+     * @param out Destination buffer.
+     * @param len Size of the destination buffer.
+     * @return Number of bytes copied.
+     */
+    size_t readStderr(Botan::byte* out, size_t len)
+    {
+        return _channel->readStderr(out, len);
+    }
+
+    /**
+     * Releases standard error data, after it was read through getReceivedStderr().
+     * @param len Number of bytes to release.
+     */
+    void consumeStderr(size_t len)
+    {
+        _channel->consumeStderr(len);
+    }
+
+    /**
+     * Registers the functions called when events arrive on the channel.
+     * @param callbacks Shared pointer to the callbacks, or an empty pointer to go back to buffering.
+     */
+    void setCallbacks(std::shared_ptr<const ne7ssh_callbacks> callbacks)
+    {
+        _channel->setCallbacks(callbacks);
+    }
+
+    /**
+     * Limits the amount of unread data buffered on the channel.
+     * @param limit Maximum number of unread bytes, 0 for no limit.
+     */
+    void setReceiveLimit(uint32 limit)
+    {
+        _channel->setReceiveLimit(limit);
+    }
+
+    /**
+     * Retrieves the hit and miss counters of the connection's packet buffer pool.
+     * @param hits Number of packet buffers reused from the pool will be stored here.
+     * @param misses Number of packet buffers the pool had to allocate will be stored here.
+     */
+    void getPacketPoolStats(uint64& hits, uint64& misses)
+    {
+        hits = _transport->getPoolHits();
+        misses = _transport->getPoolMisses();
+    }
+
     /**
     * When executing a single command with ne7ssh::sendCmd this command is used to determine when remote side finishes the xecution.
     * @return True if execution of the command is complete. Otherwise false.
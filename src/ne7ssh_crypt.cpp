@@ -25,9 +25,53 @@
 
 #include <botan/cbc.h>
 #include <botan/look_pk.h>
+#include <algorithm>
+#include <chrono>
 
 using namespace Botan;
 
+#define NE7SSH_BENCH_BUFFER 16384
+#define NE7SSH_BENCH_MSECS  10
+
+typedef std::pair<double, std::string> algoSpeed;
+
+static bool fasterAlgo(const algoSpeed& a, const algoSpeed& b)
+{
+    return a.first > b.first;
+}
+
+static void appendAlgo(std::string& list, const char* algo)
+{
+    if (!list.empty())
+    {
+        list.push_back(',');
+    }
+    list += algo;
+}
+
+static std::string joinAlgos(std::vector<algoSpeed>& timed, const std::string& tail)
+{
+    std::string result;
+    std::stable_sort(timed.begin(), timed.end(), fasterAlgo);
+    for (size_t i = 0; i < timed.size(); i++)
+    {
+        if (!result.empty())
+        {
+            result.push_back(',');
+        }
+        result += timed[i].second;
+    }
+    if (!tail.empty())
+    {
+        if (!result.empty())
+        {
+            result.push_back(',');
+        }
+        result += tail;
+    }
+    return result;
+}
+
 ne7ssh_crypt::ne7ssh_crypt(std::shared_ptr<ne7ssh_session> session)
     : _session(session),
     _kexMethod(DH_GROUP1_SHA1),
@@ -48,251 +92,346 @@ ne7ssh_crypt::~ne7ssh_crypt()
 {
 }
 
-bool ne7ssh_crypt::agree(Botan::SecureVector<Botan::byte> &result, const char* local, Botan::SecureVector<Botan::byte> &remote)
+std::string ne7ssh_crypt::orderCiphersBySpeed(const char* algos)
 {
-    ne7ssh_string localAlgos(local, 0);
-    ne7ssh_string remoteAlgos(remote, 0);
-    char* localAlgo, * remoteAlgo;
-    bool match;
-    size_t len = 0;
+    ne7ssh_string localAlgos(algos, 0);
+    std::vector<algoSpeed> timed;
+    SecureVector<Botan::byte> buffer(NE7SSH_BENCH_BUFFER);
+    std::string legacy;
+    const char* botanName;
+    char* algo;
 
     localAlgos.split(',');
     localAlgos.resetParts();
-    remoteAlgos.split(',');
-    remoteAlgos.resetParts();
-
-    match = false;
-    do
+    while ((algo = localAlgos.nextPart()) != NULL)
     {
-        localAlgo = localAlgos.nextPart();
-        if (localAlgo != NULL)
+        double speed = 0;
+
+        // Only 128 bit block ciphers compete on speed. 64 bit block ciphers, and unknown names, keep their static order behind them.
+        if (!strcmp(algo, "aes128-cbc"))
+        {
+            botanName = "AES-128";
+        }
+        else if (!strcmp(algo, "aes192-cbc"))
         {
-            len = strlen(localAlgo);
-            do
+            botanName = "AES-192";
+        }
+        else if (!strcmp(algo, "aes256-cbc"))
+        {
+            botanName = "AES-256";
+        }
+        else if (!strcmp(algo, "twofish-cbc") || !strcmp(algo, "twofish256-cbc"))
+        {
+            botanName = "Twofish";
+        }
+        else
+        {
+            appendAlgo(legacy, algo);
+            continue;
+        }
+
+        try
+        {
+            if (botanName)
             {
-                remoteAlgo = remoteAlgos.nextPart();
-                if (remoteAlgo != NULL)
+                std::unique_ptr<BlockCipher> cipher(global_state().algorithm_factory().make_block_cipher(botanName));
+                SecureVector<Botan::byte> key(cipher->key_spec().maximum_keylength());
+                size_t blocks = NE7SSH_BENCH_BUFFER / cipher->block_size();
+                uint64 processed = 0;
+
+                cipher->set_key(key.begin(), key.size());
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::chrono::steady_clock::duration elapsed;
+                do
                 {
-                    if (!memcmp(localAlgo, remoteAlgo, len))
-                    {
-                        match = true;
-                        break;
-                    }
-                }
-            } while (remoteAlgo != NULL);
-            if (match)
-            {
-                break;
+                    cipher->encrypt_n(buffer.begin(), buffer.begin(), blocks);
+                    processed += NE7SSH_BENCH_BUFFER;
+                    elapsed = std::chrono::steady_clock::now() - start;
+                } while (elapsed < std::chrono::milliseconds(NE7SSH_BENCH_MSECS));
+                speed = processed / (double)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
             }
-            remoteAlgos.resetParts();
         }
-    } while (localAlgo != NULL);
-    if (match)
-    {
-        result = Botan::SecureVector<Botan::byte>((Botan::byte*)localAlgo, (uint32_t) len);
-        return true;
-    }
-    else
-    {
-        result.clear();
-        return false;
+        catch (const std::exception &)
+        {
+            speed = 0;
+        }
+        timed.push_back(algoSpeed(speed, algo));
     }
+
+    return joinAlgos(timed, legacy);
 }
 
-bool ne7ssh_crypt::negotiatedKex(Botan::SecureVector<Botan::byte> &kexAlgo)
+std::string ne7ssh_crypt::orderMacsBySpeed(const char* algos)
 {
-    if (!memcmp(kexAlgo.begin(), "diffie-hellman-group1-sha1", kexAlgo.size()))
+    ne7ssh_string localAlgos(algos, 0);
+    std::vector<algoSpeed> timed;
+    SecureVector<Botan::byte> buffer(NE7SSH_BENCH_BUFFER);
+    std::string legacy, tail;
+    const char* hashName;
+    char* algo;
+
+    localAlgos.split(',');
+    localAlgos.resetParts();
+    while ((algo = localAlgos.nextPart()) != NULL)
     {
-        _kexMethod = DH_GROUP1_SHA1;
-        return true;
+        double speed = 0;
+
+        // Only approved MACs compete on speed. hmac-md5, and unknown names, keep their static order behind them.
+        if (!strcmp(algo, "none"))
+        {
+            tail = algo;
+            continue;
+        }
+        else if (!strcmp(algo, "hmac-sha1"))
+        {
+            hashName = "SHA-1";
+        }
+        else
+        {
+            appendAlgo(legacy, algo);
+            continue;
+        }
+
+        try
+        {
+            if (hashName)
+            {
+                HMAC hmac(global_state().algorithm_factory().make_hash_function(hashName));
+                SecureVector<Botan::byte> key(hmac.output_length());
+                uint64 processed = 0;
+
+                hmac.set_key(key.begin(), key.size());
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::chrono::steady_clock::duration elapsed;
+                do
+                {
+                    hmac.update(buffer.begin(), buffer.size());
+                    hmac.final();
+                    processed += NE7SSH_BENCH_BUFFER;
+                    elapsed = std::chrono::steady_clock::now() - start;
+                } while (elapsed < std::chrono::milliseconds(NE7SSH_BENCH_MSECS));
+                speed = processed / (double)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+            }
+        }
+        catch (const std::exception &)
+        {
+            speed = 0;
+        }
+        timed.push_back(algoSpeed(speed, algo));
     }
-    else if (!memcmp(kexAlgo.begin(), "diffie-hellman-group14-sha1", kexAlgo.size()))
+
+    if (!tail.empty())
     {
-        _kexMethod = DH_GROUP14_SHA1;
-        return true;
+        appendAlgo(legacy, tail.c_str());
     }
+    return joinAlgos(timed, legacy);
+}
 
-    ne7ssh::errors()->push(_session->getSshChannel(), "KEX algorithm: '%B' not defined.", &kexAlgo);
-    return false;
+bool ne7ssh_crypt::agree(uint8& result, const ne7ssh_algorithm_list& local, const Botan::byte* remote, uint32 remoteLen)
+{
+    return local.agree(result, ne7ssh_algorithms::parse(local.getCategory(), remote, remoteLen));
 }
 
-bool ne7ssh_crypt::negotiatedHostkey(Botan::SecureVector<Botan::byte> &hostkeyAlgo)
+bool ne7ssh_crypt::negotiatedKex(uint8 kexAlgo)
 {
-    if (!memcmp(hostkeyAlgo.begin(), "ssh-dss", hostkeyAlgo.size()))
-    {
-        _hostkeyMethod = SSH_DSS;
-        return true;
-    }
-    else if (!memcmp(hostkeyAlgo.begin(), "ssh-rsa", hostkeyAlgo.size()))
+    switch (kexAlgo)
     {
-        _hostkeyMethod = SSH_RSA;
-        return true;
-    }
+        case ne7ssh_algorithms::KEX_DH_GROUP1_SHA1:
+            _kexMethod = DH_GROUP1_SHA1;
+            return true;
 
-    ne7ssh::errors()->push(_session->getSshChannel(), "Hostkey algorithm: '%B' not defined.", &hostkeyAlgo);
-    return false;
+        case ne7ssh_algorithms::KEX_DH_GROUP14_SHA1:
+            _kexMethod = DH_GROUP14_SHA1;
+            return true;
+
+        default:
+            ne7ssh::errors()->push(_session->getSshChannel(), "KEX algorithm: '%s' not defined.", ne7ssh_algorithms::getName(kexAlgo));
+            return false;
+    }
 }
 
-bool ne7ssh_crypt::negotiatedCryptoC2s(Botan::SecureVector<Botan::byte> &cryptoAlgo)
+bool ne7ssh_crypt::negotiatedHostkey(uint8 hostkeyAlgo)
 {
-    if (!memcmp(cryptoAlgo.begin(), "3des-cbc", cryptoAlgo.size()))
-    {
-        _c2sCryptoMethod = TDES_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "aes128-cbc", cryptoAlgo.size()))
-    {
-        _c2sCryptoMethod = AES128_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "aes192-cbc", cryptoAlgo.size()))
-    {
-        _c2sCryptoMethod = AES192_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "aes256-cbc", cryptoAlgo.size()))
-    {
-        _c2sCryptoMethod = AES256_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "blowfish-cbc", cryptoAlgo.size()))
+    switch (hostkeyAlgo)
     {
-        _c2sCryptoMethod = BLOWFISH_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "cast128-cbc", cryptoAlgo.size()))
-    {
-        _c2sCryptoMethod = CAST128_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "twofish-cbc", cryptoAlgo.size()) || !memcmp(cryptoAlgo.begin(), "twofish256-cbc", cryptoAlgo.size()))
-    {
-        _c2sCryptoMethod = TWOFISH_CBC;
-        return true;
-    }
+        case ne7ssh_algorithms::HOSTKEY_SSH_DSS:
+            _hostkeyMethod = SSH_DSS;
+            return true;
+
+        case ne7ssh_algorithms::HOSTKEY_SSH_RSA:
+            _hostkeyMethod = SSH_RSA;
+            return true;
 
-    ne7ssh::errors()->push(_session->getSshChannel(), "Cryptographic algorithm: '%B' not defined.", &cryptoAlgo);
-    return false;
+        case ne7ssh_algorithms::HOSTKEY_RSA_SHA2_256:
+            _hostkeyMethod = RSA_SHA2_256;
+            return true;
+
+        case ne7ssh_algorithms::HOSTKEY_RSA_SHA2_512:
+            _hostkeyMethod = RSA_SHA2_512;
+            return true;
+
+        default:
+            ne7ssh::errors()->push(_session->getSshChannel(), "Hostkey algorithm: '%s' not defined.", ne7ssh_algorithms::getName(hostkeyAlgo));
+            return false;
+    }
 }
 
-bool ne7ssh_crypt::negotiatedCryptoS2c(Botan::SecureVector<Botan::byte> &cryptoAlgo)
+bool ne7ssh_crypt::negotiatedCryptoC2s(uint8 cryptoAlgo)
 {
-    if (!memcmp(cryptoAlgo.begin(), "3des-cbc", cryptoAlgo.size()))
+    switch (cryptoAlgo)
     {
-        _s2cCryptoMethod = TDES_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "aes128-cbc", cryptoAlgo.size()))
-    {
-        _s2cCryptoMethod = AES128_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "aes192-cbc", cryptoAlgo.size()))
-    {
-        _s2cCryptoMethod = AES192_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "aes256-cbc", cryptoAlgo.size()))
-    {
-        _s2cCryptoMethod = AES256_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "blowfish-cbc", cryptoAlgo.size()))
-    {
-        _s2cCryptoMethod = BLOWFISH_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "cast128-cbc", cryptoAlgo.size()))
-    {
-        _s2cCryptoMethod = CAST128_CBC;
-        return true;
-    }
-    else if (!memcmp(cryptoAlgo.begin(), "twofish-cbc", cryptoAlgo.size()) || !memcmp(cryptoAlgo.begin(), "twofish256-cbc", cryptoAlgo.size()))
-    {
-        _s2cCryptoMethod = TWOFISH_CBC;
-        return true;
-    }
+        case ne7ssh_algorithms::CIPHER_3DES_CBC:
+            _c2sCryptoMethod = TDES_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_AES128_CBC:
+            _c2sCryptoMethod = AES128_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_AES192_CBC:
+            _c2sCryptoMethod = AES192_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_AES256_CBC:
+            _c2sCryptoMethod = AES256_CBC;
+            return true;
 
-    ne7ssh::errors()->push(_session->getSshChannel(), "Cryptographic method: '%B' not defined.", &cryptoAlgo);
-    return false;
+        case ne7ssh_algorithms::CIPHER_BLOWFISH_CBC:
+            _c2sCryptoMethod = BLOWFISH_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_CAST128_CBC:
+            _c2sCryptoMethod = CAST128_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_TWOFISH_CBC:
+        case ne7ssh_algorithms::CIPHER_TWOFISH256_CBC:
+            _c2sCryptoMethod = TWOFISH_CBC;
+            return true;
+
+        default:
+            ne7ssh::errors()->push(_session->getSshChannel(), "Cryptographic algorithm: '%s' not defined.", ne7ssh_algorithms::getName(cryptoAlgo));
+            return false;
+    }
 }
 
-bool ne7ssh_crypt::negotiatedMacC2s(Botan::SecureVector<Botan::byte> &macAlgo)
+bool ne7ssh_crypt::negotiatedCryptoS2c(uint8 cryptoAlgo)
 {
-    if (!memcmp(macAlgo.begin(), "hmac-sha1", macAlgo.size()))
+    switch (cryptoAlgo)
     {
-        _c2sMacMethod = HMAC_SHA1;
-        return true;
-    }
-    else if (!memcmp(macAlgo.begin(), "hmac-md5", macAlgo.size()))
-    {
-        _c2sMacMethod = HMAC_MD5;
-        return true;
-    }
-    else if (!memcmp(macAlgo.begin(), "none", macAlgo.size()))
-    {
-        _c2sMacMethod = HMAC_NONE;
-        return true;
-    }
+        case ne7ssh_algorithms::CIPHER_3DES_CBC:
+            _s2cCryptoMethod = TDES_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_AES128_CBC:
+            _s2cCryptoMethod = AES128_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_AES192_CBC:
+            _s2cCryptoMethod = AES192_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_AES256_CBC:
+            _s2cCryptoMethod = AES256_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_BLOWFISH_CBC:
+            _s2cCryptoMethod = BLOWFISH_CBC;
+            return true;
+
+        case ne7ssh_algorithms::CIPHER_CAST128_CBC:
+            _s2cCryptoMethod = CAST128_CBC;
+            return true;
 
-    ne7ssh::errors()->push(_session->getSshChannel(), "HMAC algorithm: '%B' not defined.", &macAlgo);
-    return false;
+        case ne7ssh_algorithms::CIPHER_TWOFISH_CBC:
+        case ne7ssh_algorithms::CIPHER_TWOFISH256_CBC:
+            _s2cCryptoMethod = TWOFISH_CBC;
+            return true;
+
+        default:
+            ne7ssh::errors()->push(_session->getSshChannel(), "Cryptographic method: '%s' not defined.", ne7ssh_algorithms::getName(cryptoAlgo));
+            return false;
+    }
 }
 
-bool ne7ssh_crypt::negotiatedMacS2c(Botan::SecureVector<Botan::byte> &macAlgo)
+bool ne7ssh_crypt::negotiatedMacC2s(uint8 macAlgo)
 {
-    if (!memcmp(macAlgo.begin(), "hmac-sha1", macAlgo.size()))
+    switch (macAlgo)
     {
-        _s2cMacMethod = HMAC_SHA1;
-        return true;
-    }
-    else if (!memcmp(macAlgo.begin(), "hmac-md5", macAlgo.size()))
-    {
-        _s2cMacMethod = HMAC_MD5;
-        return true;
-    }
-    else if (!memcmp(macAlgo.begin(), "none", macAlgo.size()))
-    {
-        _s2cMacMethod = HMAC_NONE;
-        return true;
-    }
+        case ne7ssh_algorithms::MAC_HMAC_SHA1:
+            _c2sMacMethod = HMAC_SHA1;
+            return true;
+
+        case ne7ssh_algorithms::MAC_HMAC_MD5:
+            _c2sMacMethod = HMAC_MD5;
+            return true;
 
-    ne7ssh::errors()->push(_session->getSshChannel(), "HMAC algorithm: '%B' not defined.", &macAlgo);
-    return false;
+        case ne7ssh_algorithms::MAC_NONE:
+            _c2sMacMethod = HMAC_NONE;
+            return true;
+
+        default:
+            ne7ssh::errors()->push(_session->getSshChannel(), "HMAC algorithm: '%s' not defined.", ne7ssh_algorithms::getName(macAlgo));
+            return false;
+    }
 }
 
-bool ne7ssh_crypt::negotiatedCmprsC2s(Botan::SecureVector<Botan::byte> &cmprsAlgo)
+bool ne7ssh_crypt::negotiatedMacS2c(uint8 macAlgo)
 {
-    if (!memcmp(cmprsAlgo.begin(), "none", cmprsAlgo.size()))
+    switch (macAlgo)
     {
-        _c2sCmprsMethod = NONE;
-        return true;
-    }
-    else if (!memcmp(cmprsAlgo.begin(), "zlib", cmprsAlgo.size()))
-    {
-        _c2sCmprsMethod = ZLIB;
-        return true;
-    }
+        case ne7ssh_algorithms::MAC_HMAC_SHA1:
+            _s2cMacMethod = HMAC_SHA1;
+            return true;
 
-    ne7ssh::errors()->push(_session->getSshChannel(), "Compression algorithm: '%B' not defined.", &cmprsAlgo);
-    return false;
+        case ne7ssh_algorithms::MAC_HMAC_MD5:
+            _s2cMacMethod = HMAC_MD5;
+            return true;
+
+        case ne7ssh_algorithms::MAC_NONE:
+            _s2cMacMethod = HMAC_NONE;
+            return true;
+
+        default:
+            ne7ssh::errors()->push(_session->getSshChannel(), "HMAC algorithm: '%s' not defined.", ne7ssh_algorithms::getName(macAlgo));
+            return false;
+    }
 }
 
-bool ne7ssh_crypt::negotiatedCmprsS2c(Botan::SecureVector<Botan::byte> &cmprsAlgo)
+bool ne7ssh_crypt::negotiatedCmprsC2s(uint8 cmprsAlgo)
 {
-    if (!memcmp(cmprsAlgo.begin(), "none", cmprsAlgo.size()))
+    switch (cmprsAlgo)
     {
-        _s2cCmprsMethod = NONE;
-        return true;
+        case ne7ssh_algorithms::CMPRS_NONE:
+            _c2sCmprsMethod = NONE;
+            return true;
+
+        case ne7ssh_algorithms::CMPRS_ZLIB:
+            _c2sCmprsMethod = ZLIB;
+            return true;
+
+        default:
+            ne7ssh::errors()->push(_session->getSshChannel(), "Compression algorithm: '%s' not defined.", ne7ssh_algorithms::getName(cmprsAlgo));
+            return false;
     }
-    else if (!memcmp(cmprsAlgo.begin(), "zlib", cmprsAlgo.size()))
+}
+
+bool ne7ssh_crypt::negotiatedCmprsS2c(uint8 cmprsAlgo)
+{
+    switch (cmprsAlgo)
     {
-        _s2cCmprsMethod = ZLIB;
-        return true;
-    }
+        case ne7ssh_algorithms::CMPRS_NONE:
+            _s2cCmprsMethod = NONE;
+            return true;
 
-    ne7ssh::errors()->push(_session->getSshChannel(), "Compression algorithm: '%B' not defined.", &cmprsAlgo);
-    return false;
+        case ne7ssh_algorithms::CMPRS_ZLIB:
+            _s2cCmprsMethod = ZLIB;
+            return true;
+
+        default:
+            ne7ssh::errors()->push(_session->getSshChannel(), "Compression algorithm: '%s' not defined.", ne7ssh_algorithms::getName(cmprsAlgo));
+            return false;
+    }
 }
 
 bool ne7ssh_crypt::getKexPublic(Botan::BigInt &publicKey)
@@ -337,7 +476,7 @@ bool ne7ssh_crypt::computeH(Botan::SecureVector<Botan::byte> &result, Botan::Sec
     return true;
 }
 
-bool ne7ssh_crypt::verifySig(Botan::SecureVector<Botan::byte> &hostKey, Botan::SecureVector<Botan::byte> &sig)
+bool ne7ssh_crypt::verifySig(ne7ssh_buffer &hostKey, ne7ssh_buffer &sig)
 {
     std::shared_ptr<DSA_PublicKey> dsaKey;
     std::shared_ptr<RSA_PublicKey> rsaKey;
@@ -362,6 +501,12 @@ bool ne7ssh_crypt::verifySig(Botan::SecureVector<Botan::byte> &hostKey, Botan::S
         ne7ssh::errors()->push(_session->getSshChannel(), "Signature without data.");
         return false;
     }
+    if (((_hostkeyMethod == RSA_SHA2_256) && ((sigType.size() != 12) || memcmp(sigType.begin(), "rsa-sha2-256", 12))) ||
+        ((_hostkeyMethod == RSA_SHA2_512) && ((sigType.size() != 12) || memcmp(sigType.begin(), "rsa-sha2-512", 12))))
+    {
+        ne7ssh::errors()->push(_session->getSshChannel(), "Host signature type: '%B' does not match the negotiated algorithm.", &sigType);
+        return false;
+    }
 
     switch (_hostkeyMethod)
     {
@@ -375,6 +520,8 @@ bool ne7ssh_crypt::verifySig(Botan::SecureVector<Botan::byte> &hostKey, Botan::S
             break;
 
         case SSH_RSA:
+        case RSA_SHA2_256:
+        case RSA_SHA2_512:
             rsaKey = getRSAKey(hostKey);
             if (!rsaKey)
             {
@@ -396,6 +543,14 @@ bool ne7ssh_crypt::verifySig(Botan::SecureVector<Botan::byte> &hostKey, Botan::S
             {
                 verifier.reset(new PK_Verifier(*dsaKey, "EMSA1(SHA-1)"));
             }
+            else if (rsaKey && (_hostkeyMethod == RSA_SHA2_256))
+            {
+                verifier.reset(new PK_Verifier(*rsaKey, "EMSA3(SHA-256)"));
+            }
+            else if (rsaKey && (_hostkeyMethod == RSA_SHA2_512))
+            {
+                verifier.reset(new PK_Verifier(*rsaKey, "EMSA3(SHA-512)"));
+            }
             else if (rsaKey)
             {
                 verifier.reset(new PK_Verifier(*rsaKey, "EMSA3(SHA-1)"));
@@ -428,7 +583,7 @@ bool ne7ssh_crypt::verifySig(Botan::SecureVector<Botan::byte> &hostKey, Botan::S
     }
 }
 
-std::shared_ptr<DSA_PublicKey> ne7ssh_crypt::getDSAKey(Botan::SecureVector<Botan::byte> &hostKey)
+std::shared_ptr<DSA_PublicKey> ne7ssh_crypt::getDSAKey(ne7ssh_buffer &hostKey)
 {
     ne7ssh_string hKey;
     SecureVector<Botan::byte> field;
@@ -441,8 +596,9 @@ std::shared_ptr<DSA_PublicKey> ne7ssh_crypt::getDSAKey(Botan::SecureVector<Botan
     {
         return 0;
     }
-    if (!negotiatedHostkey(field))
+    if ((field.size() != 7) || memcmp(field.begin(), "ssh-dss", 7))
     {
+        ne7ssh::errors()->push(_session->getSshChannel(), "Host key type: '%B' is not ssh-dss.", &field);
         return 0;
     }
 
@@ -468,7 +624,7 @@ std::shared_ptr<DSA_PublicKey> ne7ssh_crypt::getDSAKey(Botan::SecureVector<Botan
     return pubKey;
 }
 
-std::shared_ptr<RSA_PublicKey> ne7ssh_crypt::getRSAKey(Botan::SecureVector<Botan::byte> &hostKey)
+std::shared_ptr<RSA_PublicKey> ne7ssh_crypt::getRSAKey(ne7ssh_buffer &hostKey)
 {
     ne7ssh_string hKey;
     SecureVector<Botan::byte> field;
@@ -481,8 +637,9 @@ std::shared_ptr<RSA_PublicKey> ne7ssh_crypt::getRSAKey(Botan::SecureVector<Botan
     {
         return 0;
     }
-    if (!negotiatedHostkey(field))
+    if ((field.size() != 7) || memcmp(field.begin(), "ssh-rsa", 7))
     {
+        ne7ssh::errors()->push(_session->getSshChannel(), "Host key type: '%B' is not ssh-rsa.", &field);
         return 0;
     }
 
@@ -788,7 +945,7 @@ bool ne7ssh_crypt::makeNewKeys()
 bool ne7ssh_crypt::compute_key(Botan::SecureVector<Botan::byte>& key, Botan::byte ID, uint32 nBytes)
 {
     SecureVector<Botan::byte> hash, newKey;
-    ne7ssh_string hashBytes;
+    ne7ssh_secure_string hashBytes;
     HashFunction* hashIt;
     const char* algo = getHashAlgo();
     uint32 len;
@@ -830,28 +987,36 @@ bool ne7ssh_crypt::compute_key(Botan::SecureVector<Botan::byte>& key, Botan::byt
     return true;
 }
 
-bool ne7ssh_crypt::encryptPacket(Botan::SecureVector<Botan::byte> &crypted, Botan::SecureVector<Botan::byte> &hmac, Botan::SecureVector<Botan::byte> &packet, uint32 seq)
+bool ne7ssh_crypt::encryptPacket(ne7ssh_buffer &crypted, ne7ssh_buffer &packet, uint32 seq)
 {
-    SecureVector<Botan::byte> macStr;
     uint32 nSeq = (uint32)htonl(seq);
+    uint32 macLen = _hmacOut ? _hmacOut->output_length() : 0;
+    Pipe::message_id msg;
+    size_t cryptLen;
 
     _encrypt->start_msg();
     _encrypt->write(packet.begin(), packet.size());
     _encrypt->end_msg();
 //  encrypt->process_msg (packet);
-    crypted = _encrypt->read_all(_encrypt->message_count() - 1);
+    msg = _encrypt->message_count() - 1;
+    cryptLen = _encrypt->remaining(msg);
+    crypted.resize(cryptLen + macLen);
+    if (_encrypt->read(crypted.begin(), cryptLen, msg) != cryptLen)
+    {
+        return false;
+    }
 
     if (_hmacOut)
     {
-        macStr = SecureVector<Botan::byte>((Botan::byte*)&nSeq, 4);
-        macStr += packet;
-        hmac = _hmacOut->process(macStr);
+        _hmacOut->update((Botan::byte*)&nSeq, 4);
+        _hmacOut->update(packet);
+        _hmacOut->final(crypted.begin() + cryptLen);
     }
 
     return true;
 }
 
-bool ne7ssh_crypt::decryptPacket(Botan::SecureVector<Botan::byte> &decrypted, Botan::SecureVector<Botan::byte> &packet, uint32 len)
+bool ne7ssh_crypt::decryptPacket(ne7ssh_buffer &decrypted, ne7ssh_buffer &packet, uint32 len)
 {
     uint32 pLen = packet.size();
 
@@ -865,14 +1030,26 @@ bool ne7ssh_crypt::decryptPacket(Botan::SecureVector<Botan::byte> &decrypted, Bo
         len = pLen;
     }
 
-    _decrypt->process_msg(packet.begin(), len);
-    decrypted = _decrypt->read_all(_decrypt->message_count() - 1);
-    return true;
+    decrypted.clear();
+    return decryptAppend(decrypted, packet.begin(), len);
+}
+
+bool ne7ssh_crypt::decryptAppend(ne7ssh_buffer &decrypted, const Botan::byte* data, uint32 len)
+{
+    size_t used = decrypted.size();
+    size_t plainLen;
+    Pipe::message_id msg;
+
+    _decrypt->process_msg(data, len);
+    msg = _decrypt->message_count() - 1;
+    plainLen = _decrypt->remaining(msg);
+    decrypted.resize(used + plainLen);
+    return (_decrypt->read(decrypted.begin() + used, plainLen, msg) == plainLen);
 }
 
-void ne7ssh_crypt::compressData(Botan::SecureVector<Botan::byte> &buffer)
+void ne7ssh_crypt::compressData(ne7ssh_buffer &buffer)
 {
-    SecureVector<Botan::byte> tmpVar;
+    ne7ssh_buffer tmpVar;
     if (!_compress)
     {
         return;
@@ -884,9 +1061,9 @@ void ne7ssh_crypt::compressData(Botan::SecureVector<Botan::byte> &buffer)
     buffer = tmpVar;
 }
 
-void ne7ssh_crypt::decompressData(Botan::SecureVector<Botan::byte> &buffer)
+void ne7ssh_crypt::decompressData(ne7ssh_buffer &buffer)
 {
-    SecureVector<Botan::byte> tmpVar;
+    ne7ssh_buffer tmpVar;
     if (!_decompress)
     {
         return;
@@ -898,16 +1075,16 @@ void ne7ssh_crypt::decompressData(Botan::SecureVector<Botan::byte> &buffer)
     buffer = tmpVar;
 }
 
-void ne7ssh_crypt::computeMac(Botan::SecureVector<Botan::byte> &hmac, Botan::SecureVector<Botan::byte> &packet, uint32 seq)
+void ne7ssh_crypt::computeMac(ne7ssh_buffer &hmac, ne7ssh_buffer &packet, uint32 seq)
 {
-    SecureVector<Botan::byte> macStr;
     uint32 nSeq = htonl(seq);
 
     if (_hmacIn)
     {
-        macStr = SecureVector<Botan::byte>((Botan::byte*)&nSeq, 4);
-        macStr += packet;
-        hmac = _hmacIn->process(macStr);
+        _hmacIn->update((Botan::byte*)&nSeq, 4);
+        _hmacIn->update(packet);
+        hmac.resize(_hmacIn->output_length());
+        _hmacIn->final(hmac.begin());
     }
     else
     {
@@ -18,6 +18,7 @@
 #define CRYPT_H
 
 #include "ne7ssh_string.h"
+#include "ne7ssh_algorithms.h"
 
 #include <botan/dh.h>
 #include <botan/dsa.h>
@@ -45,7 +46,7 @@ private:
     enum kexMethods { DH_GROUP1_SHA1, DH_GROUP14_SHA1 };
     uint32 _kexMethod;
 
-    enum hostkeyMethods { SSH_DSS, SSH_RSA };
+    enum hostkeyMethods { SSH_DSS, SSH_RSA, RSA_SHA2_256, RSA_SHA2_512 };
     uint32 _hostkeyMethod;
 
     enum cryptoMethods { TDES_CBC, AES128_CBC, AES192_CBC, AES256_CBC, BLOWFISH_CBC, CAST128_CBC, TWOFISH_CBC };
@@ -95,14 +96,14 @@ private:
      * @param hostKey Reference to vector containing host key received from a server.
      * @return Returns newly generated DSA public Key. If host key vector is trash, more likely application will be aborted within Botan library.
      */
-    std::shared_ptr<Botan::DSA_PublicKey> getDSAKey(Botan::SecureVector<Botan::byte>& hostKey);
+    std::shared_ptr<Botan::DSA_PublicKey> getDSAKey(ne7ssh_buffer& hostKey);
 
     /**
     * Generates a new RSA public Key from n and e values extracted from the host key received from the server.
     * @param hostKey Reference to a vector containing host key.
     * @return Returns newly generated ESA public Key. If the hostkey is trash, more likely application will abort within Botan library.
     */
-    std::shared_ptr<Botan::RSA_PublicKey> getRSAKey(Botan::SecureVector<Botan::byte> &hostKey);
+    std::shared_ptr<Botan::RSA_PublicKey> getRSAKey(ne7ssh_buffer &hostKey);
 
     /**
      * Returns a string represenation of negotiated one way hash algorithm. For DH1_GROUP1_SHA1, "SHA-1" will be returned.
@@ -165,6 +166,23 @@ public:
      */
     ~ne7ssh_crypt();
 
+    /**
+     * Times the approved cipher algorithms from the list on the local CPU.
+     * <p> Only reorders the list, algorithms are never added or removed. AES and Twofish are ordered fastest first.
+     * Ciphers with 64 bit blocks (3des-cbc, blowfish-cbc, cast128-cbc) and unknown algorithms follow them in their original order, so speed never ranks them first.
+     * @param algos Comma separated list of SSH cipher algorithm names.
+     * @return The same list, approved algorithms ordered fastest first.
+     */
+    static std::string orderCiphersBySpeed(const char* algos);
+
+    /**
+     * Times the approved HMAC algorithms from the list on the local CPU.
+     * <p> Only reorders the list. hmac-md5 and unknown algorithms follow the approved ones in their original order, "none" is always kept last.
+     * @param algos Comma separated list of SSH HMAC algorithm names.
+     * @return The same list, approved algorithms ordered fastest first.
+     */
+    static std::string orderMacsBySpeed(const char* algos);
+
     /**
      * Checks if cryptographic engine has been initialized.
      * <p> The engine is initialized when all crypto and hmac keys are generated and the cryptographic Pipes are created.
@@ -213,68 +231,70 @@ public:
 
     /**
      * This function is used in negotiations of crypto, signing and HMAC algorithms.
-     * @param result Reference to a vector where negotiated algorithm name will be dumped.
-     * @param local String containing a list of localy supported algorithms, separated by commas.
-     * @param remote Reference to vector containing a list of algorithms supported by remote side, separated by commas.
+     * <p> The remote name-list is parsed in a single pass into a set of algorithm IDs, the first local algorithm in that set wins.
+     * @param result Reference to a variable where the ID of the negotiated algorithm will be stored.
+     * @param local List of localy supported algorithms, most preferred first.
+     * @param remote Pointer to a comma separated list of algorithms supported by remote side.
+     * @param remoteLen Length of the remote list.
      * @return True, if common algorithm was found, otherwise false is returned.
      */
-    bool agree(Botan::SecureVector<Botan::byte>& result, const char* local, Botan::SecureVector<Botan::byte>& remote);
+    bool agree(uint8& result, const ne7ssh_algorithm_list& local, const Botan::byte* remote, uint32 remoteLen);
 
     /**
-     * Parses negotiated key exchange algorithm vector, and registers it's integer representation with the class.
-     * @param kexAlgo Reference to a vector containing the negotiated KEX algorithm.
-     * @return True if negotiated algorithm is recognized, otherwise false is returned.
+     * Registers the integer representation of the negotiated key exchange algorithm with the class.
+     * @param kexAlgo ID of the negotiated algorithm.
+     * @return True if the algorithm is recognized, otherwise false is returned.
      */
-    bool negotiatedKex(Botan::SecureVector<Botan::byte>& kexAlgo);
+    bool negotiatedKex(uint8 kexAlgo);
 
     /**
-     * Parses negotiated host key algorithm and registers it's integer representation with the class.
-     * @param hostKeyAlgo Reference to a vector containing the negotiated host key algorithm.
-     * @return True if negotiated algorithm is recognized, otherwise false is returned.
+     * Registers the integer representation of the negotiated host key algorithm with the class.
+     * @param hostkeyAlgo ID of the negotiated algorithm.
+     * @return True if the algorithm is recognized, otherwise false is returned.
      */
-    bool negotiatedHostkey(Botan::SecureVector<Botan::byte>& hostKeyAlgo);
+    bool negotiatedHostkey(uint8 hostkeyAlgo);
 
     /**
-     * Parse negotiated client to server cipher algorithm and registers it's integer representation with the class.
-     * @param cryptoAlgo Reference to a vector containing the negotiated cipher algorithm.
-     * @return True if negotiated algorithm is recognized, otherwise false is returned.
+     * Registers the integer representation of the negotiated client to server cipher algorithm with the class.
+     * @param cryptoAlgo ID of the negotiated algorithm.
+     * @return True if the algorithm is recognized, otherwise false is returned.
      */
-    bool negotiatedCryptoC2s(Botan::SecureVector<Botan::byte>& cryptoAlgo);
+    bool negotiatedCryptoC2s(uint8 cryptoAlgo);
 
     /**
-     * Parses negotiated server to client cipher algorithm and registers it's integer representation with the class.
-     * @param cryptoAlgo Reference to a vector containing the negotiated cipher algorithm.
-     * @return True if negotiated algorithm is recognized, otherwise false is returned.
+     * Registers the integer representation of the negotiated server to client cipher algorithm with the class.
+     * @param cryptoAlgo ID of the negotiated algorithm.
+     * @return True if the algorithm is recognized, otherwise false is returned.
      */
-    bool negotiatedCryptoS2c(Botan::SecureVector<Botan::byte>& cryptoAlgo);
+    bool negotiatedCryptoS2c(uint8 cryptoAlgo);
 
     /**
-     * Parses negotiated client to server HMAC algorithm and registers it's integer representation with the class.
-     * @param macAlgo Reference to a vector containing the negotiated HMAC algorithm.
-     * @return True if negotiated algorithm is recognized, otherwise false is returned.
+     * Registers the integer representation of the negotiated client to server HMAC algorithm with the class.
+     * @param macAlgo ID of the negotiated algorithm.
+     * @return True if the algorithm is recognized, otherwise false is returned.
      */
-    bool negotiatedMacC2s(Botan::SecureVector<Botan::byte>& macAlgo);
+    bool negotiatedMacC2s(uint8 macAlgo);
 
     /**
-     * Parses negotiated server to client HMAC algorithm vector and registers it's integer representation with the class.
-     * @param macAlgo Reference to a vector containing the negotiated HMAC algorithm.
-     * @return True if negotiated algorithm is recognized, otherwise false is returned.
+     * Registers the integer representation of the negotiated server to client HMAC algorithm with the class.
+     * @param macAlgo ID of the negotiated algorithm.
+     * @return True if the algorithm is recognized, otherwise false is returned.
      */
-    bool negotiatedMacS2c(Botan::SecureVector<Botan::byte>& macAlgo);
+    bool negotiatedMacS2c(uint8 macAlgo);
 
     /**
-     * Parses negotiated client to server compression algorithm and registers it's integer representation with the class.
-     * @param cmprsAlgo Reference to a vector containing the negotiated compression algorithm.
-     * @return True if negotiated algorithm is recognized, otherwise false is returned.
+     * Registers the integer representation of the negotiated client to server compression algorithm with the class.
+     * @param cmprsAlgo ID of the negotiated algorithm.
+     * @return True if the algorithm is recognized, otherwise false is returned.
      */
-    bool negotiatedCmprsC2s(Botan::SecureVector<Botan::byte>& cmprsAlgo);
+    bool negotiatedCmprsC2s(uint8 cmprsAlgo);
 
     /**
-     * Parses negotiated server to client compression algorithm and registers it's integer representation with the class.
-     * @param cmprsAlgo Reference to a vector containing the negotiated compression algorithm.
-     * @return True if negotiated algorithm is recognized, otherwise false is returned.
+     * Registers the integer representation of the negotiated server to client compression algorithm with the class.
+     * @param cmprsAlgo ID of the negotiated algorithm.
+     * @return True if the algorithm is recognized, otherwise false is returned.
      */
-    bool negotiatedCmprsS2c(Botan::SecureVector<Botan::byte>& cmprsAlgo);
+    bool negotiatedCmprsS2c(uint8 cmprsAlgo);
 
     /**
      * Generates KEX public key.
@@ -305,7 +325,7 @@ public:
      * @param sig Regerence to vector containing the signature.
      * @return True if signature verification was successful, otherwise false is returned.
      */
-    bool verifySig(Botan::SecureVector<Botan::byte>& hostKey, Botan::SecureVector<Botan::byte>& sig);
+    bool verifySig(ne7ssh_buffer& hostKey, ne7ssh_buffer& sig);
 
     /**
      * Generates new cipher and HMAC keys.
@@ -316,13 +336,13 @@ public:
     /**
      * Encrypts a packet and generates HMAC, if enabled during negotiation.
      * <p>The entire packet is encrypted, only HMAC stays in raw format.
-     * @param crypted Encrypted packet will be dumped into this var.
-     * @param hmac HMAC will be dumped into this var.
+     * Ciphertext and HMAC are written into a single buffer, sized once, so the result can be sent as is.
+     * @param crypted Encrypted packet, followed by the HMAC, will be dumped into this var.
      * @param packet Reference to vector containing unencrypted packet.
      * @param seq Transmited packet sequence.
      * @return True if encryption successful, otherwise false is returned.
      */
-    bool encryptPacket(Botan::SecureVector<Botan::byte>& crypted, Botan::SecureVector<Botan::byte>& hmac, Botan::SecureVector<Botan::byte>& packet, uint32 seq);
+    bool encryptPacket(ne7ssh_buffer& crypted, ne7ssh_buffer& packet, uint32 seq);
 
     /**
      * Decrypts a packet.
@@ -331,7 +351,17 @@ public:
      * @param len Specifies the length of chunk to be decrypted.
      * @return True if decryption is successful, otherwise false returned.
      */
-    bool decryptPacket(Botan::SecureVector<Botan::byte>& decrypted, Botan::SecureVector<Botan::byte>& packet, uint32 len);
+    bool decryptPacket(ne7ssh_buffer& decrypted, ne7ssh_buffer& packet, uint32 len);
+
+    /**
+     * Decrypts a chunk of a packet and appends the plain text to a buffer.
+     * <p>Lets the rest of a packet be decrypted straight from the receive buffer, behind the first block that was already decrypted.
+     * @param decrypted Decrypted data will be appended to this var.
+     * @param data Pointer to the encrypted data.
+     * @param len Length of the encrypted data, a multiple of the cipher's block size.
+     * @return True if decryption is successful, otherwise false returned.
+     */
+    bool decryptAppend(ne7ssh_buffer& decrypted, const Botan::byte* data, uint32 len);
 
     /**
      * Computes HMAC from specific packet.
@@ -339,19 +369,19 @@ public:
      * @param packet Reference to vector containing packet for HMAC generation.
      * @param seq receive sequence.
      */
-    void computeMac(Botan::SecureVector<Botan::byte>& hmac, Botan::SecureVector<Botan::byte>& packet, uint32 seq);
+    void computeMac(ne7ssh_buffer& hmac, ne7ssh_buffer& packet, uint32 seq);
 
     /**
      * Compresses the data.
      * @param buffer Reference to vector containing payload to be compress. Results will also be dumped into this var.
      */
-    void compressData(Botan::SecureVector<Botan::byte>& buffer);
+    void compressData(ne7ssh_buffer& buffer);
 
     /**
      * Decompresses the data.
      * @param buffer Reference to vector containing packet payload to decompress. Result will also be dumped into this var.
      */
-    void decompressData(Botan::SecureVector<Botan::byte>& buffer);
+    void decompressData(ne7ssh_buffer& buffer);
 
     /**
      * Checks if compression is enabled.
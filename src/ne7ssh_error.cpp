@@ -39,7 +39,7 @@ bool Ne7sshError::push(int32 channel, const char* format, ...)
     bool isArg = false;
     bool isUnsigned = false;
     char converter[21];
-    SecureVector<Botan::byte>* secVec;
+    MemoryRegion<Botan::byte>* secVec;
     int32 i;
 
     if (channel < -1 || !format)
@@ -86,7 +86,7 @@ bool Ne7sshError::push(int32 channel, const char* format, ...)
                     break;
 
                 case 'B':
-                    secVec = va_arg(args, SecureVector<Botan::byte>*);
+                    secVec = va_arg(args, MemoryRegion<Botan::byte>*);
                     msgLen = secVec->size();
                     if (msgLen > MAX_ERROR_LEN)
                     {
@@ -16,9 +16,13 @@
 
 #include "ne7ssh_impl.h"
 #include "ne7ssh_connection.h"
+#include "ne7ssh_algorithms.h"
 #include "ne7ssh_rng.h"
 #include "ne7ssh_keys.h"
+#include "ne7ssh_known_hosts.h"
 #include <botan/init.h>
+#include <set>
+#include <algorithm>
 #if defined(WIN32) || defined(__MINGW32__)
 #   include <winsock.h>
 #endif
@@ -39,16 +43,23 @@ const char* ne7ssh_impl::HOSTKEY_ALGORITHMS = "ssh-dss";
 const char* ne7ssh_impl::MAC_ALGORITHMS = "hmac-md5,hmac-sha1,none";
 const char* ne7ssh_impl::CIPHER_ALGORITHMS = "aes256-cbc,aes192-cbc,twofish-cbc,twofish256-cbc,blowfish-cbc,3des-cbc,aes128-cbc,cast128-cbc";
 const char* ne7ssh_impl::KEX_ALGORITHMS = "diffie-hellman-group1-sha1,diffie-hellman-group14-sha1";
-const char* ne7ssh_impl::HOSTKEY_ALGORITHMS = "ssh-dss,ssh-rsa";
+const char* ne7ssh_impl::HOSTKEY_ALGORITHMS = "rsa-sha2-512,rsa-sha2-256,ssh-dss,ssh-rsa";
 #endif
 
 const char* ne7ssh_impl::COMPRESSION_ALGORITHMS = "none";
 std::string ne7ssh_impl::PREFERED_CIPHER;
 std::string ne7ssh_impl::PREFERED_MAC;
+std::string ne7ssh_impl::ORDERED_CIPHERS;
+std::string ne7ssh_impl::ORDERED_MACS;
+bool ne7ssh_impl::PIPELINED_HANDSHAKE = false;
+uint32 ne7ssh_impl::RECV_WINDOW_SIZE = NE7SSH_DEFAULT_WINDOW;
+uint32 ne7ssh_impl::RECV_MAX_PACKET = NE7SSH_DEFAULT_MAX_PACKET;
+bool ne7ssh_impl::RECV_WINDOW_AUTOTUNE = true;
 std::recursive_mutex ne7ssh_impl::s_mutex;
+std::shared_ptr<const ne7ssh_local_algorithms> ne7ssh_impl::s_localAlgorithms;
 volatile bool ne7ssh_impl::s_running = false;
 
-std::shared_ptr<ne7ssh_impl> ne7ssh_impl::create()
+std::shared_ptr<ne7ssh_impl> ne7ssh_impl::create(bool benchmarkAlgos)
 {
     std::shared_ptr<ne7ssh_impl> ret(new ne7ssh_impl());
     ret->_selectThread = std::thread(&ne7ssh_impl::selectThread, ret);
@@ -56,6 +67,15 @@ std::shared_ptr<ne7ssh_impl> ne7ssh_impl::create()
     {
         s_rng.reset(new ne7ssh_rng());
     }
+    if (benchmarkAlgos)
+    {
+        ORDERED_CIPHERS = ne7ssh_crypt::orderCiphersBySpeed(CIPHER_ALGORITHMS);
+        ORDERED_MACS = ne7ssh_crypt::orderMacsBySpeed(MAC_ALGORITHMS);
+    }
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        s_localAlgorithms.reset();
+    }
 
     return ret;
 }
@@ -69,6 +89,7 @@ void ne7ssh_impl::destroy()
         for (uint32 i = 0; i < _connections.size(); i++)
         {
             close(i);
+            _connections[i]->getChannel().wakeWaiters();
         }
     }
     catch (const std::system_error &ex)
@@ -80,11 +101,21 @@ void ne7ssh_impl::destroy()
 
     ne7ssh_impl::PREFERED_CIPHER.clear();
     ne7ssh_impl::PREFERED_MAC.clear();
+    ne7ssh_impl::ORDERED_CIPHERS.clear();
+    ne7ssh_impl::ORDERED_MACS.clear();
+    ne7ssh_impl::PIPELINED_HANDSHAKE = false;
+    ne7ssh_impl::RECV_WINDOW_SIZE = NE7SSH_DEFAULT_WINDOW;
+    ne7ssh_impl::RECV_MAX_PACKET = NE7SSH_DEFAULT_MAX_PACKET;
+    ne7ssh_impl::RECV_WINDOW_AUTOTUNE = true;
+    ne7ssh_impl::s_localAlgorithms.reset();
+    ne7ssh_keys::clearKeyCache();
+    ne7ssh_known_hosts::clear();
     if (s_errs)
     {
         delete (s_errs);
         s_errs = 0;
     }
+    s_rng.reset();
     _init.reset();
 }
 
@@ -132,7 +163,8 @@ void ne7ssh_impl::selectThread(std::shared_ptr<ne7ssh_impl> ssh)
             for (i = 0; i < ssh->_connections.size(); i++)
             {
                 cmdOrShell = (ssh->_connections[i]->isRemoteShell() || ssh->_connections[i]->isCmdRunning()) ? true : false;
-                if (ssh->_connections[i]->isOpen() && cmdOrShell)
+                // A channel being opened has its socket read too, its confirmation may be the only thing the connection is waiting for.
+                if ((ssh->_connections[i]->isOpen() && cmdOrShell) || ssh->_connections[i]->isOpening())
                 {
                     rfds = rfds > ssh->_connections[i]->getSocket() ? rfds : ssh->_connections[i]->getSocket();
 #if defined(WIN32)
@@ -183,10 +215,12 @@ void ne7ssh_impl::selectThread(std::shared_ptr<ne7ssh_impl> ssh)
         try
         {
             std::unique_lock<std::recursive_mutex> lock(s_mutex);
+            std::set<SOCKET> served;
 
             for (i = 0; i < ssh->_connections.size(); i++)
             {
-                if (ssh->_connections[i]->isOpen() && FD_ISSET(ssh->_connections[i]->getSocket(), &rd))
+                // Channels multiplexed over one connection share its socket, a single read serves all of them.
+                if ((ssh->_connections[i]->isOpen() || ssh->_connections[i]->isOpening()) && FD_ISSET(ssh->_connections[i]->getSocket(), &rd) && served.insert(ssh->_connections[i]->getSocket()).second)
                 {
                     ssh->_connections[i]->handleData();
                 }
@@ -199,6 +233,44 @@ void ne7ssh_impl::selectThread(std::shared_ptr<ne7ssh_impl> ssh)
     }
 }
 
+uint32 ne7ssh_impl::channelsSharing(std::shared_ptr<ne7ssh_connection> con)
+{
+    uint32 i, count = 0;
+
+    for (i = 0; i < _connections.size(); i++)
+    {
+        if ((_connections[i]->isOpen() || _connections[i]->isOpening()) && (_connections[i]->getSocket() == con->getSocket()))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool ne7ssh_impl::sftpSharing(std::shared_ptr<ne7ssh_connection> con)
+{
+    uint32 i;
+
+    for (i = 0; i < _connections.size(); i++)
+    {
+        if (_connections[i]->isSftpActive() && (_connections[i]->getSocket() == con->getSocket()))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ne7ssh_impl::onSelectThread(const char* function)
+{
+    if (std::this_thread::get_id() != _selectThread.get_id())
+    {
+        return false;
+    }
+    s_errs->push(-1, "%s cannot be called from a channel callback.", function);
+    return true;
+}
+
 int ne7ssh_impl::connectWithPassword(const char* host, const short port, const char* username, const char* password, bool shell, const int timeout)
 {
     int channel;
@@ -301,9 +373,67 @@ int ne7ssh_impl::connectWithKey(const char* host, const short port, const char*
     return channel;
 }
 
-bool ne7ssh_impl::send(const char* data, int channel)
+int ne7ssh_impl::connectWithKeyData(const char* host, const short port, const char* username, const char* privKey, size_t privKeyLen, bool shell, const int timeout)
 {
-    uint32 i;
+    int channel;
+    uint32 currentRecord = 0, z;
+    uint32 channelID;
+
+    std::shared_ptr<ne7ssh_connection> con(new ne7ssh_connection());
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        _connections.push_back(con);
+        channelID = getChannelNo();
+        con->setChannelNo(channelID);
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock in connectWithKeyData %s.", ex.what());
+        return -1;
+    }
+
+    channel = con->connectWithKeyData(channelID, host, port, username, privKey, privKeyLen, shell, timeout);
+
+    if (channel == -1)
+    {
+        try
+        {
+            std::unique_lock<std::recursive_mutex> lock(s_mutex);
+            for (z = 0; z < _connections.size(); z++)
+            {
+                if (_connections[z] == con)
+                {
+                    currentRecord = z;
+                    break;
+                }
+            }
+            if (z == _connections.size())
+            {
+                ne7ssh_impl::errors()->push(-1, "Unexpected behaviour!");
+                return -1;
+            }
+            _connections.erase(_connections.begin() + currentRecord);
+        }
+        catch (const std::system_error &ex)
+        {
+            s_errs->push(-1, "Unable to get lock in connectWithKeyData %s.", ex.what());
+            return -1;
+        }
+    }
+    return channel;
+}
+
+int ne7ssh_impl::openChannel(int channel, bool shell)
+{
+    uint32 i, channelID;
+    int result;
+    std::shared_ptr<ne7ssh_connection> con;
+
+    if (onSelectThread("openChannel"))
+    {
+        return -1;
+    }
     try
     {
         std::unique_lock<std::recursive_mutex> lock(s_mutex);
@@ -311,25 +441,60 @@ bool ne7ssh_impl::send(const char* data, int channel)
         {
             if (channel == _connections[i]->getChannelNo())
             {
-                _connections[i]->sendData(data);
-                return true;
+                break;
+            }
+        }
+        if (i == _connections.size())
+        {
+            s_errs->push(-1, "Bad channel: %i specified for opening a new channel.", channel);
+            return -1;
+        }
+        if (sftpSharing(_connections[i]))
+        {
+            s_errs->push(-1, "SFTP subsystem is running on channel: %i. No other channel can be opened on its connection.", channel);
+            return -1;
+        }
+        channelID = getChannelNo();
+        if (!channelID)
+        {
+            return -1;
+        }
+        con = _connections[i]->openChannel(channelID);
+        if (!con)
+        {
+            return -1;
+        }
+        // Listed right away, so the ID stays reserved and the select thread receives the confirmation while the lock is released.
+        con->setChannelNo(channelID);
+        _connections.push_back(con);
+        while (s_running && con->isOpening())
+        {
+            con->getChannel().waitForData(lock);
+        }
+        result = con->completeChannel(shell);
+        if (result == -1)
+        {
+            for (i = 0; i < _connections.size(); i++)
+            {
+                if (_connections[i] == con)
+                {
+                    _connections.erase(_connections.begin() + i);
+                    break;
+                }
             }
         }
     }
     catch (const std::system_error &ex)
     {
-        s_errs->push(-1, "Unable to get lock %s", ex.what());
-        return false;
+        s_errs->push(-1, "Unable to get lock in openChannel %s.", ex.what());
+        return -1;
     }
-    s_errs->push(-1, "Bad channel: %i specified for sending.", channel);
-    return false;
+    return result;
 }
 
-bool ne7ssh_impl::initSftp(Ne7SftpSubsystem& sftpSubsys, int channel)
+bool ne7ssh_impl::send(const char* data, int channel)
 {
     uint32 i;
-    std::shared_ptr<Ne7sshSftp> sftp;
-
     try
     {
         std::unique_lock<std::recursive_mutex> lock(s_mutex);
@@ -337,17 +502,7 @@ bool ne7ssh_impl::initSftp(Ne7SftpSubsystem& sftpSubsys, int channel)
         {
             if (channel == _connections[i]->getChannelNo())
             {
-                sftp = _connections[i]->startSftp();
-                if (!sftp)
-                {
-                    return false;
-                }
-                else
-                {
-                    Ne7SftpSubsystem sftpSubsystem(sftp);
-                    sftpSubsys = sftpSubsystem;
-                    return true;
-                }
+                return _connections[i]->sendData(data);
             }
         }
     }
@@ -356,20 +511,18 @@ bool ne7ssh_impl::initSftp(Ne7SftpSubsystem& sftpSubsys, int channel)
         s_errs->push(-1, "Unable to get lock %s", ex.what());
         return false;
     }
-
-    s_errs->push(-1, "Bad channel: %i specified. Cannot initialize SFTP subsystem.", channel);
+    s_errs->push(-1, "Bad channel: %i specified for sending.", channel);
     return false;
 }
 
-bool ne7ssh_impl::sendCmd(const char* cmd, int channel, int timeout)
+bool ne7ssh_impl::send(const void* data, size_t len, int channel)
 {
     uint32 i;
-    time_t cutoff = 0;
-    bool status;
 
-    if (timeout)
+    if (!data && len)
     {
-        cutoff = time(NULL) + timeout;
+        s_errs->push(-1, "Bad data specified for sending on channel: %i.", channel);
+        return false;
     }
     try
     {
@@ -378,69 +531,7 @@ bool ne7ssh_impl::sendCmd(const char* cmd, int channel, int timeout)
         {
             if (channel == _connections[i]->getChannelNo())
             {
-                status = _connections[i]->sendCmd(cmd);
-                if (!status)
-                {
-                    return false;
-                }
-
-                if (!timeout)
-                {
-                    while (!_connections[i]->getCmdComplete())
-                    {
-                        for (i = 0; i < _connections.size(); i++)
-                        {
-                            if (channel == _connections[i]->getChannelNo())
-                            {
-                                break;
-                            }
-                        }
-                        if (i == _connections.size())
-                        {
-                            s_errs->push(-1, "Bad channel: %i specified for sending.", channel);
-                            return false;
-                        }
-                        if (!_connections[i]->getCmdComplete())
-                        {
-                            s_mutex.unlock();
-                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                            s_mutex.lock();
-                        }
-                    }
-                }
-                else if (timeout > 0)
-                {
-                    while (!_connections[i]->getCmdComplete())
-                    {
-                        for (i = 0; i < _connections.size(); i++)
-                        {
-                            if (channel == _connections[i]->getChannelNo())
-                            {
-                                break;
-                            }
-                        }
-                        if (i == _connections.size())
-                        {
-                            s_errs->push(-1, "Bad channel: %i specified for sending.", channel);
-                            return false;
-                        }
-                        if (!_connections[i]->getCmdComplete())
-                        {
-                            s_mutex.unlock();
-                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                            s_mutex.lock();
-                            if (!cutoff)
-                            {
-                                continue;
-                            }
-                            if (time(NULL) >= cutoff)
-                            {
-                                break;
-                            }
-                        }
-                    }
-                }
-                return true;
+                return _connections[i]->sendData(data, len);
             }
         }
     }
@@ -453,14 +544,13 @@ bool ne7ssh_impl::sendCmd(const char* cmd, int channel, int timeout)
     return false;
 }
 
-bool ne7ssh_impl::close(int channel)
+bool ne7ssh_impl::sendv(const ne7ssh_iovec* iov, int count, int channel)
 {
     uint32 i;
-    bool status = false;
 
-    if (channel == -1)
+    if ((count < 0) || (!iov && count))
     {
-        s_errs->push(-1, "Bad channel: %i specified for closing.", channel);
+        s_errs->push(-1, "Bad data specified for sending on channel: %i.", channel);
         return false;
     }
     try
@@ -470,100 +560,92 @@ bool ne7ssh_impl::close(int channel)
         {
             if (channel == _connections[i]->getChannelNo())
             {
-                status = _connections[i]->sendClose();
+                return _connections[i]->sendData(iov, count);
             }
         }
-        s_errs->deleteChannel(channel);
     }
     catch (const std::system_error &ex)
     {
         s_errs->push(-1, "Unable to get lock %s", ex.what());
         return false;
     }
-
-    return status;
+    s_errs->push(-1, "Bad channel: %i specified for sending.", channel);
+    return false;
 }
 
-bool ne7ssh_impl::waitFor(int channel, const char* str, uint32 timeSec)
+bool ne7ssh_impl::send(std::string&& data, int channel)
 {
-    Botan::byte one;
-    const Botan::byte* carret;
-    const char* buffer;
-    size_t len = 0, carretLen = 0, str_len = 0, prevLen = 0;
-    time_t cutoff = 0;
-
-    if (timeSec)
+    uint32 i;
+    try
     {
-        cutoff = time(NULL) + timeSec;
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                return _connections[i]->sendData(std::move(data));
+            }
+        }
     }
-
-    if (channel == -1)
+    catch (const std::system_error &ex)
     {
-        s_errs->push(-1, "Bad channel: %i specified for waiting.", channel);
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
         return false;
     }
+    s_errs->push(-1, "Bad channel: %i specified for sending.", channel);
+    return false;
+}
 
-    str_len = strlen(str);
+bool ne7ssh_impl::initSftp(Ne7SftpSubsystem& sftpSubsys, int channel)
+{
+    uint32 i;
+    std::shared_ptr<Ne7sshSftp> sftp;
 
-    while (s_running)
+    try
     {
-        try
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
         {
-            std::unique_lock<std::recursive_mutex> lock(s_mutex);
-            buffer = read(channel);
-            if (buffer)
+            if (channel == _connections[i]->getChannelNo())
             {
-                len = getReceivedSize(channel);
-                if (!(cutoff && prevLen && len == prevLen))
+                // The subsystem reads and writes the socket from the caller's thread, it cannot share the connection with channels served by the select thread.
+                if (channelsSharing(_connections[i]) > 1)
                 {
-                    prevLen = len;
+                    s_errs->push(-1, "Other channels are open on the connection of channel: %i. Cannot initialize SFTP subsystem.", channel);
+                    return false;
                 }
-                carret = (const Botan::byte*) buffer + len - 1;
-                one = *str;
-                carretLen = 1;
-
-                while (carretLen <= len)
+                sftp = _connections[i]->startSftp();
+                if (!sftp)
                 {
-                    if ((*carret == one) && (str_len <= carretLen))
-                    {
-                        if (!memcmp(carret, str, str_len))
-                        {
-                            return true;
-                        }
-                    }
-                    carretLen++;
-                    carret--;
+                    return false;
+                }
+                else
+                {
+                    Ne7SftpSubsystem sftpSubsystem(sftp);
+                    sftpSubsys = sftpSubsystem;
+                    return true;
                 }
             }
         }
-        catch (const std::system_error &ex)
-        {
-            s_errs->push(-1, "Unable to get lock %s", ex.what());
-            return false;
-        }
-
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        if (!cutoff)
-        {
-            continue;
-        }
-        if (time(NULL) >= cutoff)
-        {
-            break;
-        }
     }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+
+    s_errs->push(-1, "Bad channel: %i specified. Cannot initialize SFTP subsystem.", channel);
     return false;
 }
 
-const char* ne7ssh_impl::read(int channel)
+bool ne7ssh_impl::sendCmd(const char* cmd, int channel, int timeout)
 {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
     uint32 i;
-    SecureVector<Botan::byte> data;
 
-    if (channel == -1)
+    if (onSelectThread("sendCmd"))
     {
-        s_errs->push(-1, "Bad channel: %i specified for reading.", channel);
-        return NULL;
+        return false;
     }
     try
     {
@@ -572,67 +654,578 @@ const char* ne7ssh_impl::read(int channel)
         {
             if (channel == _connections[i]->getChannelNo())
             {
-                data = _connections[i]->getReceived();
-                if (data.size())
+                std::shared_ptr<ne7ssh_connection> con = _connections[i];
+                if (!con->sendCmd(cmd))
+                {
+                    return false;
+                }
+                if (timeout >= 0)
                 {
-                    return ((const char*)_connections[i]->getReceived().begin());
+                    waitForCmd(con, lock, timeout ? &deadline : NULL);
                 }
+                return true;
             }
         }
     }
     catch (const std::system_error &ex)
     {
         s_errs->push(-1, "Unable to get lock %s", ex.what());
-        return NULL;
+        return false;
     }
-
-    return NULL;
+    s_errs->push(-1, "Bad channel: %i specified for sending.", channel);
+    return false;
 }
 
-int ne7ssh_impl::getReceivedSize(int channel)
+std::shared_ptr<ne7ssh_cmd_result> ne7ssh_impl::execCmd(const char* cmd, int channel, uint32 timeoutMs)
 {
+    std::shared_ptr<ne7ssh_cmd_result> result;
+    std::chrono::steady_clock::time_point start, deadline;
     uint32 i;
-    int size;
+
+    if (onSelectThread("execCmd"))
+    {
+        return result;
+    }
     try
     {
         std::unique_lock<std::recursive_mutex> lock(s_mutex);
-
         for (i = 0; i < _connections.size(); i++)
         {
             if (channel == _connections[i]->getChannelNo())
             {
-                if (!_connections[i]->getReceived().size())
-                {
-                    return 0;
-                }
-                else
+                std::shared_ptr<ne7ssh_connection> con = _connections[i];
+
+                // Output left over from earlier use of the channel does not belong to this command.
+                con->consumeReceived(con->getReceived().length());
+                con->consumeStderr(con->getReceivedStderr().length());
+                result.reset(new ne7ssh_cmd_result());
+                result->started = std::chrono::system_clock::now();
+                start = std::chrono::steady_clock::now();
+                deadline = start + std::chrono::milliseconds(timeoutMs);
+                con->getChannel().setCmdResult(result);
+                if (!con->sendCmd(cmd))
                 {
-                    size = _connections[i]->getReceived().size();
-                    return (size);
+                    con->getChannel().setCmdResult(std::shared_ptr<ne7ssh_cmd_result>());
+                    return std::shared_ptr<ne7ssh_cmd_result>();
                 }
+
+                result->completed = waitForCmd(con, lock, timeoutMs ? &deadline : NULL, result.get());
+                result->elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                con->getChannel().setCmdResult(std::shared_ptr<ne7ssh_cmd_result>());
+                return result;
             }
         }
     }
     catch (const std::system_error &ex)
     {
         s_errs->push(-1, "Unable to get lock %s", ex.what());
-        return false;
+        return std::shared_ptr<ne7ssh_cmd_result>();
     }
-
-    return 0;
+    s_errs->push(-1, "Bad channel: %i specified for sending.", channel);
+    return std::shared_ptr<ne7ssh_cmd_result>();
 }
 
-uint32 ne7ssh_impl::getChannelNo()
+bool ne7ssh_impl::waitForCmd(std::shared_ptr<ne7ssh_connection> con, std::unique_lock<std::recursive_mutex>& lock, const std::chrono::steady_clock::time_point* deadline, ne7ssh_cmd_result* output)
 {
-    uint32 i;
-    int32 channelID = 1;
+    bool completed;
 
-    if (_connections.size() == 0)
+    // The reading thread signals the channel on data, EOF, exit status and close, so the wait costs nothing while the command runs.
+    while (s_running && !con->getCmdComplete() && con->isOpen())
     {
-        return channelID;
-    }
-
-    for (channelID = 1; channelID != 0x7FFFFFFF; channelID++)
+        if (output)
+        {
+            drainCmdOutput(con, output);
+        }
+        if (!deadline)
+        {
+            con->getChannel().waitForData(lock);
+        }
+        else if (std::chrono::steady_clock::now() < *deadline)
+        {
+            con->getChannel().waitForData(lock, *deadline);
+        }
+        else
+        {
+            break;
+        }
+    }
+    completed = con->getCmdComplete() || !con->isOpen();
+    if (output)
+    {
+        drainCmdOutput(con, output);
+    }
+    return completed;
+}
+
+void ne7ssh_impl::drainCmdOutput(std::shared_ptr<ne7ssh_connection> con, ne7ssh_cmd_result* output)
+{
+    size_t len;
+
+    len = con->getReceived().length();
+    if (len)
+    {
+        output->stdOut.append((const char*)con->getReceived().contiguous(), len);
+        con->consumeReceived(len);
+    }
+    len = con->getReceivedStderr().length();
+    if (len)
+    {
+        output->stdErr.append((const char*)con->getReceivedStderr().contiguous(), len);
+        con->consumeStderr(len);
+    }
+}
+
+bool ne7ssh_impl::close(int channel)
+{
+    uint32 i;
+    bool status = false;
+
+    if (channel == -1)
+    {
+        s_errs->push(-1, "Bad channel: %i specified for closing.", channel);
+        return false;
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                status = _connections[i]->sendClose();
+            }
+        }
+        s_errs->deleteChannel(channel);
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+
+    return status;
+}
+
+bool ne7ssh_impl::waitFor(int channel, const char* str, uint32 timeSec)
+{
+    return waitForMs(channel, str, (timeSec > UINT32_MAX / 1000) ? UINT32_MAX : timeSec * 1000);
+}
+
+bool ne7ssh_impl::waitForMs(int channel, const char* str, uint32 timeoutMs)
+{
+    std::shared_ptr<ne7ssh_connection> con;
+    std::chrono::steady_clock::time_point deadline;
+    const Botan::byte* buffer;
+    size_t len, start, strLen;
+    uint64 scanned = 0;
+    uint32 i;
+
+    if (onSelectThread("waitFor"))
+    {
+        return false;
+    }
+    if (channel == -1)
+    {
+        s_errs->push(-1, "Bad channel: %i specified for waiting.", channel);
+        return false;
+    }
+
+    strLen = strlen(str);
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                con = _connections[i];
+                break;
+            }
+        }
+        if (!con)
+        {
+            s_errs->push(-1, "Bad channel: %i specified for waiting.", channel);
+            return false;
+        }
+
+        while (s_running)
+        {
+            ne7ssh_chunked_buffer& received = con->getReceived();
+
+            // Only data not scanned yet is searched, overlapping the previous scan by the length of the string minus one.
+            len = received.length();
+            start = (scanned > received.offset()) ? (size_t)(scanned - received.offset()) : 0;
+            if (len && (len >= strLen) && (start <= len - strLen))
+            {
+                buffer = received.contiguous();
+                if (std::search(buffer + start, buffer + len, (const Botan::byte*)str, (const Botan::byte*)str + strLen) != buffer + len)
+                {
+                    return true;
+                }
+                start = len - strLen + 1;
+            }
+            scanned = received.offset() + start;
+
+            if (!con->isOpen() || (timeoutMs && (std::chrono::steady_clock::now() >= deadline)))
+            {
+                return false;
+            }
+            // The reading thread signals the channel when data arrives, data received while waiting is searched on the next pass.
+            if (timeoutMs)
+            {
+                con->getChannel().waitForData(lock, deadline);
+            }
+            else
+            {
+                con->getChannel().waitForData(lock);
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+    return false;
+}
+
+const char* ne7ssh_impl::read(int channel)
+{
+    uint32 i;
+
+    if (channel == -1)
+    {
+        s_errs->push(-1, "Bad channel: %i specified for reading.", channel);
+        return NULL;
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                // Only the data received since the last call is copied into the contiguous view.
+                return ((const char*)_connections[i]->getReceived().contiguous());
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return NULL;
+    }
+
+    return NULL;
+}
+
+int ne7ssh_impl::read(int channel, char* buffer, int size)
+{
+    uint32 i;
+
+    if ((channel == -1) || !buffer || (size < 0))
+    {
+        s_errs->push(-1, "Bad channel: %i specified for reading.", channel);
+        return -1;
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                return (int)_connections[i]->readReceived((Botan::byte*)buffer, size);
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return -1;
+    }
+
+    s_errs->push(-1, "Bad channel: %i specified for reading.", channel);
+    return -1;
+}
+
+bool ne7ssh_impl::consume(int channel, int size)
+{
+    uint32 i;
+
+    if ((channel == -1) || (size < 0))
+    {
+        s_errs->push(-1, "Bad channel: %i specified for releasing data.", channel);
+        return false;
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                _connections[i]->consumeReceived(size);
+                return true;
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+
+    s_errs->push(-1, "Bad channel: %i specified for releasing data.", channel);
+    return false;
+}
+
+const char* ne7ssh_impl::readStderr(int channel)
+{
+    uint32 i;
+
+    if (channel == -1)
+    {
+        s_errs->push(-1, "Bad channel: %i specified for reading.", channel);
+        return NULL;
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                return ((const char*)_connections[i]->getReceivedStderr().contiguous());
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return NULL;
+    }
+
+    return NULL;
+}
+
+int ne7ssh_impl::readStderr(int channel, char* buffer, int size)
+{
+    uint32 i;
+
+    if ((channel == -1) || !buffer || (size < 0))
+    {
+        s_errs->push(-1, "Bad channel: %i specified for reading.", channel);
+        return -1;
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                return (int)_connections[i]->readStderr((Botan::byte*)buffer, size);
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return -1;
+    }
+
+    s_errs->push(-1, "Bad channel: %i specified for reading.", channel);
+    return -1;
+}
+
+bool ne7ssh_impl::consumeStderr(int channel, int size)
+{
+    uint32 i;
+
+    if ((channel == -1) || (size < 0))
+    {
+        s_errs->push(-1, "Bad channel: %i specified for releasing data.", channel);
+        return false;
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                _connections[i]->consumeStderr(size);
+                return true;
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+
+    s_errs->push(-1, "Bad channel: %i specified for releasing data.", channel);
+    return false;
+}
+
+int ne7ssh_impl::getStderrSize(int channel)
+{
+    uint32 i;
+
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                return (int)_connections[i]->getReceivedStderr().length();
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return 0;
+    }
+
+    return 0;
+}
+
+bool ne7ssh_impl::setCallbacks(int channel, const ne7ssh_callbacks& callbacks)
+{
+    std::shared_ptr<const ne7ssh_callbacks> shared;
+    uint32 i;
+
+    if (channel == -1)
+    {
+        s_errs->push(-1, "Bad channel: %i specified for callbacks.", channel);
+        return false;
+    }
+    if (callbacks.onData || callbacks.onExtendedData || callbacks.onEof || callbacks.onExitStatus || callbacks.onClose)
+    {
+        shared.reset(new ne7ssh_callbacks(callbacks));
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                _connections[i]->setCallbacks(shared);
+                return true;
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+
+    s_errs->push(-1, "Bad channel: %i specified for callbacks.", channel);
+    return false;
+}
+
+bool ne7ssh_impl::setReceiveLimit(int channel, uint32 limit)
+{
+    uint32 i;
+
+    if (channel == -1)
+    {
+        s_errs->push(-1, "Bad channel: %i specified for limiting.", channel);
+        return false;
+    }
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                _connections[i]->setReceiveLimit(limit);
+                return true;
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+
+    s_errs->push(-1, "Bad channel: %i specified for limiting.", channel);
+    return false;
+}
+
+int ne7ssh_impl::getReceivedSize(int channel)
+{
+    uint32 i;
+    int size;
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                size = (int)_connections[i]->getReceived().length();
+                return (size);
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+
+    return 0;
+}
+
+bool ne7ssh_impl::getPacketPoolStats(int channel, uint64& hits, uint64& misses)
+{
+    uint32 i;
+    try
+    {
+        std::unique_lock<std::recursive_mutex> lock(s_mutex);
+
+        for (i = 0; i < _connections.size(); i++)
+        {
+            if (channel == _connections[i]->getChannelNo())
+            {
+                _connections[i]->getPacketPoolStats(hits, misses);
+                return true;
+            }
+        }
+    }
+    catch (const std::system_error &ex)
+    {
+        s_errs->push(-1, "Unable to get lock %s", ex.what());
+        return false;
+    }
+
+    s_errs->push(-1, "Bad channel: %i specified for pool statistics.", channel);
+    return false;
+}
+
+uint32 ne7ssh_impl::getChannelNo()
+{
+    uint32 i;
+    int32 channelID = 1;
+
+    if (_connections.size() == 0)
+    {
+        return channelID;
+    }
+
+    for (channelID = 1; channelID != 0x7FFFFFFF; channelID++)
     {
         for (i = 0; i < _connections.size(); i++)
         {
@@ -660,6 +1253,8 @@ uint32 ne7ssh_impl::getChannelNo()
 
 void ne7ssh_impl::setOptions(const char* prefCipher, const char* prefHmac)
 {
+    std::unique_lock<std::recursive_mutex> lock(s_mutex);
+
     if (prefCipher)
     {
         ne7ssh_impl::PREFERED_CIPHER.assign(prefCipher);
@@ -669,6 +1264,59 @@ void ne7ssh_impl::setOptions(const char* prefCipher, const char* prefHmac)
     {
         ne7ssh_impl::PREFERED_MAC.assign(prefHmac);
     }
+    s_localAlgorithms.reset();
+}
+
+std::shared_ptr<const ne7ssh_local_algorithms> ne7ssh_impl::getLocalAlgorithms()
+{
+    std::unique_lock<std::recursive_mutex> lock(s_mutex);
+
+    if (!s_localAlgorithms)
+    {
+        s_localAlgorithms.reset(new ne7ssh_local_algorithms(KEX_ALGORITHMS, HOSTKEY_ALGORITHMS, getCipherAlgorithms(), getMacAlgorithms(), COMPRESSION_ALGORITHMS, PREFERED_CIPHER, PREFERED_MAC));
+    }
+    return s_localAlgorithms;
+}
+
+bool ne7ssh_impl::setKnownHostsFile(const char* fileName, bool allowUnknown)
+{
+    return ne7ssh_known_hosts::setFile(fileName, allowUnknown);
+}
+
+void ne7ssh_impl::setPipelinedHandshake(bool enable)
+{
+    ne7ssh_impl::PIPELINED_HANDSHAKE = enable;
+}
+
+void ne7ssh_impl::setReceiveWindow(uint32 windowSize, uint32 maxPacketSize, bool autoTune)
+{
+    std::unique_lock<std::recursive_mutex> lock(s_mutex);
+
+    if (!windowSize)
+    {
+        windowSize = NE7SSH_DEFAULT_WINDOW;
+    }
+    if (!maxPacketSize)
+    {
+        maxPacketSize = NE7SSH_DEFAULT_MAX_PACKET;
+    }
+    // Room for the channel data header, padding and MAC within the largest packet the transport accepts.
+    if (maxPacketSize > MAX_INCOMING_PACKET_LEN - 1024)
+    {
+        maxPacketSize = MAX_INCOMING_PACKET_LEN - 1024;
+    }
+    if (windowSize > NE7SSH_MAX_WINDOW)
+    {
+        windowSize = NE7SSH_MAX_WINDOW;
+    }
+    // A window smaller than one packet would stall the remote side.
+    if (windowSize < maxPacketSize)
+    {
+        windowSize = maxPacketSize;
+    }
+    ne7ssh_impl::RECV_WINDOW_SIZE = windowSize;
+    ne7ssh_impl::RECV_MAX_PACKET = maxPacketSize;
+    ne7ssh_impl::RECV_WINDOW_AUTOTUNE = autoTune;
 }
 
 Ne7sshError* ne7ssh_impl::errors()
@@ -719,3 +1367,55 @@ bool ne7ssh_impl::generateKeyPair(const char* type, const char* fqdn, const char
     return false;
 }
 
+bool ne7ssh_impl::generateKeyPair(const char* type, const char* fqdn, std::string& privKey, std::string& pubKey, uint16 keySize)
+{
+    ne7ssh_keys keyPair;
+    ne7ssh_secure_string securePrivKey;
+    bool status = false;
+    enum keyAlgos { UNKNOWN, DSA, RSA };
+    uint8 keyAlgo = UNKNOWN;
+
+    if (!memcmp(type, "dsa", 3))
+    {
+        keyAlgo = DSA;
+    }
+    else if (!memcmp(type, "rsa", 3))
+    {
+        keyAlgo = RSA;
+    }
+
+    switch (keyAlgo)
+    {
+        case DSA:
+            if (!keySize)
+            {
+                status = keyPair.generateDSAKeys(fqdn, securePrivKey, pubKey);
+            }
+            else
+            {
+                status = keyPair.generateDSAKeys(fqdn, securePrivKey, pubKey, keySize);
+            }
+            break;
+
+        case RSA:
+            if (!keySize)
+            {
+                status = keyPair.generateRSAKeys(fqdn, securePrivKey, pubKey);
+            }
+            else
+            {
+                status = keyPair.generateRSAKeys(fqdn, securePrivKey, pubKey, keySize);
+            }
+            break;
+
+        default:
+            s_errs->push(-1, "The specfied key algorithm: %i not supported", keyAlgo);
+    }
+    if (status)
+    {
+        // The caller's string is the only copy of the key that is not wiped on release.
+        privKey.assign((const char*)securePrivKey.value().begin(), securePrivKey.length());
+    }
+    return status;
+}
+
@@ -18,6 +18,8 @@
 #define NE7SSH_IMPL_H
 
 #include "ne7ssh_error.h"
+#include "ne7ssh_callbacks.h"
+#include "ne7ssh_cmd_result.h"
 
 #include <botan/rng.h>
 #include <thread>
@@ -34,6 +36,7 @@
 
 #define SSH2_MSG_SERVICE_REQUEST 5
 #define SSH2_MSG_SERVICE_ACCEPT 6
+#define SSH2_MSG_EXT_INFO 7
 
 #define SSH2_MSG_USERAUTH_REQUEST 50
 #define SSH2_MSG_USERAUTH_FAILURE 51
@@ -54,6 +57,7 @@
 #define SSH2_MSG_CHANNEL_FAILURE                        100
 
 class ne7ssh_connection;
+class ne7ssh_local_algorithms;
 
 /** definitions for Botan */
 namespace Botan
@@ -89,7 +93,49 @@ private:
     uint32 getChannelNo();
     std::thread _selectThread;
 
+    /**
+    * Checks if the caller runs on the select thread, the thread channel callbacks are called from.
+    * <p>Functions waiting for the remote side fail right away there, as the thread would otherwise wait for itself.
+    * @param function Name of the calling function, used in the error message.
+    * @return True if called from the select thread, otherwise false is returned.
+    */
+    bool onSelectThread(const char* function);
+
+    /**
+    * Counts the open channels multiplexed over a connection, including channels still being opened.
+    * <p>Must be called with the library lock held.
+    * @param con Any channel of the connection.
+    * @return Number of channels.
+    */
+    uint32 channelsSharing(std::shared_ptr<ne7ssh_connection> con);
+
+    /**
+    * Checks if a channel multiplexed over a connection runs the SFTP subsystem.
+    * <p>Must be called with the library lock held.
+    * @param con Any channel of the connection.
+    * @return True if the SFTP subsystem is active on the connection, otherwise false is returned.
+    */
+    bool sftpSharing(std::shared_ptr<ne7ssh_connection> con);
+
+    /**
+    * Blocks until the command executed on a connection completes, the channel is closed, or the deadline passes.
+    * @param con Connection the command runs on.
+    * @param lock Lock on the library mutex, released while waiting.
+    * @param deadline Point in time to give up at, or NULL to wait without a timeout.
+    * @param output Result the received output is moved to as it arrives, so a receive limit cannot stall the command. NULL leaves it in the receive buffers.
+    * @return True if the command completed, otherwise false is returned.
+    */
+    static bool waitForCmd(std::shared_ptr<ne7ssh_connection> con, std::unique_lock<std::recursive_mutex>& lock, const std::chrono::steady_clock::time_point* deadline, ne7ssh_cmd_result* output = NULL);
+
+    /**
+    * Moves all output buffered on a connection to a command result.
+    * @param con Connection the command runs on.
+    * @param output Result the output is appended to.
+    */
+    static void drainCmdOutput(std::shared_ptr<ne7ssh_connection> con, ne7ssh_cmd_result* output);
+
     static Ne7sshError* s_errs;
+    static std::shared_ptr<const ne7ssh_local_algorithms> s_localAlgorithms;
 
     /**
     * Default constructor. Used to allocate required memory, as well as initializing cryptographic routines.
@@ -108,9 +154,46 @@ public:
     static const char* COMPRESSION_ALGORITHMS;
     static std::string PREFERED_CIPHER;
     static std::string PREFERED_MAC;
+    static std::string ORDERED_CIPHERS;
+    static std::string ORDERED_MACS;
+    static bool PIPELINED_HANDSHAKE;
+    static uint32 RECV_WINDOW_SIZE;
+    static uint32 RECV_MAX_PACKET;
+    static bool RECV_WINDOW_AUTOTUNE;
     static std::unique_ptr<Botan::RandomNumberGenerator> s_rng;
 
-    static std::shared_ptr<ne7ssh_impl> create();
+    /**
+    * Creates the SSH working environment and starts the select thread.
+    * @param benchmarkAlgos If set to true, supported cipher and hmac algorithms are timed and ORDERED_CIPHERS / ORDERED_MACS are filled fastest first.
+    * @return Newly created instance.
+    */
+    static std::shared_ptr<ne7ssh_impl> create(bool benchmarkAlgos = false);
+
+    /**
+    * Returns the cipher list advertised in KEX_INIT. Benchmarked order if available, otherwise CIPHER_ALGORITHMS.
+    * @return Comma separated list of cipher algorithms.
+    */
+    static const char* getCipherAlgorithms()
+    {
+        return ORDERED_CIPHERS.empty() ? CIPHER_ALGORITHMS : ORDERED_CIPHERS.c_str();
+    }
+
+    /**
+    * Returns the hmac list advertised in KEX_INIT. Benchmarked order if available, otherwise MAC_ALGORITHMS.
+    * @return Comma separated list of hmac algorithms.
+    */
+    static const char* getMacAlgorithms()
+    {
+        return ORDERED_MACS.empty() ? MAC_ALGORITHMS : ORDERED_MACS.c_str();
+    }
+
+    /**
+    * Returns the local algorithm preferences, built from the lists above and the preferred cipher and hmac.
+    * <p> The tables are built on first use after a configuration change, and shared by all connections.
+    * @return Local algorithm preferences.
+    */
+    static std::shared_ptr<const ne7ssh_local_algorithms> getLocalAlgorithms();
+
     void destroy();
     /**
     * Destructor.
@@ -143,6 +226,27 @@ public:
     */
     int connectWithKey(const char* host, const short port, const char* username, const char* privKeyFileName, bool shell = true, const int timeout = 0);
 
+    /**
+    * Connect to remote host using SSH2 protocol, with publickey authentication, using a private key held in memory.
+    * @param host Hostname or IP to connect to.
+    * @param port Port to connect to.
+    * @param username Username to use in authentication.
+    * @param privKey Private key, either PEM encoded or raw DER.
+    * @param privKeyLen Length of the private key data.
+    * @param shell Set this to true if you wish to launch the shell on the remote end. By default set to true.
+    * @param timeout Timeout for the connection procedure, in seconds.
+    * @return Returns newly assigned channel ID, or -1 if connection failed.
+    */
+    int connectWithKeyData(const char* host, const short port, const char* username, const char* privKey, size_t privKeyLen, bool shell = true, const int timeout = 0);
+
+    /**
+    * Opens an additional session channel on the connection of an already open channel, without a new TCP connection, key exchange or authentication.
+    * @param channel Channel whose connection is used.
+    * @param shell Set this to true if you wish to launch the shell on the remote end. By default set to true.
+    * @return Returns newly assigned channel ID, or -1 if the channel could not be opened.
+    */
+    int openChannel(int channel, bool shell = true);
+
     /**
     * Retreives count of current connections
     * <p> For internal use only.
@@ -158,6 +262,34 @@ public:
     */
     bool send(const char* data, int channel);
 
+    /**
+    * Sends binary data on specified channel. The data may contain any byte, including NUL.
+    * <p>As much as the remote window allows is encrypted straight from the given buffer, the rest is copied to the channel's queue.
+    * @param data Pointer to the data.
+    * @param len Length of the data.
+    * @param channel Channel to send data on.
+    * @return Returns true if the send was successful, otherwise false returned.
+    */
+    bool send(const void* data, size_t len, int channel);
+
+    /**
+    * Sends several blocks of data on specified channel, as if they were a single buffer, so they share packets without being joined first.
+    * @param iov Array of data blocks.
+    * @param count Number of blocks.
+    * @param channel Channel to send data on.
+    * @return Returns true if the send was successful, otherwise false returned.
+    */
+    bool sendv(const ne7ssh_iovec* iov, int count, int channel);
+
+    /**
+    * Sends a buffer on specified channel, taking it over.
+    * <p>Data the remote window does not allow right away stays in the buffer until it is sent, instead of being copied to the channel's queue.
+    * @param data Buffer to send. It is left empty.
+    * @param channel Channel to send data on.
+    * @return Returns true if the send was successful, otherwise false returned.
+    */
+    bool send(std::string&& data, int channel);
+
     /**
     * Can be used to send a single command and disconnect, similiar behavior to openssh when one appends a command to the end of ssh command.
     * @param cmd Remote command to execute. Can be used to read files on unix with 'cat [filename]'.
@@ -167,6 +299,17 @@ public:
     */
     bool sendCmd(const char* cmd, int channel, int timeout);
 
+    /**
+    * Executes a command on specified channel, and waits for it to complete.
+    * <p>The calling thread sleeps until the reading thread signals completion, so many commands can be awaited without polling.
+    * The command's standard output is taken from the receive buffer, data passed to a data callback is not part of the result.
+    * @param cmd Remote command to execute.
+    * @param channel Channel to execute the command on.
+    * @param timeoutMs Timeout in milliseconds, 0 waits until the command completes.
+    * @return Returns the result of the command, or an empty pointer if the command could not be sent.
+    */
+    std::shared_ptr<ne7ssh_cmd_result> execCmd(const char* cmd, int channel, uint32 timeoutMs = 0);
+
     /**
     * Closes specified channel.
     * @param channel Channel to close.
@@ -175,19 +318,98 @@ public:
     bool close(int channel);
 
     /**
-    * Reads all data from receiving buffer on specified channel.
+    * Reads all unread data from receiving buffer on specified channel.
+    * <p>The data stays in the buffer until it is released with consume().
     * @param channel Channel to read data on.
     * @return Returns string read from receiver buffer or 0 if buffer is empty.
     */
     const char* read(int channel);
 
     /**
-    * Returns the size of all data read. Used to read buffer passed 0x0.
+    * Copies unread data from receiving buffer on specified channel, and releases the copied bytes.
+    * @param channel Channel to read data on.
+    * @param buffer Buffer the data is copied to.
+    * @param size Size of the buffer.
+    * @return Returns number of bytes copied, 0 if receive buffer is empty, or -1 on error.
+    */
+    int read(int channel, char* buffer, int size);
+
+    /**
+    * Releases data returned by read(int) from receiving buffer on specified channel.
+    * @param channel Channel to release data on.
+    * @param size Number of bytes to release.
+    * @return Returns true if the channel was found, otherwise false is returned.
+    */
+    bool consume(int channel, int size);
+
+    /**
+    * Reads all unread standard error data received on specified channel.
+    * <p>The data stays in the buffer until it is released with consumeStderr().
+    * @param channel Channel to read data on.
+    * @return Returns string read from the standard error buffer or 0 if buffer is empty.
+    */
+    const char* readStderr(int channel);
+
+    /**
+    * Copies unread standard error data received on specified channel, and releases the copied bytes.
+    * @param channel Channel to read data on.
+    * @param buffer Buffer the data is copied to.
+    * @param size Size of the buffer.
+    * @return Returns number of bytes copied, 0 if the standard error buffer is empty, or -1 on error.
+    */
+    int readStderr(int channel, char* buffer, int size);
+
+    /**
+    * Releases data returned by readStderr(int) from the standard error buffer on specified channel.
+    * @param channel Channel to release data on.
+    * @param size Number of bytes to release.
+    * @return Returns true if the channel was found, otherwise false is returned.
+    */
+    bool consumeStderr(int channel, int size);
+
+    /**
+    * Returns the size of the unread standard error data on specified channel.
     * @param channel Channel number which buffer size to check.
-    * @return Return size of the buffer, or 0x0 if receive buffer empty.
+    * @return Return size of the buffer, not counting the NUL terminator added by readStderr(), or 0x0 if the buffer is empty.
+    */
+    int getStderrSize(int channel);
+
+    /**
+    * Registers functions called from the connection's reading thread when data, extended data, EOF, exit status or close arrive on specified channel.
+    * <p>While a data callback is set, received data is passed to it instead of the receive buffer, so read() and waitFor() do not see it.
+    * Likewise, extended data passed to its callback is not added to the standard error buffer.
+    * Data already buffered is passed to the new data callback right away.
+    * @param channel Channel to register the callbacks on.
+    * @param callbacks Set of callbacks, empty functions are not called. Passing an empty set goes back to buffering.
+    * @return Returns true if the channel was found, otherwise false is returned.
+    */
+    bool setCallbacks(int channel, const ne7ssh_callbacks& callbacks);
+
+    /**
+    * Limits the amount of unread data buffered on specified channel.
+    * <p>Once the limit is reached, the remote side is not allowed to send more data until the buffered data is consumed.
+    * @param channel Channel to limit.
+    * @param limit Maximum number of unread bytes, 0 for no limit.
+    * @return Returns true if the channel was found, otherwise false is returned.
+    */
+    bool setReceiveLimit(int channel, uint32 limit);
+
+    /**
+    * Returns the size of the unread data. Used to read buffer passed 0x0.
+    * @param channel Channel number which buffer size to check.
+    * @return Return size of the buffer, not counting the NUL terminator added by read(), or 0x0 if receive buffer empty.
     */
     int getReceivedSize(int channel);
 
+    /**
+    * Retrieves the hit and miss counters of the packet buffer pool used by a connection.
+    * @param channel Channel number of the connection.
+    * @param hits Number of packet buffers reused from the pool will be stored here.
+    * @param misses Number of packet buffers the pool had to allocate will be stored here.
+    * @return True if the channel was found, otherwise false is returned.
+    */
+    bool getPacketPoolStats(int channel, uint64& hits, uint64& misses);
+
     /**
     * Wait until receiving buffer contains a string passed in str, or until the function timeouts as specified in timeout.
     * @param channel Channel to wait on.
@@ -197,6 +419,17 @@ public:
     */
     bool waitFor(int channel, const char* str, uint32 timeout = 0);
 
+    /**
+    * Wait until receiving buffer contains a string passed in str, or until the function timeouts as specified in timeout.
+    * <p>Blocks until the reading thread signals new data, and only searches data not searched before, so the cost depends on the amount of new data rather than the size of the buffer.
+    * The library lock must not be held by the calling thread, so this function cannot be called from a callback.
+    * @param channel Channel to wait on.
+    * @param str String to wait for.
+    * @param timeoutMs Timeout in milliseconds, 0 waits until the string is received or the channel is closed.
+    * @return Returns true if string specified in str variable has been received, otherwise false returned.
+    */
+    bool waitForMs(int channel, const char* str, uint32 timeoutMs = 0);
+
     /**
     * Sets prefered cipher and hmac algorithms.
     * <p> This function as to be executed before connection functions, just after initialization of ne7ssh class.
@@ -205,6 +438,28 @@ public:
     */
     void setOptions(const char* prefCipher, const char* prefHmac);
 
+    /**
+    * Enables host key verification against an OpenSSH known_hosts file.
+    * @param fileName Full path to the known_hosts file, NULL disables host key verification.
+    * @param allowUnknown If true, hosts without a key of the offered type in the file are accepted.
+    * @return True if the file was loaded, otherwise false is returned.
+    */
+    bool setKnownHostsFile(const char* fileName, bool allowUnknown);
+
+    /**
+    * Enables or disables the pipelined handshake for connections made afterwards.
+    * @param enable If true, handshake packets are sent without waiting for each reply.
+    */
+    void setPipelinedHandshake(bool enable);
+
+    /**
+    * Sets the receive window and maximum packet size advertised by channels opened afterwards.
+    * @param windowSize Initial receive window in bytes, 0 restores the default.
+    * @param maxPacketSize Largest data packet the remote side may send, 0 restores the default.
+    * @param autoTune If true, the window grows with the measured bandwidth-delay product.
+    */
+    void setReceiveWindow(uint32 windowSize, uint32 maxPacketSize, bool autoTune);
+
     /**
     * Generate key pair.
     * @param type String specifying key type. Currently "dsa" and "rsa" are supported.
@@ -216,6 +471,17 @@ public:
     */
     bool generateKeyPair(const char* type, const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, uint16 keySize = 0);
 
+    /**
+    * Generate key pair into memory buffers.
+    * @param type String specifying key type. Currently "dsa" and "rsa" are supported.
+    * @param fqdn User id. Usually an Email. For example "test@netsieben.com"
+    * @param privKey PEM encoded private key will be stored here.
+    * @param pubKey Public key line will be stored here.
+    * @param keySize Desired key size in bits. If not specified will default to 2048.
+    * @return Return true if keys generated. Otherwise false is returned.
+    */
+    bool generateKeyPair(const char* type, const char* fqdn, std::string& privKey, std::string& pubKey, uint16 keySize = 0);
+
     /**
     * This method is used to initialize a new SFTP subsystem.
     * @param _sftp Reference to SFTP subsystem to be initialized.
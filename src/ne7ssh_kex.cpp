@@ -17,11 +17,14 @@
 #include "ne7ssh_kex.h"
 #include "ne7ssh_impl.h"
 #include "ne7ssh.h"
+#include "ne7ssh_known_hosts.h"
 
 using namespace Botan;
 
 ne7ssh_kex::ne7ssh_kex(std::shared_ptr<ne7ssh_session> session)
-    : _session(session)
+    : _session(session),
+    _guessSent(false),
+    _guessRight(false)
 {
 }
 
@@ -29,14 +32,12 @@ ne7ssh_kex::~ne7ssh_kex()
 {
 }
 
-void ne7ssh_kex::constructLocalKex()
+void ne7ssh_kex::constructLocalKex(bool firstKexFollows)
 {
     Botan::byte random[16];
-    ne7ssh_string myCiphers(ne7ssh_impl::CIPHER_ALGORITHMS, 0);
-    ne7ssh_string myMacs(ne7ssh_impl::MAC_ALGORITHMS, 0);
-    SecureVector<Botan::byte> tmpCiphers, tmpMacs;
-    char* cipher, * hmac;
-    size_t len;
+
+    // Held for the whole exchange, so the negotiation uses the same lists as the 'KEX_INIT' sent.
+    _local = ne7ssh_impl::getLocalAlgorithms();
 
     _localKex.clear();
     _localKex.addChar(SSH2_MSG_KEXINIT);
@@ -44,87 +45,35 @@ void ne7ssh_kex::constructLocalKex()
     ne7ssh_impl::s_rng->randomize(random, 16);
 
     _localKex.addBytes(random, 16);
-    _localKex.addString(ne7ssh_impl::KEX_ALGORITHMS);
-    _localKex.addString(ne7ssh_impl::HOSTKEY_ALGORITHMS);
-
-    if (ne7ssh_impl::PREFERED_CIPHER.size() > 0)
-    {
-        myCiphers.split(',');
-        myCiphers.resetParts();
-
-        do
-        {
-            cipher = myCiphers.nextPart();
-            if (cipher != NULL)
-            {
-                len = strlen(cipher);
-                if (ne7ssh_impl::PREFERED_CIPHER.compare(cipher) == 0)
-                {
-                    _ciphers += SecureVector<Botan::byte>((Botan::byte*)cipher, (uint32_t) len);
-                }
-                else
-                {
-                    tmpCiphers += SecureVector<Botan::byte>((Botan::byte*)",", 1);
-                    tmpCiphers += SecureVector<Botan::byte>((Botan::byte*)cipher, (uint32_t) len);
-                }
-            }
-        } while (cipher != NULL);
-    }
-    if (_ciphers.size())
-    {
-        _ciphers += tmpCiphers;
-    }
-    else
-    {
-        _ciphers = myCiphers.value();
-    }
-// _ciphers.append (&null_byte, 1);
-
-    if (ne7ssh_impl::PREFERED_MAC.size() > 0)
-    {
-        myMacs.split(',');
-        myMacs.resetParts();
-
-        do
-        {
-            hmac = myMacs.nextPart();
-            if (hmac != NULL)
-            {
-                len = strlen(hmac);
-                if (ne7ssh_impl::PREFERED_MAC.compare(hmac) == 0)
-                {
-                    _hmacs += SecureVector<Botan::byte>((Botan::byte*)hmac, (uint32_t) len);
-                }
-                else
-                {
-                    tmpMacs += SecureVector<Botan::byte>((Botan::byte*)",", 1);
-                    tmpMacs += SecureVector<Botan::byte>((Botan::byte*)hmac, (uint32_t) len);
-                }
-            }
-        } while (hmac != NULL);
-    }
-    if (_hmacs.size())
-    {
-        _hmacs += SecureVector<Botan::byte>(tmpMacs);
-    }
-    else
-    {
-        _hmacs = myMacs.value();
-    }
-//  _hmacs.append (&null_byte, 1);
-
-    _localKex.addVectorField(_ciphers);
-    _localKex.addVectorField(_ciphers);
-    _localKex.addVectorField(_hmacs);
-    _localKex.addVectorField(_hmacs);
-    _localKex.addString(ne7ssh_impl::COMPRESSION_ALGORITHMS);
-    _localKex.addString(ne7ssh_impl::COMPRESSION_ALGORITHMS);
-    _localKex.addInt(0);
-    _localKex.addInt(0);
-    _localKex.addChar('\0');
+    _localKex.addVector(_local->getKexInitLists());
+    _localKex.addChar(firstKexFollows ? 1 : 0);
     _localKex.addInt(0);
 }
 
+bool ne7ssh_kex::sameFirstAlgo(const ne7ssh_algorithm_list& local, const ne7ssh_span& remote)
+{
+    const char* localName = ne7ssh_algorithms::getName(local.first());
+    uint32 localLen = strlen(localName);
+    uint32 remoteLen = 0;
+
+    while ((remoteLen < remote.length) && (remote.data[remoteLen] != ','))
+    {
+        remoteLen++;
+    }
+    return (localLen == remoteLen) && !memcmp(localName, remote.data, localLen);
+}
+
+bool ne7ssh_kex::agreeNext(ne7ssh_reader& remoteKex, const ne7ssh_algorithm_list& local, uint8& result, ne7ssh_span& remote)
+{
+    std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
+
+    if (!remoteKex.getString(remote))
+    {
+        return false;
+    }
+    return crypto->agree(result, local, remote.data, remote.length);
+}
+
 bool ne7ssh_kex::sendInit()
 {
     std::shared_ptr<ne7ssh_transport> transport;
@@ -142,12 +91,48 @@ bool ne7ssh_kex::sendInit()
     {
         return false;
     }
+    return waitForInit();
+}
+
+bool ne7ssh_kex::sendInitWithGuess()
+{
+    std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
+    std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
+
+    if (!transport)
+    {
+        ne7ssh::errors()->push(_session->getSshChannel(), "No transport. Cannot initialize key exchange.");
+        return false;
+    }
+
+    constructLocalKex(true);
+
+    if (!transport->sendPacket(_localKex.value()))
+    {
+        return false;
+    }
+
+    if (!crypto->negotiatedKex(_local->getKex().first()))
+    {
+        return false;
+    }
+    if (!sendKexDHInitPacket())
+    {
+        return false;
+    }
+    _guessSent = true;
+    return true;
+}
+
+bool ne7ssh_kex::waitForInit()
+{
+    std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
+
     if (!transport->waitForPacket(SSH2_MSG_KEXINIT))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "Timeout while waiting for key exchange init reply");
         return false;
     }
-
     return true;
 }
 
@@ -155,52 +140,43 @@ bool ne7ssh_kex::handleInit()
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
     std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
-    SecureVector<Botan::byte> packet;
+    ne7ssh_buffer packet;
     uint32 padLen = transport->getPacket(packet);
-    ne7ssh_string remoteKex(packet, 17);
-    SecureVector<Botan::byte> algos;
-    SecureVector<Botan::byte> agreed;
+    ne7ssh_reader remoteKex(packet, 17);
+    ne7ssh_span algos;
+    uint8 agreed;
 
-    if (!transport || !crypto)
+    if (!transport || !crypto || !_local)
     {
         return false;
     }
     _remotKex.clear();
     _remotKex.addBytes(packet.begin(), packet.size() - padLen - 1);
 
-    if (!remoteKex.getString(algos))
-    {
-        return false;
-    }
-    if (!crypto->agree(agreed, ne7ssh_impl::KEX_ALGORITHMS, algos))
+    if (!agreeNext(remoteKex, _local->getKex(), agreed, algos))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "No compatible key exchange algorithms.");
         return false;
     }
+    // RFC 4253: a guessed KEX packet is only valid if both sides prefer the same KEX and host key algorithms.
+    _guessRight = sameFirstAlgo(_local->getKex(), algos);
     if (!crypto->negotiatedKex(agreed))
     {
         return false;
     }
 
-    if (!remoteKex.getString(algos))
-    {
-        return false;
-    }
-    if (!crypto->agree(agreed, ne7ssh_impl::HOSTKEY_ALGORITHMS, algos))
+    if (!agreeNext(remoteKex, _local->getHostkey(), agreed, algos))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "No compatible Hostkey algorithms.");
         return false;
     }
+    _guessRight = _guessRight && sameFirstAlgo(_local->getHostkey(), algos);
     if (!crypto->negotiatedHostkey(agreed))
     {
         return false;
     }
 
-    if (!remoteKex.getString(algos))
-    {
-        return false;
-    }
-    if (!crypto->agree(agreed, (char*)_ciphers.begin(), algos))
+    if (!agreeNext(remoteKex, _local->getCiphers(), agreed, algos))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "No compatible cryptographic algorithms.");
         return false;
@@ -210,11 +186,7 @@ bool ne7ssh_kex::handleInit()
         return false;
     }
 
-    if (!remoteKex.getString(algos))
-    {
-        return false;
-    }
-    if (!crypto->agree(agreed, (char*)_ciphers.begin(), algos))
+    if (!agreeNext(remoteKex, _local->getCiphers(), agreed, algos))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "No compatible cryptographic algorithms.");
         return false;
@@ -224,11 +196,7 @@ bool ne7ssh_kex::handleInit()
         return false;
     }
 
-    if (!remoteKex.getString(algos))
-    {
-        return false;
-    }
-    if (!crypto->agree(agreed, (char*)_hmacs.begin(), algos))
+    if (!agreeNext(remoteKex, _local->getMacs(), agreed, algos))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "No compatible HMAC algorithms.");
         return false;
@@ -238,11 +206,7 @@ bool ne7ssh_kex::handleInit()
         return false;
     }
 
-    if (!remoteKex.getString(algos))
-    {
-        return false;
-    }
-    if (!crypto->agree(agreed, (char*)_hmacs.begin(), algos))
+    if (!agreeNext(remoteKex, _local->getMacs(), agreed, algos))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "No compatible HMAC algorithms.");
         return false;
@@ -252,11 +216,7 @@ bool ne7ssh_kex::handleInit()
         return false;
     }
 
-    if (!remoteKex.getString(algos))
-    {
-        return false;
-    }
-    if (!crypto->agree(agreed, ne7ssh_impl::COMPRESSION_ALGORITHMS, algos))
+    if (!agreeNext(remoteKex, _local->getCompression(), agreed, algos))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "No compatible compression algorithms.");
         return false;
@@ -266,11 +226,7 @@ bool ne7ssh_kex::handleInit()
         return false;
     }
 
-    if (!remoteKex.getString(algos))
-    {
-        return false;
-    }
-    if (!crypto->agree(agreed, ne7ssh_impl::COMPRESSION_ALGORITHMS, algos))
+    if (!agreeNext(remoteKex, _local->getCompression(), agreed, algos))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "No compatible compression algorithms.");
         return false;
@@ -283,7 +239,7 @@ bool ne7ssh_kex::handleInit()
     return true;
 }
 
-bool ne7ssh_kex::sendKexDHInit()
+bool ne7ssh_kex::sendKexDHInitPacket()
 {
     ne7ssh_string dhInit;
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
@@ -302,7 +258,15 @@ bool ne7ssh_kex::sendKexDHInit()
     _e.clear();
     _e.addVector(eVector);
 
-    if (!transport->sendPacket(dhInit.value()))
+    return transport->sendPacket(dhInit.value());
+}
+
+bool ne7ssh_kex::sendKexDHInit()
+{
+    std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
+
+    // A wrong guess is ignored by the server, the exchange starts over with the negotiated algorithm.
+    if ((!_guessSent || !_guessRight) && !sendKexDHInitPacket())
     {
         return false;
     }
@@ -319,14 +283,15 @@ bool ne7ssh_kex::handleKexDHReply()
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
     std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
-    SecureVector<Botan::byte> packet;
+    ne7ssh_buffer packet;
     transport->getPacket(packet);
     if (packet.empty() == true)
     {
         return false;
     }
     ne7ssh_string remoteKexDH(packet, 1);
-    SecureVector<Botan::byte> field, fVector, hSig, kVector, hVector;
+    ne7ssh_buffer field, hSig;
+    SecureVector<Botan::byte> fVector, kVector, hVector;
     BigInt publicKey;
 
     if (!remoteKexDH.getString(field))
@@ -371,6 +336,11 @@ bool ne7ssh_kex::handleKexDHReply()
         return false;
     }
 
+    if (!ne7ssh_known_hosts::verify(_session->getRemoteHost(), _session->getRemotePort(), _hostKey.value(), _session->getSshChannel()))
+    {
+        return false;
+    }
+
     return true;
 }
 
@@ -386,6 +356,11 @@ bool ne7ssh_kex::sendKexNewKeys()
         return false;
     }
 
+    if (ne7ssh_impl::PIPELINED_HANDSHAKE)
+    {
+        // Our NEWKEYS is flushed together with the following requests, by the next wait for a packet.
+        transport->cork();
+    }
     newKeys.addChar(SSH2_MSG_NEWKEYS);
     if (!transport->sendPacket(newKeys.value()))
     {
@@ -404,7 +379,7 @@ bool ne7ssh_kex::sendKexNewKeys()
 void ne7ssh_kex::makeH(Botan::SecureVector<Botan::byte> &hVector)
 {
     std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
-    ne7ssh_string hashBytes;
+    ne7ssh_secure_string hashBytes;
 
     hashBytes.addVectorField(_session->getLocalVersion());
     hashBytes.addVectorField(_session->getRemoteVersion());
@@ -19,6 +19,8 @@
 
 #include "ne7ssh_session.h"
 #include "ne7ssh_string.h"
+#include "ne7ssh_reader.h"
+#include "ne7ssh_algorithms.h"
 
 /**
 @author Andrew Useckas
@@ -32,14 +34,40 @@ private:
     ne7ssh_string _hostKey;
     ne7ssh_string _e;
     ne7ssh_string _f;
-    ne7ssh_string _k;
-    Botan::SecureVector<Botan::byte> _ciphers;
-    Botan::SecureVector<Botan::byte> _hmacs;
+    ne7ssh_secure_string _k;
+    std::shared_ptr<const ne7ssh_local_algorithms> _local;
+    bool _guessSent;
+    bool _guessRight;
 
     /**
      * Constructs local 'KEX_INIT' payload
+     * @param firstKexFollows If true, the first_kex_packet_follows flag is set.
      */
-    void constructLocalKex();
+    void constructLocalKex(bool firstKexFollows = false);
+
+    /**
+     * Computes local DH public value and sends 'KEXDH_INIT' packet, without waiting for the reply.
+     * @return True if the packet was sent, otherwise false is returned.
+     */
+    bool sendKexDHInitPacket();
+
+    /**
+     * Compares the first algorithm of a local and a remote name-list.
+     * @param local Local algorithm list.
+     * @param remote View of the remote name-list.
+     * @return True if both lists start with the same algorithm, otherwise false is returned.
+     */
+    static bool sameFirstAlgo(const ne7ssh_algorithm_list& local, const ne7ssh_span& remote);
+
+    /**
+     * Extracts the next remote name-list from 'KEX_INIT', and agrees on an algorithm.
+     * @param remoteKex Reader positioned at the name-list.
+     * @param local Local algorithm list.
+     * @param result Reference to a variable where the ID of the agreed algorithm will be stored.
+     * @param remote Reference to a span which will point at the remote name-list.
+     * @return True if a common algorithm was found, otherwise false is returned.
+     */
+    bool agreeNext(ne7ssh_reader& remoteKex, const ne7ssh_algorithm_list& local, uint8& result, ne7ssh_span& remote);
 
     /**
      * Computes H hash, from concated values of the local SSH version string, remote SSH version string, local KEX_INIT payload, remote KEX_INIT payload, host key, e, f and k BigInt values.
@@ -65,6 +93,20 @@ public:
      */
     bool sendInit();
 
+    /**
+     * Pipelined variant of sendInit(). Sends 'KEX_INIT' with first_kex_packet_follows set, followed by a 'KEXDH_INIT'
+     * packet for the first local KEX algorithm, without waiting for any reply.
+     * <p> waitForInit() has to be called next.
+     * @return True if both packets were sent, otherwise false is returned.
+     */
+    bool sendInitWithGuess();
+
+    /**
+     * Waits for the remote 'KEX_INIT' packet.
+     * @return True if the packet was received, otherwise false is returned.
+     */
+    bool waitForInit();
+
     /**
      * After sendInit() function returnes true, this functions is used to parse the received 'KEX_INIT' packet.
      * <p> Used to agree on cipher, hmac, etc. algorithms used in communication between client and server.
@@ -74,6 +116,7 @@ public:
 
     /**
      * Sends 'KEXDH_INIT' packet and waits for 'KEXDH_REPLY'.
+     * <p> If sendInitWithGuess() was used and the guess was right, only waits for the reply.
      * @return True if reply is received, otherwise false is returned.
      */
     bool sendKexDHInit();
@@ -88,6 +131,7 @@ public:
     /**
      * This function waits for 'NEWKEYS' packet from the remote host.
      * <p> Once the packet is received, local 'NEWKEYS' packet is sent, all encryption and hmac keys are generated and encrypted communication is established.
+     * <p> With a pipelined handshake the transport is left corked after local 'NEWKEYS', so it goes out with the following requests.
      * @return True if all operations are successful, otherwise false is returned.
      */
     bool sendKexNewKeys();
@@ -22,6 +22,8 @@
 #include <botan/dsa.h>
 #include <botan/rsa.h>
 #include <memory>
+#include <mutex>
+#include <map>
 
 /**
  @author Andrew Useckas <andrew@netsieben.com>
@@ -40,6 +42,24 @@ private:
 
     uint8 keyAlgo;
 
+    /**
+    * Structure used to store a parsed private key file, together with the file identity it was parsed from.
+    */
+    typedef struct
+    {
+        uint64 device;
+        uint64 inode;
+        int64 mtime;
+        int64 size;
+        uint8 keyAlgo;
+        std::shared_ptr<Botan::DSA_PrivateKey> dsaPrivateKey;
+        std::shared_ptr<Botan::RSA_PrivateKey> rsaPrivateKey;
+        ne7ssh_buffer publicKeyBlob;
+    } cachedKeyPair;
+
+    static std::recursive_mutex s_cacheMutex;
+    static std::map<std::string, cachedKeyPair> s_keyCache;
+
     /**
      * Extracts DSA key pair from a PEM encoded stream.
      * @param buffer PEM encoded string.
@@ -56,6 +76,46 @@ private:
      */
     bool getRSAKeys(char* buffer, uint32 size);
 
+    /**
+     * Extracts DSA key pair from DER encoded key data.
+     * @param keyDataRaw DER encoded DSA private key.
+     * @return True if keys succesfully extracted. Otherwise False is returned.
+     */
+    bool decodeDSAKey(Botan::SecureVector<Botan::byte>& keyDataRaw);
+
+    /**
+     * Extracts RSA key pair from DER encoded key data.
+     * @param keyDataRaw DER encoded PKCS#1 RSA private key.
+     * @return True if keys succesfully extracted. Otherwise False is returned.
+     */
+    bool decodeRSAKey(Botan::SecureVector<Botan::byte>& keyDataRaw);
+
+    /**
+     * Determines the type of a PEM encoded private key, then passes processing to either getDSAKeys() or getRSAKeys() functions.
+     * <p>Decoding errors of malformed keys are reported, they do not propagate as exceptions.
+     * @param buffer PEM encoded private key. CR characters are removed in place.
+     * @param source Name of the key source, used in error messages.
+     * @return True if keys succesfully extracted. Otherwise False is returned.
+     */
+    bool getKeyPairFromPEM(Botan::SecureVector<Botan::byte>& buffer, const char* source);
+
+    /**
+     * Determines the type of a DER encoded private key by its number of fields, then passes processing to either decodeDSAKey() or decodeRSAKey() functions.
+     * @param keyDataRaw DER encoded private key.
+     * @return True if keys succesfully extracted. Otherwise False is returned.
+     */
+    bool getKeyPairFromDER(Botan::SecureVector<Botan::byte>& keyDataRaw);
+
+    /**
+     * Writes generated keys to files.
+     * @param privKeyFileName Full path to a file where the private key should be written.
+     * @param privKey PEM encoded private key.
+     * @param pubKeyFileName Full path to a file where the public key should be written.
+     * @param pubKey Public key line.
+     * @return True if both files were written. Otherwise false is returned.
+     */
+    static bool writeKeyFiles(const char* privKeyFileName, const Botan::SecureVector<Botan::byte>& privKey, const char* pubKeyFileName, const std::string& pubKey);
+
 public:
     enum keyAlgos { DSA, RSA };
 
@@ -80,6 +140,16 @@ public:
      */
     bool generateDSAKeys(const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, uint16 keySize = 2048);
 
+    /**
+     * Generates DSA Key pair into memory buffers.
+     * @param fqdn User id. Usually an Email. For example "test@netsieben.com"
+     * @param privKey PEM encoded private key will be stored here, in memory that is wiped when released.
+     * @param pubKey Public key, in the same single line format as written by the file version, will be stored here.
+     * @param keySize Desired key size in bits. If not specified will default to 2048.
+     * @return True if keys generated. Otherwise false is returned.
+     */
+    bool generateDSAKeys(const char* fqdn, ne7ssh_secure_string& privKey, std::string& pubKey, uint16 keySize = 2048);
+
     /**
      * Generates RSA Key pair and saves keys in specified files.
      * @param fqdn User id. Usually an Email. For example "test@netsieben.com"
@@ -90,22 +160,48 @@ public:
      */
     bool generateRSAKeys(const char* fqdn, const char* privKeyFileName, const char* pubKeyFileName, uint16 keySize = 2048);
 
+    /**
+     * Generates RSA Key pair into memory buffers.
+     * @param fqdn User id. Usually an Email. For example "test@netsieben.com"
+     * @param privKey PEM encoded private key will be stored here, in memory that is wiped when released.
+     * @param pubKey Public key, in the same single line format as written by the file version, will be stored here.
+     * @param keySize Desired key size in bits. If not specified will default to 2048.
+     * @return True if keys generated. Otherwise false is returned.
+     */
+    bool generateRSAKeys(const char* fqdn, ne7ssh_secure_string& privKey, std::string& pubKey, uint16 keySize = 2048);
+
     /**
      * Extracts key pair from a PEM encoded file.
      * <p>Reads the file and determines the type of key, then passes processing to either getDsaKeys() or getRSAKeys(*) functions.
+     * <p>Parsed keys are cached process wide, and reused as long as the path, inode, size and mtime of the file do not change.
      * @param privKeyFileName Full path to PEM encoded file.
      * @return True if key succesfully extracted, otherwise False is returned.
      */
     bool getKeyPairFromFile(const char* privKeyFileName);
 
     /**
-     * Generates a SHA-1 signature from sessionID and packet data provided.
+     * Extracts key pair from a private key held in memory.
+     * <p>Accepts either a PEM encoded key, as found in private key files, or the raw DER encoded key. The key is only copied to memory that is wiped when released.
+     * @param privKey Pointer to the key data.
+     * @param length Length of the key data.
+     * @return True if key succesfully extracted, otherwise False is returned.
+     */
+    bool getKeyPairFromMemory(const char* privKey, size_t length);
+
+    /**
+     * Drops all private keys cached by getKeyPairFromFile().
+     */
+    static void clearKeyCache();
+
+    /**
+     * Generates a signature from sessionID and packet data provided.
      * <p>Determines key type and passed the processing either to generateDSASignature() or generateRSAKeys() functions.
      * @param sessionID SSH2 SessionID.
      * @param signingData Packet data to sign.
+     * @param sigAlgo Signature algorithm used with RSA keys: "ssh-rsa", "rsa-sha2-256" or "rsa-sha2-512". Ignored for DSA keys.
      * @return Returns signature, or 0 length vector if operation failed.
      */
-    Botan::SecureVector<Botan::byte>& generateSignature(Botan::SecureVector<Botan::byte>& sessionID, Botan::SecureVector<Botan::byte>& signingData);
+    Botan::SecureVector<Botan::byte>& generateSignature(Botan::SecureVector<Botan::byte>& sessionID, ne7ssh_buffer& signingData, const char* sigAlgo = "ssh-rsa");
 
     /**
      * Generates a SHA-1 signature from sessionID and packet data provided, using DSA private key initialized before.
@@ -113,21 +209,22 @@ public:
      * @param signingData Packet data to sign.
      * @return Returns signature, or 0 length vector if operation failed.
      */
-    Botan::SecureVector<Botan::byte> generateDSASignature(Botan::SecureVector<Botan::byte>& sessionID, Botan::SecureVector<Botan::byte>& signingData);
+    Botan::SecureVector<Botan::byte> generateDSASignature(Botan::SecureVector<Botan::byte>& sessionID, ne7ssh_buffer& signingData);
 
     /**
-     * Generates a SHA-1 signature from sessionID and packet data provided, using DSA private key initialized before.
+     * Generates a RSA signature from sessionID and packet data provided, using RSA private key initialized before.
      * @param sessionID SSH2 SessionID.
      * @param signingData Packet data to sign.
+     * @param sigAlgo Signature algorithm: "ssh-rsa" (SHA-1), "rsa-sha2-256" or "rsa-sha2-512".
      * @return Returns signature, or 0 length vector if operation failed.
      */
-    Botan::SecureVector<Botan::byte> generateRSASignature(Botan::SecureVector<Botan::byte>& sessionID, Botan::SecureVector<Botan::byte>& signingData);
+    Botan::SecureVector<Botan::byte> generateRSASignature(Botan::SecureVector<Botan::byte>& sessionID, ne7ssh_buffer& signingData, const char* sigAlgo = "ssh-rsa");
 
     /**
      * After key pair has been initialized, this function returns public key blob, as specified by SSH2 specs.
      * @return Public key blob or zero length vector, if there are initialized keys.
      */
-    Botan::SecureVector<Botan::byte>& getPublicKeyBlob();
+    ne7ssh_buffer& getPublicKeyBlob();
 
     /**
      * Returns type of initialized keys.
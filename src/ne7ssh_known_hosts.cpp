@@ -0,0 +1,429 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#include "ne7ssh_known_hosts.h"
+#include "ne7ssh_string.h"
+#include "ne7ssh.h"
+#include <botan/b64_filt.h>
+#include <botan/pipe.h>
+#include <botan/hmac.h>
+#include <botan/sha160.h>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+#include <sys/stat.h>
+
+using namespace Botan;
+
+std::recursive_mutex ne7ssh_known_hosts::s_mutex;
+std::string ne7ssh_known_hosts::s_fileName;
+bool ne7ssh_known_hosts::s_allowUnknown = false;
+uint64 ne7ssh_known_hosts::s_device = 0;
+uint64 ne7ssh_known_hosts::s_inode = 0;
+int64 ne7ssh_known_hosts::s_mtime = 0;
+uint64 ne7ssh_known_hosts::s_size = 0;
+uint64 ne7ssh_known_hosts::s_offset = 0;
+ne7ssh_buffer ne7ssh_known_hosts::s_prefixHash;
+std::unordered_map<std::string, std::vector<ne7ssh_known_hosts::hostKey> > ne7ssh_known_hosts::s_hosts;
+std::unordered_map<std::string, ne7ssh_known_hosts::resolvedName> ne7ssh_known_hosts::s_resolved;
+std::list<std::string> ne7ssh_known_hosts::s_resolvedOrder;
+std::vector<ne7ssh_known_hosts::hashedEntry> ne7ssh_known_hosts::s_hashed;
+std::vector<ne7ssh_known_hosts::patternEntry> ne7ssh_known_hosts::s_patterns;
+
+bool ne7ssh_known_hosts::setFile(const char* fileName, bool allowUnknown)
+{
+    std::unique_lock<std::recursive_mutex> lock(s_mutex);
+
+    reset();
+    if (!fileName)
+    {
+        s_fileName.clear();
+        return true;
+    }
+    s_fileName.assign(fileName);
+    s_allowUnknown = allowUnknown;
+    return refresh();
+}
+
+void ne7ssh_known_hosts::clear()
+{
+    std::unique_lock<std::recursive_mutex> lock(s_mutex);
+
+    reset();
+    s_fileName.clear();
+    s_allowUnknown = false;
+}
+
+void ne7ssh_known_hosts::reset()
+{
+    s_hosts.clear();
+    s_resolved.clear();
+    s_resolvedOrder.clear();
+    s_hashed.clear();
+    s_patterns.clear();
+    s_prefixHash.clear();
+    s_device = 0;
+    s_inode = 0;
+    s_mtime = 0;
+    s_size = 0;
+    s_offset = 0;
+}
+
+ne7ssh_buffer ne7ssh_known_hosts::hashPrefix(const char* data, size_t len)
+{
+    SHA_160 sha;
+
+    sha.update((const Botan::byte*)data, len);
+    return sha.final();
+}
+
+bool ne7ssh_known_hosts::refresh()
+{
+    struct stat fileStatus;
+    std::string buffer;
+    size_t lineStart, lineEnd, firstHashed;
+
+    if (stat(s_fileName.c_str(), &fileStatus) < 0)
+    {
+        ne7ssh::errors()->push(-1, "Cannot read file status: '%s'.", s_fileName.c_str());
+        return false;
+    }
+
+    if (((uint64)fileStatus.st_dev != s_device) || ((uint64)fileStatus.st_ino != s_inode) || ((uint64)fileStatus.st_size < s_offset))
+    {
+        // File was replaced or truncated, names resolved against hashed entries are no longer valid.
+        reset();
+    }
+    else if (((int64)fileStatus.st_mtime == s_mtime) && ((uint64)fileStatus.st_size == s_size))
+    {
+        return true;
+    }
+
+    std::ifstream file(s_fileName.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+        ne7ssh::errors()->push(-1, "Cannot open file: '%s'.", s_fileName.c_str());
+        return false;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    buffer = contents.str();
+    file.close();
+
+    if (s_offset && ((buffer.size() < s_offset) || (hashPrefix(buffer.data(), (size_t)s_offset) != s_prefixHash)))
+    {
+        // Lines parsed before were rewritten in place, so removed or revoked keys must not survive from the previous load.
+        reset();
+    }
+    s_device = fileStatus.st_dev;
+    s_inode = fileStatus.st_ino;
+    s_mtime = fileStatus.st_mtime;
+    s_size = fileStatus.st_size;
+
+    firstHashed = s_hashed.size();
+    lineStart = (size_t)s_offset;
+    while ((lineEnd = buffer.find('\n', lineStart)) != std::string::npos)
+    {
+        parseLine(buffer.substr(lineStart, lineEnd - lineStart));
+        lineStart = lineEnd + 1;
+    }
+    // An unterminated last line may still be written, it is parsed once completed.
+    s_offset = lineStart;
+    s_prefixHash = hashPrefix(buffer.data(), lineStart);
+
+    if (firstHashed < s_hashed.size())
+    {
+        std::unordered_map<std::string, resolvedName>::iterator name;
+        for (name = s_resolved.begin(); name != s_resolved.end(); name++)
+        {
+            resolveHashed(name->first, firstHashed, name->second.keys);
+        }
+    }
+    return true;
+}
+
+void ne7ssh_known_hosts::parseLine(const std::string& line)
+{
+    std::istringstream fields(line);
+    std::string hosts, keyType, keyData;
+    hostKey key;
+
+    key.revoked = false;
+    if (!(fields >> hosts) || (hosts[0] == '#'))
+    {
+        return;
+    }
+    if (hosts[0] == '@')
+    {
+        if (hosts != "@revoked")
+        {
+            // @cert-authority keys sign host certificates, which are not supported.
+            return;
+        }
+        key.revoked = true;
+        if (!(fields >> hosts))
+        {
+            return;
+        }
+    }
+    if (!(fields >> keyType >> keyData))
+    {
+        return;
+    }
+    key.keyType = keyType;
+    if (!decodeBase64(key.keyBlob, keyData) || key.keyBlob.empty())
+    {
+        return;
+    }
+
+    if (!hosts.compare(0, 3, "|1|"))
+    {
+        hashedEntry entry;
+        size_t separator = hosts.find('|', 3);
+        if ((separator == std::string::npos) ||
+            !decodeBase64(entry.salt, hosts.substr(3, separator - 3)) ||
+            !decodeBase64(entry.hash, hosts.substr(separator + 1)))
+        {
+            return;
+        }
+        entry.key = key;
+        s_hashed.push_back(entry);
+        return;
+    }
+
+    std::vector<std::string> names;
+    bool isPattern = false;
+    size_t start = 0, end;
+    do
+    {
+        end = hosts.find(',', start);
+        std::string name = hosts.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+        for (size_t i = 0; i < name.size(); i++)
+        {
+            name[i] = tolower(name[i]);
+        }
+        if (name.find_first_of("*?!") != std::string::npos)
+        {
+            isPattern = true;
+        }
+        if (!name.empty())
+        {
+            names.push_back(name);
+        }
+        start = end + 1;
+    } while (end != std::string::npos);
+
+    if (isPattern)
+    {
+        patternEntry entry;
+        entry.patterns = names;
+        entry.key = key;
+        s_patterns.push_back(entry);
+        return;
+    }
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        s_hosts[names[i]].push_back(key);
+    }
+}
+
+void ne7ssh_known_hosts::resolveHashed(const std::string& name, size_t first, std::vector<hostKey>& keys)
+{
+    for (size_t i = first; i < s_hashed.size(); i++)
+    {
+        HMAC hmac(new SHA_160);
+        hmac.set_key(s_hashed[i].salt.begin(), s_hashed[i].salt.size());
+        hmac.update((const Botan::byte*)name.c_str(), name.size());
+        if (hmac.final() == s_hashed[i].hash)
+        {
+            keys.push_back(s_hashed[i].key);
+        }
+    }
+}
+
+bool ne7ssh_known_hosts::matchPattern(const char* name, const char* pattern)
+{
+    while (*pattern)
+    {
+        if (*pattern == '*')
+        {
+            pattern++;
+            if (!*pattern)
+            {
+                return true;
+            }
+            for (; *name; name++)
+            {
+                if (matchPattern(name, pattern))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        if (!*name || ((*pattern != '?') && (*pattern != *name)))
+        {
+            return false;
+        }
+        name++;
+        pattern++;
+    }
+    return !*name;
+}
+
+bool ne7ssh_known_hosts::decodeBase64(ne7ssh_buffer& result, const std::string& encoded)
+{
+    try
+    {
+        Pipe base64dec(new Base64_Decoder);
+        base64dec.process_msg(encoded);
+        result = base64dec.read_all();
+    }
+    catch (const std::exception&)
+    {
+        result.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ne7ssh_known_hosts::verify(const std::string& host, uint16 port, ne7ssh_buffer& keyBlob, int32 channel)
+{
+    std::unique_lock<std::recursive_mutex> lock(s_mutex);
+    std::vector<const hostKey*> candidates;
+    std::string name, keyType;
+    ne7ssh_buffer field;
+    ne7ssh_string blob;
+    bool known = false;
+
+    if (s_fileName.empty())
+    {
+        return true;
+    }
+    if (!refresh())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < host.size(); i++)
+    {
+        name += (char)tolower(host[i]);
+    }
+    if (port != 22)
+    {
+        std::ostringstream bracketed;
+        bracketed << "[" << name << "]:" << port;
+        name = bracketed.str();
+    }
+
+    blob.addVector(keyBlob);
+    if (!blob.getString(field))
+    {
+        ne7ssh::errors()->push(channel, "Host key without type.");
+        return false;
+    }
+    keyType.assign((const char*)field.begin(), field.size());
+
+    if (!s_hashed.empty())
+    {
+        std::unordered_map<std::string, resolvedName>::iterator resolved = s_resolved.find(name);
+        if (resolved == s_resolved.end())
+        {
+            if (s_resolved.size() >= NE7SSH_MAX_RESOLVED_HOSTS)
+            {
+                s_resolved.erase(s_resolvedOrder.back());
+                s_resolvedOrder.pop_back();
+            }
+            s_resolvedOrder.push_front(name);
+            resolved = s_resolved.insert(std::make_pair(name, resolvedName())).first;
+            resolved->second.age = s_resolvedOrder.begin();
+            resolveHashed(name, 0, resolved->second.keys);
+        }
+        else
+        {
+            s_resolvedOrder.splice(s_resolvedOrder.begin(), s_resolvedOrder, resolved->second.age);
+        }
+        for (size_t i = 0; i < resolved->second.keys.size(); i++)
+        {
+            candidates.push_back(&resolved->second.keys[i]);
+        }
+    }
+
+    std::unordered_map<std::string, std::vector<hostKey> >::const_iterator found = s_hosts.find(name);
+    if (found != s_hosts.end())
+    {
+        for (size_t i = 0; i < found->second.size(); i++)
+        {
+            candidates.push_back(&found->second[i]);
+        }
+    }
+    for (size_t i = 0; i < s_patterns.size(); i++)
+    {
+        bool matched = false, negated = false;
+        for (size_t j = 0; j < s_patterns[i].patterns.size(); j++)
+        {
+            const std::string& pattern = s_patterns[i].patterns[j];
+            if (pattern[0] == '!')
+            {
+                negated |= matchPattern(name.c_str(), pattern.c_str() + 1);
+            }
+            else
+            {
+                matched |= matchPattern(name.c_str(), pattern.c_str());
+            }
+        }
+        if (matched && !negated)
+        {
+            candidates.push_back(&s_patterns[i].key);
+        }
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        if (candidates[i]->revoked && (candidates[i]->keyBlob == keyBlob))
+        {
+            ne7ssh::errors()->push(channel, "Host key for '%s' is marked as revoked in: '%s'.", name.c_str(), s_fileName.c_str());
+            return false;
+        }
+    }
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        if (candidates[i]->revoked)
+        {
+            continue;
+        }
+        if (candidates[i]->keyBlob == keyBlob)
+        {
+            return true;
+        }
+        if (candidates[i]->keyType == keyType)
+        {
+            known = true;
+        }
+    }
+
+    if (known)
+    {
+        ne7ssh::errors()->push(channel, "Host key for '%s' does not match the key in: '%s'.", name.c_str(), s_fileName.c_str());
+        return false;
+    }
+    if (!s_allowUnknown)
+    {
+        ne7ssh::errors()->push(channel, "No %s host key for '%s' in: '%s'.", keyType.c_str(), name.c_str(), s_fileName.c_str());
+        return false;
+    }
+    return true;
+}
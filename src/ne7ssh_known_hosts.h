@@ -0,0 +1,169 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_KNOWN_HOSTS_H
+#define NE7SSH_KNOWN_HOSTS_H
+
+#include "ne7ssh_string.h"
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <list>
+
+// Number of host names whose hashed known_hosts matches are memoized.
+#define NE7SSH_MAX_RESOLVED_HOSTS 1024
+
+/**
+ * Process wide store of host keys loaded from an OpenSSH known_hosts file.
+ * <p>Plain host names are kept in a hash index keyed by "host" or "[host]:port", so lookups do not depend on the size of the file.
+ * Hashed (|1|salt|hash) entries are resolved the first time a host name is looked up, and the result is memoized for up to NE7SSH_MAX_RESOLVED_HOSTS names.
+ * Once the memo is full, the least recently looked up name is evicted.
+ * Lines using wildcards or negated patterns are matched linearly.
+ * <p>Lines appended to the file are parsed incrementally, but only if the part parsed before is unchanged. Any other modification reloads the whole file.
+ */
+class ne7ssh_known_hosts
+{
+private:
+    /**
+    * Structure used to store a single host key.
+    */
+    typedef struct
+    {
+        std::string keyType;
+        ne7ssh_buffer keyBlob;
+        bool revoked;
+    } hostKey;
+
+    /**
+    * Structure used to store a hashed known_hosts entry.
+    */
+    typedef struct
+    {
+        ne7ssh_buffer salt;
+        ne7ssh_buffer hash;
+        hostKey key;
+    } hashedEntry;
+
+    /**
+    * Structure used to store a known_hosts entry with wildcard or negated host patterns.
+    */
+    typedef struct
+    {
+        std::vector<std::string> patterns;
+        hostKey key;
+    } patternEntry;
+
+    /**
+    * Structure used to store the hashed entries matching a host name, along with its position in the lookup order.
+    */
+    typedef struct
+    {
+        std::vector<hostKey> keys;
+        std::list<std::string>::iterator age;
+    } resolvedName;
+
+    static std::recursive_mutex s_mutex;
+    static std::string s_fileName;
+    static bool s_allowUnknown;
+    static uint64 s_device;
+    static uint64 s_inode;
+    static int64 s_mtime;
+    static uint64 s_size;
+    static uint64 s_offset;
+    static ne7ssh_buffer s_prefixHash;
+    static std::unordered_map<std::string, std::vector<hostKey> > s_hosts;
+    static std::unordered_map<std::string, resolvedName> s_resolved;
+    static std::list<std::string> s_resolvedOrder;
+    static std::vector<hashedEntry> s_hashed;
+    static std::vector<patternEntry> s_patterns;
+
+    /**
+     * Drops all loaded entries, keeping the file name and policy.
+     */
+    static void reset();
+
+    /**
+     * Computes the digest used to detect changes to the part of the file that was already parsed.
+     * @param data Pointer to the data.
+     * @param len Length of the data.
+     * @return SHA-1 digest of the data.
+     */
+    static ne7ssh_buffer hashPrefix(const char* data, size_t len);
+
+    /**
+     * Checks the file status, and parses either the whole file or only the lines appended since the last load.
+     * @return True if the file is loaded and up to date, otherwise false is returned.
+     */
+    static bool refresh();
+
+    /**
+     * Parses one line of a known_hosts file and adds it to the index.
+     * @param line The line, without the trailing new line character.
+     */
+    static void parseLine(const std::string& line);
+
+    /**
+     * Compares a host name with all hashed entries starting at the given index, and adds the matching keys to the given list.
+     * @param name Host name in known_hosts form.
+     * @param first Index of the first hashed entry to check.
+     * @param keys List the matching keys are added to.
+     */
+    static void resolveHashed(const std::string& name, size_t first, std::vector<hostKey>& keys);
+
+    /**
+     * Matches a host name against a shell style pattern, supporting '*' and '?' wildcards.
+     * @param name Host name.
+     * @param pattern Pattern.
+     * @return True if the name matches, otherwise false is returned.
+     */
+    static bool matchPattern(const char* name, const char* pattern);
+
+    /**
+     * Decodes base64 encoded data.
+     * @param result Decoded data will be dumped into this var.
+     * @param encoded Base64 encoded string.
+     * @return True if decoding was successful, otherwise false is returned.
+     */
+    static bool decodeBase64(ne7ssh_buffer& result, const std::string& encoded);
+
+public:
+    /**
+     * Loads a known_hosts file and enables host key verification for all new connections.
+     * @param fileName Full path to the known_hosts file, NULL disables host key verification.
+     * @param allowUnknown If true, hosts without a key of the offered type in the file are accepted.
+     * @return True if the file was loaded, otherwise false is returned.
+     */
+    static bool setFile(const char* fileName, bool allowUnknown);
+
+    /**
+     * Checks a host key received from the server against the loaded known_hosts file.
+     * <p>The file is reloaded first if its modification time changed.
+     * @param host Host name or address used to connect.
+     * @param port Port used to connect.
+     * @param keyBlob Reference to a vector containing the host key blob sent by the server.
+     * @param channel Channel used for error reporting.
+     * @return True if the host key is known, or verification is disabled, otherwise false is returned.
+     */
+    static bool verify(const std::string& host, uint16 port, ne7ssh_buffer& keyBlob, int32 channel);
+
+    /**
+     * Disables host key verification and drops all loaded entries.
+     */
+    static void clear();
+};
+
+#endif
@@ -0,0 +1,310 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_MESSAGE_H
+#define NE7SSH_MESSAGE_H
+
+#include "ne7ssh_string.h"
+#include "ne7ssh_reader.h"
+#include <string>
+#include <string.h>
+
+/**
+ * Schema field holding a single byte.
+ */
+struct ne7ssh_byte_field
+{
+    static const uint32 fixedSize = 1;
+
+    static uint32 variableSize(Botan::byte)
+    {
+        return 0;
+    }
+
+    static Botan::byte* write(Botan::byte* out, Botan::byte value)
+    {
+        *out = value;
+        return out + 1;
+    }
+
+    static bool read(ne7ssh_reader& in, Botan::byte& value)
+    {
+        return in.getByte(value);
+    }
+};
+
+/**
+ * Schema field holding a boolean, encoded as a single byte.
+ */
+struct ne7ssh_bool_field
+{
+    static const uint32 fixedSize = 1;
+
+    static uint32 variableSize(bool)
+    {
+        return 0;
+    }
+
+    static Botan::byte* write(Botan::byte* out, bool value)
+    {
+        *out = value ? 1 : 0;
+        return out + 1;
+    }
+
+    static bool read(ne7ssh_reader& in, bool& value)
+    {
+        Botan::byte byte;
+
+        if (!in.getByte(byte))
+        {
+            return false;
+        }
+        value = (byte != 0);
+        return true;
+    }
+};
+
+/**
+ * Schema field holding a 32 bit integer, in network byte order.
+ */
+struct ne7ssh_uint32_field
+{
+    static const uint32 fixedSize = 4;
+
+    static uint32 variableSize(uint32)
+    {
+        return 0;
+    }
+
+    static Botan::byte* write(Botan::byte* out, uint32 value)
+    {
+        out[0] = (Botan::byte)(value >> 24);
+        out[1] = (Botan::byte)(value >> 16);
+        out[2] = (Botan::byte)(value >> 8);
+        out[3] = (Botan::byte)value;
+        return out + 4;
+    }
+
+    static bool read(ne7ssh_reader& in, uint32& value)
+    {
+        return in.getInt(value);
+    }
+};
+
+/**
+ * Schema field holding a 64 bit integer, in network byte order.
+ */
+struct ne7ssh_uint64_field
+{
+    static const uint32 fixedSize = 8;
+
+    static uint32 variableSize(uint64)
+    {
+        return 0;
+    }
+
+    static Botan::byte* write(Botan::byte* out, uint64 value)
+    {
+        out = ne7ssh_uint32_field::write(out, (uint32)(value >> 32));
+        return ne7ssh_uint32_field::write(out, (uint32)value);
+    }
+
+    static bool read(ne7ssh_reader& in, uint64& value)
+    {
+        return in.getInt64(value);
+    }
+};
+
+/**
+ * Schema field holding a length prefixed string.
+ * <p>Accepts C strings, std::string, vectors and spans when encoding. Decoding into a span does not copy the data.
+ */
+struct ne7ssh_string_field
+{
+    static const uint32 fixedSize = 4;
+
+    static uint32 variableSize(const char* value)
+    {
+        return (uint32)strlen(value);
+    }
+
+    static uint32 variableSize(const std::string& value)
+    {
+        return (uint32)value.length();
+    }
+
+    static uint32 variableSize(const Botan::MemoryRegion<Botan::byte>& value)
+    {
+        return (uint32)value.size();
+    }
+
+    static uint32 variableSize(const ne7ssh_span& value)
+    {
+        return value.length;
+    }
+
+    static Botan::byte* write(Botan::byte* out, const Botan::byte* data, uint32 len)
+    {
+        out = ne7ssh_uint32_field::write(out, len);
+        memcpy(out, data, len);
+        return out + len;
+    }
+
+    static Botan::byte* write(Botan::byte* out, const char* value)
+    {
+        return write(out, (const Botan::byte*)value, (uint32)strlen(value));
+    }
+
+    static Botan::byte* write(Botan::byte* out, const std::string& value)
+    {
+        return write(out, (const Botan::byte*)value.data(), (uint32)value.length());
+    }
+
+    static Botan::byte* write(Botan::byte* out, const Botan::MemoryRegion<Botan::byte>& value)
+    {
+        return write(out, value.begin(), (uint32)value.size());
+    }
+
+    static Botan::byte* write(Botan::byte* out, const ne7ssh_span& value)
+    {
+        return write(out, value.data, value.length);
+    }
+
+    static bool read(ne7ssh_reader& in, ne7ssh_span& value)
+    {
+        return in.getString(value);
+    }
+
+    static bool read(ne7ssh_reader& in, Botan::MemoryRegion<Botan::byte>& value)
+    {
+        return in.getString(value);
+    }
+};
+
+/**
+ * Recursive helper walking the fields of a schema together with their values.
+ */
+template <class... Fields>
+struct ne7ssh_fields;
+
+template <>
+struct ne7ssh_fields<>
+{
+    static const uint32 fixedSize = 0;
+
+    static uint32 variableSize()
+    {
+        return 0;
+    }
+
+    static Botan::byte* write(Botan::byte* out)
+    {
+        return out;
+    }
+
+    static bool read(ne7ssh_reader&)
+    {
+        return true;
+    }
+};
+
+template <class Field, class... Rest>
+struct ne7ssh_fields<Field, Rest...>
+{
+    static const uint32 fixedSize = Field::fixedSize + ne7ssh_fields<Rest...>::fixedSize;
+
+    template <class Value, class... Values>
+    static uint32 variableSize(const Value& value, const Values&... values)
+    {
+        return Field::variableSize(value) + ne7ssh_fields<Rest...>::variableSize(values...);
+    }
+
+    template <class Value, class... Values>
+    static Botan::byte* write(Botan::byte* out, const Value& value, const Values&... values)
+    {
+        return ne7ssh_fields<Rest...>::write(Field::write(out, value), values...);
+    }
+
+    template <class Value, class... Values>
+    static bool read(ne7ssh_reader& in, Value& value, Values&... values)
+    {
+        return Field::read(in, value) && ne7ssh_fields<Rest...>::read(in, values...);
+    }
+};
+
+/**
+ * Compile time description of an SSH or SFTP message: its message number followed by a list of fields.
+ * <p>The length of all fixed size parts is a compile time constant, so encoding computes the exact wire size, extends the buffer once, and writes every field in a single pass.
+ * Decoding checks the fixed size parts with a single bounds check, only strings check their own length.
+ * <p>Example: typedef ne7ssh_message<SSH2_MSG_CHANNEL_EOF, ne7ssh_uint32_field> channelEof;
+ */
+template <Botan::byte Command, class... Fields>
+class ne7ssh_message
+{
+private:
+    typedef ne7ssh_fields<Fields...> fields;
+
+public:
+    /**
+     * Length of the message on the wire, without the contents of its strings.
+     */
+    static const uint32 fixedSize = 1 + fields::fixedSize;
+
+    /**
+     * Computes the exact length of an encoded message.
+     * @param values Field values, in schema order.
+     * @return Length of the message, including the message number.
+     */
+    template <class... Values>
+    static uint32 size(const Values&... values)
+    {
+        static_assert(sizeof...(Values) == sizeof...(Fields), "Number of values does not match the message schema.");
+        return fixedSize + fields::variableSize(values...);
+    }
+
+    /**
+     * Appends an encoded message to a packet.
+     * @param out Packet the message is appended to.
+     * @param values Field values, in schema order.
+     */
+    template <class... Values>
+    static void encode(ne7ssh_string& out, const Values&... values)
+    {
+        Botan::byte* pos = out.grow(size(values...));
+
+        *pos = Command;
+        fields::write(pos + 1, values...);
+    }
+
+    /**
+     * Decodes the fields of a message, whose message number was already read.
+     * @param in Reader positioned behind the message number.
+     * @param values Variables receiving the field values, in schema order.
+     * @return True if all fields were decoded, otherwise false is returned.
+     */
+    template <class... Values>
+    static bool decode(ne7ssh_reader& in, Values&... values)
+    {
+        static_assert(sizeof...(Values) == sizeof...(Fields), "Number of values does not match the message schema.");
+        if (in.remaining() < fields::fixedSize)
+        {
+            return false;
+        }
+        return fields::read(in, values...);
+    }
+};
+
+#endif
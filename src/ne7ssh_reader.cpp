@@ -0,0 +1,140 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#include "ne7ssh_reader.h"
+
+using namespace Botan;
+
+ne7ssh_reader::ne7ssh_reader(const Botan::MemoryRegion<Botan::byte>& buffer, uint32 position)
+    : _data(buffer.begin()),
+    _length(buffer.size()),
+    _position((position < buffer.size()) ? position : buffer.size())
+{
+}
+
+ne7ssh_reader::ne7ssh_reader(const Botan::byte* data, uint32 length)
+    : _data(data),
+    _length(length),
+    _position(0)
+{
+}
+
+ne7ssh_reader::ne7ssh_reader(const ne7ssh_span& span)
+    : _data(span.data),
+    _length(span.length),
+    _position(0)
+{
+}
+
+bool ne7ssh_reader::getByte(Botan::byte& result)
+{
+    if (remaining() < 1)
+    {
+        return false;
+    }
+    result = _data[_position++];
+    return true;
+}
+
+bool ne7ssh_reader::getInt(uint32& result)
+{
+    const Botan::byte* field = _data + _position;
+
+    if (remaining() < sizeof(uint32))
+    {
+        return false;
+    }
+    result = ((uint32)field[0] << 24) | ((uint32)field[1] << 16) | ((uint32)field[2] << 8) | (uint32)field[3];
+    _position += sizeof(uint32);
+    return true;
+}
+
+bool ne7ssh_reader::getInt64(uint64& result)
+{
+    uint32 high, low;
+
+    if (remaining() < sizeof(uint64))
+    {
+        return false;
+    }
+    getInt(high);
+    getInt(low);
+    result = ((uint64)high << 32) | low;
+    return true;
+}
+
+bool ne7ssh_reader::getString(ne7ssh_span& result)
+{
+    uint32 len;
+
+    if (!getInt(len))
+    {
+        return false;
+    }
+    if (len > remaining())
+    {
+        _position -= sizeof(uint32);
+        return false;
+    }
+    result.data = _data + _position;
+    result.length = len;
+    _position += len;
+    return true;
+}
+
+bool ne7ssh_reader::getString(Botan::MemoryRegion<Botan::byte>& result)
+{
+    ne7ssh_span field;
+
+    if (!getString(field))
+    {
+        return false;
+    }
+    result.set(field.data, field.length);
+    return true;
+}
+
+bool ne7ssh_reader::getBigInt(Botan::BigInt& result)
+{
+    ne7ssh_span field;
+
+    if (!getString(field))
+    {
+        return false;
+    }
+    BigInt tmpBI(field.data, field.length);
+    result.swap(tmpBI);
+    return true;
+}
+
+bool ne7ssh_reader::skip(uint32 nBytes)
+{
+    if (nBytes > remaining())
+    {
+        return false;
+    }
+    _position += nBytes;
+    return true;
+}
+
+ne7ssh_span ne7ssh_reader::rest() const
+{
+    ne7ssh_span result;
+
+    result.data = _data + _position;
+    result.length = remaining();
+    return result;
+}
@@ -0,0 +1,131 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_READER_H
+#define NE7SSH_READER_H
+
+#include "ne7ssh_types.h"
+#include <botan/bigint.h>
+
+/**
+ * Non owning view of a range of bytes inside a packet buffer.
+ * <p>Only valid as long as the buffer it was taken from is neither modified nor destroyed.
+ */
+typedef struct
+{
+    const Botan::byte* data;
+    uint32 length;
+} ne7ssh_span;
+
+/**
+ * Cursor based parser for SSH and SFTP packet fields.
+ * <p>Unlike the get methods of ne7ssh_string, reading a field only advances the cursor, the buffer itself is never copied or modified.
+ * Every accessor checks the remaining length first, and leaves the cursor untouched if the field does not fit.
+ */
+class ne7ssh_reader
+{
+private:
+    const Botan::byte* _data;
+    uint32 _length;
+    uint32 _position;
+
+public:
+    /**
+     * Constructor.
+     * @param buffer Reference to a vector containing the packet. It must outlive the reader.
+     * @param position Position in the vector to start reading from.
+     */
+    ne7ssh_reader(const Botan::MemoryRegion<Botan::byte>& buffer, uint32 position = 0);
+
+    /**
+     * Constructor.
+     * @param data Pointer to the packet data. It must outlive the reader.
+     * @param length Length of the packet data.
+     */
+    ne7ssh_reader(const Botan::byte* data, uint32 length);
+
+    /**
+     * Constructor. Parses the content of a previously extracted field.
+     * @param span View of the data to parse.
+     */
+    ne7ssh_reader(const ne7ssh_span& span);
+
+    /**
+     * Extracts a single byte.
+     * @param result Reference to a variable where the result will be stored.
+     * @return True if the byte was available, otherwise false is returned.
+     */
+    bool getByte(Botan::byte& result);
+
+    /**
+     * Extracts a single unsigned integer, converted from the network format.
+     * @param result Reference to a variable where the result will be stored.
+     * @return True if the integer was available, otherwise false is returned.
+     */
+    bool getInt(uint32& result);
+
+    /**
+     * Extracts a single 64 bit unsigned integer, converted from the network format.
+     * @param result Reference to a variable where the result will be stored.
+     * @return True if the integer was available, otherwise false is returned.
+     */
+    bool getInt64(uint64& result);
+
+    /**
+     * Extracts a single string field without copying it.
+     * @param result Reference to a span which will point at the string data inside the buffer.
+     * @return True if the string field was found and fits in the buffer, otherwise false is returned.
+     */
+    bool getString(ne7ssh_span& result);
+
+    /**
+     * Extracts a single string field into a vector.
+     * @param result Reference to a vector where the string data will be copied.
+     * @return True if the string field was found and fits in the buffer, otherwise false is returned.
+     */
+    bool getString(Botan::MemoryRegion<Botan::byte>& result);
+
+    /**
+     * Extracts a single BigInt field.
+     * @param result Reference to a BigInt variable where the result will be stored.
+     * @return True if the BigInt field was found and fits in the buffer, otherwise false is returned.
+     */
+    bool getBigInt(Botan::BigInt& result);
+
+    /**
+     * Advances the cursor without parsing.
+     * @param nBytes How many bytes to skip.
+     * @return True if the bytes were available, otherwise false is returned.
+     */
+    bool skip(uint32 nBytes);
+
+    /**
+     * Returns number of bytes not yet read.
+     * @return Number of bytes left in the buffer.
+     */
+    uint32 remaining() const
+    {
+        return _length - _position;
+    }
+
+    /**
+     * Returns the unread part of the buffer.
+     * @return View of the bytes left in the buffer.
+     */
+    ne7ssh_span rest() const;
+};
+
+#endif
@@ -17,23 +17,76 @@
 #ifndef NE7SSH_RNG_H
 #define NE7SSH_RNG_H
 
+#include "ne7ssh_types.h"
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 #include <botan/auto_rng.h>
+#include <botan/hmac_drbg.h>
+#include <botan/hmac.h>
+#include <botan/sha2_32.h>
 
+/** Number of bytes a per-thread generator produces before it is reseeded. */
+#define NE7SSH_RNG_RESEED_BYTES (1024 * 1024)
+
+/** Number of bits requested from the global generator when a per-thread generator is (re)seeded. */
+#define NE7SSH_RNG_SEED_BITS 256
+
+/**
+ * Random number generator shared by all connections.
+ * <p>Each thread draws from its own HMAC_DRBG instance, seeded from the global AutoSeeded_RNG and reseeded with its output
+ * every NE7SSH_RNG_RESEED_BYTES bytes, so random generation does not serialize on a single lock, and system entropy is only polled by the global generator.
+ * The global generator is used directly if a per-thread instance cannot be created.
+ */
 class ne7ssh_rng : public Botan::RandomNumberGenerator
 {
 public:
     ne7ssh_rng()
-        : _rng(new Botan::AutoSeeded_RNG())
+        : _rng(new Botan::AutoSeeded_RNG()),
+        _generation(++generationCounter())
     {
+        std::unique_lock<std::mutex> lock(registryMutex());
+        current() = this;
     }
 
     ~ne7ssh_rng()
     {
+        std::unique_lock<std::mutex> lock(registryMutex());
+        if (current() == this)
+        {
+            current() = 0;
+        }
+        for (size_t i = 0; i < _threadRngs.size(); i++)
+        {
+            delete _threadRngs[i];
+        }
+        _threadRngs.clear();
     }
 
     void randomize(Botan::byte output[], size_t length)
     {
+        threadGenerator& local = threadLocal();
+
+        if (local.generation != _generation)
+        {
+            local.drbg = createThreadGenerator();
+            local.generation = _generation;
+            local.output = 0;
+        }
+        if (local.drbg)
+        {
+            if (local.output >= NE7SSH_RNG_RESEED_BYTES)
+            {
+                local.drbg->reseed(NE7SSH_RNG_SEED_BITS);
+                local.output = 0;
+            }
+            local.drbg->randomize(output, length);
+            local.output += length;
+            return;
+        }
+
         std::unique_lock<std::recursive_mutex> lock(_mutex);
         _rng->randomize(output, length);
     }
@@ -51,8 +104,14 @@ public:
 
     void reseed(size_t bits_to_collect)
     {
-        std::unique_lock<std::recursive_mutex> lock(_mutex);
-        _rng->reseed(bits_to_collect);
+        threadGenerator& local = threadLocal();
+
+        reseedGlobal(bits_to_collect);
+        if ((local.generation == _generation) && local.drbg)
+        {
+            local.drbg->reseed(bits_to_collect);
+            local.output = 0;
+        }
     }
 
     void add_entropy_source(Botan::EntropySource* source)
@@ -68,8 +127,141 @@ public:
     }
 
 private:
+    /**
+    * Seed source handed to per-thread generators. Forwards to the global generator of its owner, without taking ownership of it.
+    */
+    class seedSource : public Botan::RandomNumberGenerator
+    {
+    public:
+        seedSource(ne7ssh_rng* owner)
+            : _owner(owner)
+        {
+        }
+
+        void randomize(Botan::byte output[], size_t length)
+        {
+            std::unique_lock<std::recursive_mutex> lock(_owner->_mutex);
+            _owner->_rng->randomize(output, length);
+        }
+
+        void clear() throw()
+        {
+        }
+
+        std::string name() const
+        {
+            return _owner->_rng->name();
+        }
+
+        // The global generator polls system entropy on its own schedule, a per-thread reseed only draws fresh bytes from it.
+        void reseed(size_t)
+        {
+        }
+
+        void add_entropy_source(Botan::EntropySource* source)
+        {
+            _owner->add_entropy_source(source);
+        }
+
+        void add_entropy(const Botan::byte in[], size_t length)
+        {
+            _owner->add_entropy(in, length);
+        }
+
+    private:
+        ne7ssh_rng* _owner;
+    };
+
+    /**
+    * Per-thread generator state. Generation ties the generator to the ne7ssh_rng instance that created it.
+    */
+    struct threadGenerator
+    {
+        uint64 generation;
+        Botan::RandomNumberGenerator* drbg;
+        size_t output;
+
+        threadGenerator()
+            : generation(0),
+            drbg(0),
+            output(0)
+        {
+        }
+
+        ~threadGenerator()
+        {
+            std::unique_lock<std::mutex> lock(registryMutex());
+            if (drbg && current() && (current()->_generation == generation))
+            {
+                current()->releaseThreadGenerator(drbg);
+            }
+        }
+    };
+
     std::recursive_mutex _mutex;
     std::unique_ptr<Botan::RandomNumberGenerator> _rng;
+    uint64 _generation;
+    std::vector<Botan::RandomNumberGenerator*> _threadRngs;
+
+    static threadGenerator& threadLocal()
+    {
+        static thread_local threadGenerator local;
+        return local;
+    }
+
+    static std::atomic<uint64>& generationCounter()
+    {
+        static std::atomic<uint64> counter(0);
+        return counter;
+    }
+
+    static std::mutex& registryMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static ne7ssh_rng*& current()
+    {
+        static ne7ssh_rng* instance = 0;
+        return instance;
+    }
+
+    void reseedGlobal(size_t bits_to_collect)
+    {
+        std::unique_lock<std::recursive_mutex> lock(_mutex);
+        _rng->reseed(bits_to_collect);
+    }
+
+    Botan::RandomNumberGenerator* createThreadGenerator()
+    {
+        Botan::RandomNumberGenerator* drbg = 0;
+
+        try
+        {
+            drbg = new Botan::HMAC_DRBG(new Botan::HMAC(new Botan::SHA_256), new Botan::HMAC(new Botan::SHA_256), new seedSource(this));
+            drbg->reseed(NE7SSH_RNG_SEED_BITS);
+        }
+        catch (const std::exception&)
+        {
+            delete drbg;
+            return 0;
+        }
+
+        std::unique_lock<std::mutex> lock(registryMutex());
+        _threadRngs.push_back(drbg);
+        return drbg;
+    }
+
+    void releaseThreadGenerator(Botan::RandomNumberGenerator* drbg)
+    {
+        std::vector<Botan::RandomNumberGenerator*>::iterator it = std::find(_threadRngs.begin(), _threadRngs.end(), drbg);
+        if (it != _threadRngs.end())
+        {
+            _threadRngs.erase(it);
+            delete drbg;
+        }
+    }
 };
 
 #endif
@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#include "ne7ssh_send_queue.h"
+#include <botan/mem_ops.h>
+#include <algorithm>
+
+ne7ssh_send_queue::ne7ssh_send_queue() : _frontStart(0), _length(0)
+{
+}
+
+ne7ssh_send_queue::~ne7ssh_send_queue()
+{
+    clear();
+}
+
+void ne7ssh_send_queue::append(const Botan::byte* data, size_t len)
+{
+    if (!len)
+    {
+        return;
+    }
+    _length += len;
+    if (!_segments.empty() && (_segments.back().size() + len <= NE7SSH_SEGMENT_SIZE))
+    {
+        _segments.back().append((const char*)data, len);
+        return;
+    }
+    _segments.push_back(std::string());
+    _segments.back().reserve(std::max(len, (size_t)NE7SSH_SEGMENT_SIZE));
+    _segments.back().append((const char*)data, len);
+}
+
+void ne7ssh_send_queue::append(std::string&& data)
+{
+    if (data.empty())
+    {
+        return;
+    }
+    _length += data.size();
+    _segments.push_back(std::move(data));
+}
+
+void ne7ssh_send_queue::copy(Botan::byte* out, size_t len, size_t offset) const
+{
+    size_t start = _frontStart + offset, count, i = 0;
+
+    while ((i < _segments.size()) && (start >= _segments[i].size()))
+    {
+        start -= _segments[i].size();
+        i++;
+    }
+    for (; len && (i < _segments.size()); i++)
+    {
+        count = std::min(len, _segments[i].size() - start);
+        memcpy(out, _segments[i].data() + start, count);
+        out += count;
+        len -= count;
+        start = 0;
+    }
+}
+
+void ne7ssh_send_queue::consume(size_t len)
+{
+    size_t count;
+
+    if (len >= _length)
+    {
+        clear();
+        return;
+    }
+    _length -= len;
+    while (len)
+    {
+        count = std::min(len, _segments.front().size() - _frontStart);
+        _frontStart += count;
+        len -= count;
+        if (_frontStart == _segments.front().size())
+        {
+            popSegment();
+        }
+    }
+}
+
+void ne7ssh_send_queue::clear()
+{
+    while (!_segments.empty())
+    {
+        popSegment();
+    }
+    _length = 0;
+}
+
+void ne7ssh_send_queue::popSegment()
+{
+    std::string& segment = _segments.front();
+
+    if (!segment.empty())
+    {
+        Botan::clear_mem(&segment[0], segment.size());
+    }
+    _segments.pop_front();
+    _frontStart = 0;
+}
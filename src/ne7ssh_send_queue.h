@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2007 by NetSieben Technologies INC                 *
+ *   Author: Andrew Useckas                                                *
+ *   Email: andrew@netsieben.com                                           *
+ *                                                                         *
+ *   Windows Port and bugfixes: Keef Aragon <keef@netsieben.com>           *
+ *                                                                         *
+ *   This program may be distributed under the terms of the Q Public       *
+ *   License as defined by Trolltech AS of Norway and appearing in the     *
+ *   file LICENSE.QPL included in the packaging of this file.              *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.                  *
+ ***************************************************************************/
+
+#ifndef NE7SSH_SEND_QUEUE_H
+#define NE7SSH_SEND_QUEUE_H
+
+#include "ne7ssh_types.h"
+#include <botan/secmem.h>
+#include <deque>
+#include <string>
+
+// Small writes are coalesced into segments of up to this size.
+#define NE7SSH_SEGMENT_SIZE 32768
+
+/**
+ * Queue of data waiting to be sent on a channel.
+ * <p>Data is kept in segments. Small writes are copied into the last segment, so they are sent together, while buffers handed over with append(std::string&&) become segments of their own without being copied.
+ * Released segments are wiped before their memory is freed.
+ */
+class ne7ssh_send_queue
+{
+private:
+    std::deque<std::string> _segments;
+    size_t _frontStart;
+    size_t _length;
+
+    /**
+     * Wipes and drops the first segment.
+     */
+    void popSegment();
+
+public:
+    /**
+     * Constructor.
+     */
+    ne7ssh_send_queue();
+
+    /**
+     * Destructor. Wipes all queued data.
+     */
+    ~ne7ssh_send_queue();
+
+    /**
+     * Copies data to the end of the queue.
+     * @param data Pointer to the data.
+     * @param len Length of the data.
+     */
+    void append(const Botan::byte* data, size_t len);
+
+    /**
+     * Takes over a buffer, and adds it to the end of the queue without copying it.
+     * @param data Buffer to take over. It is left empty.
+     */
+    void append(std::string&& data);
+
+    /**
+     * Copies data from the front of the queue, without releasing it.
+     * @param out Destination buffer.
+     * @param len Number of bytes to copy. Must not exceed length() - offset.
+     * @param offset Number of bytes at the front of the queue to skip.
+     */
+    void copy(Botan::byte* out, size_t len, size_t offset = 0) const;
+
+    /**
+     * Releases data from the front of the queue.
+     * @param len Number of bytes to release. Larger values release all data.
+     */
+    void consume(size_t len);
+
+    /**
+     * Drops all data.
+     */
+    void clear();
+
+    /**
+     * Gets the length of the queued data.
+     * @return Length of the data.
+     */
+    size_t length() const
+    {
+        return _length;
+    }
+
+    /**
+     * Checks if the queue holds any data.
+     * @return True if the queue is empty, otherwise false is returned.
+     */
+    bool empty() const
+    {
+        return !_length;
+    }
+};
+
+#endif
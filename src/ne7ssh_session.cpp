@@ -17,7 +17,8 @@
 #include "ne7ssh_session.h"
 
 ne7ssh_session::ne7ssh_session()
-    : _sendChannel(0),
+    : _remotePort(0),
+    _sendChannel(0),
     _receiveChannel(0),
     _maxPacket(0),
     _channelID(-1),
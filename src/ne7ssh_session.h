@@ -26,9 +26,12 @@
 class ne7ssh_session
 {
 private:
-    Botan::SecureVector<Botan::byte> _localVersion;
-    Botan::SecureVector<Botan::byte> _remoteVersion;
+    ne7ssh_buffer _localVersion;
+    ne7ssh_buffer _remoteVersion;
     Botan::SecureVector<Botan::byte> _sessionID;
+    ne7ssh_buffer _serverSigAlgs;
+    std::string _remoteHost;
+    uint16 _remotePort;
     uint32 _sendChannel;
     uint32 _receiveChannel;
     uint32 _maxPacket;
@@ -52,7 +55,7 @@ public:
      * Sets the local SSH version string.
      * @param version Reference to a vector containing the version string.
      */
-    void setLocalVersion(Botan::SecureVector<Botan::byte>& version)
+    void setLocalVersion(ne7ssh_buffer& version)
     {
         _localVersion = version;
     }
@@ -61,7 +64,7 @@ public:
      * Returns local SSH version.
      * @return Reference to a vector containing the version string.
      */
-    Botan::SecureVector<Botan::byte> &getLocalVersion()
+    ne7ssh_buffer &getLocalVersion()
     {
         return _localVersion;
     }
@@ -70,7 +73,7 @@ public:
      * Sets the remote SSH version string.
      * @param version Reference to a vector containing the version string.
      */
-    void setRemoteVersion(Botan::SecureVector<Botan::byte>& version)
+    void setRemoteVersion(ne7ssh_buffer& version)
     {
         _remoteVersion = version;
     }
@@ -79,11 +82,40 @@ public:
      * Returns remote SSH version.
      * @return Reference to a vector containing the version string.
      */
-    Botan::SecureVector<Botan::byte> &getRemoteVersion()
+    ne7ssh_buffer &getRemoteVersion()
     {
         return _remoteVersion;
     }
 
+    /**
+     * Stores the host name and port this session connects to.
+     * @param host Host name or address.
+     * @param port Port number.
+     */
+    void setRemoteHost(const char* host, uint16 port)
+    {
+        _remoteHost.assign(host);
+        _remotePort = port;
+    }
+
+    /**
+     * Returns the host name this session connects to.
+     * @return Host name or address.
+     */
+    const std::string& getRemoteHost() const
+    {
+        return _remoteHost;
+    }
+
+    /**
+     * Returns the port this session connects to.
+     * @return Port number.
+     */
+    uint16 getRemotePort() const
+    {
+        return _remotePort;
+    }
+
     /**
      * Sets SSH session ID, a.k.a. H from the first KEX.
      * @param session Reference to a vector containing the session ID.
@@ -102,6 +134,24 @@ public:
         return _sessionID;
     }
 
+    /**
+     * Stores the signature algorithms the server accepts for public key authentication, as announced in its "server-sig-algs" extension.
+     * @param algos Reference to a vector containing the comma separated algorithm list.
+     */
+    void setServerSigAlgs(ne7ssh_buffer& algos)
+    {
+        _serverSigAlgs = algos;
+    }
+
+    /**
+     * Returns the signature algorithms announced by the server in its "server-sig-algs" extension.
+     * @return Reference to a vector containing the comma separated algorithm list, empty if the server did not send the extension.
+     */
+    ne7ssh_buffer &getServerSigAlgs()
+    {
+        return _serverSigAlgs;
+    }
+
     /**
      * After the channel is open this function sets the send channel ID.
      * @param channel Channel ID.
@@ -19,9 +19,31 @@
 #include "ne7ssh_sftp_packet.h"
 #include "ne7ssh_impl.h"
 #include "ne7ssh_session.h"
+#include "ne7ssh_message.h"
 
 using namespace Botan;
 
+// SFTP requests, draft-ietf-secsh-filexfer-02. Every request starts with its request ID.
+typedef ne7ssh_message<SSH2_MSG_CHANNEL_REQUEST, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_bool_field, ne7ssh_string_field> subsystemRequestMsg;
+typedef ne7ssh_message<SSH2_FXP_INIT, ne7ssh_uint32_field> sftpInitMsg;
+typedef ne7ssh_message<SSH2_FXP_OPEN, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_uint32_field, ne7ssh_uint32_field> sftpOpenMsg;
+typedef ne7ssh_message<SSH2_FXP_OPENDIR, ne7ssh_uint32_field, ne7ssh_string_field> sftpOpenDirMsg;
+typedef ne7ssh_message<SSH2_FXP_READ, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_uint64_field, ne7ssh_uint32_field> sftpReadMsg;
+// Only the header, the data follows in one or more channel packets.
+typedef ne7ssh_message<SSH2_FXP_WRITE, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_uint64_field, ne7ssh_uint32_field> sftpWriteMsg;
+typedef ne7ssh_message<SSH2_FXP_CLOSE, ne7ssh_uint32_field, ne7ssh_string_field> sftpCloseMsg;
+typedef ne7ssh_message<SSH2_FXP_STAT, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_uint32_field> sftpStatMsg;
+typedef ne7ssh_message<SSH2_FXP_LSTAT, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_uint32_field> sftpLStatMsg;
+typedef ne7ssh_message<SSH2_FXP_FSTAT, ne7ssh_uint32_field, ne7ssh_string_field> sftpFStatMsg;
+typedef ne7ssh_message<SSH2_FXP_REMOVE, ne7ssh_uint32_field, ne7ssh_string_field> sftpRemoveMsg;
+typedef ne7ssh_message<SSH2_FXP_RENAME, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_string_field> sftpRenameMsg;
+typedef ne7ssh_message<SSH2_FXP_MKDIR, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_uint32_field> sftpMkdirMsg;
+typedef ne7ssh_message<SSH2_FXP_RMDIR, ne7ssh_uint32_field, ne7ssh_string_field> sftpRmdirMsg;
+typedef ne7ssh_message<SSH2_FXP_READDIR, ne7ssh_uint32_field, ne7ssh_string_field> sftpReadDirMsg;
+typedef ne7ssh_message<SSH2_FXP_REALPATH, ne7ssh_uint32_field, ne7ssh_string_field> sftpRealPathMsg;
+typedef ne7ssh_message<SSH2_FXP_SETSTAT, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_uint32_field, ne7ssh_uint32_field> sftpSetPermissionsMsg;
+typedef ne7ssh_message<SSH2_FXP_SETSTAT, ne7ssh_uint32_field, ne7ssh_string_field, ne7ssh_uint32_field, ne7ssh_uint32_field, ne7ssh_uint32_field> sftpSetOwnerMsg;
+
 Ne7sshSftp::Ne7sshSftp(std::shared_ptr<ne7ssh_session> session, std::shared_ptr<ne7ssh_channel> channel)
     : ne7ssh_channel(session),
     _session(session),
@@ -30,8 +52,7 @@ Ne7sshSftp::Ne7sshSftp(std::shared_ptr<ne7ssh_session> session, std::shared_ptr<
     _sftpCmd(0),
     _lastError(0)
 {
-    _windowRecv = channel->getRecvWindow();
-    _windowSend = channel->getSendWindow();
+    takeOverWindows(*channel);
 }
 
 Ne7sshSftp::~Ne7sshSftp()
@@ -41,32 +62,22 @@ Ne7sshSftp::~Ne7sshSftp()
 bool Ne7sshSftp::init()
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
-    ne7ssh_string packet;
+    ne7ssh_string request;
+    Ne7sshSftpPacket packet(_session->getSendChannel());
     bool status;
 
-    packet.clear();
-    packet.addChar(SSH2_MSG_CHANNEL_REQUEST);
-    packet.addInt(_session->getSendChannel());
-    packet.addString("subsystem");
-    packet.addChar(0);
-    packet.addString("sftp");
+    subsystemRequestMsg::encode(request, _session->getSendChannel(), "subsystem", false, "sftp");
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendPacket(request.value()))
     {
         return false;
     }
 
-    packet.clear();
-    packet.addChar(SSH2_MSG_CHANNEL_DATA);
-    packet.addInt(_session->getSendChannel());
-    packet.addInt(sizeof(uint32) * 2 + sizeof(char));
-    packet.addInt(sizeof(uint32) + sizeof(char));
-    packet.addChar(SSH2_FXP_INIT);
-    packet.addInt(SFTP_VERSION);
+    sftpInitMsg::encode(packet, SFTP_VERSION);
 
-    _windowSend -= 9;
+    _windowSend -= packet.channelDataLength();
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
@@ -77,76 +88,74 @@ bool Ne7sshSftp::init()
     return status;
 }
 
-bool Ne7sshSftp::handleData(Botan::SecureVector<Botan::byte>& packet)
+bool Ne7sshSftp::handleData(ne7ssh_reader& channelData)
 {
-    ne7ssh_string mainBuffer(packet, 0);
-    SecureVector<Botan::byte> sftpBuffer;
+    ne7ssh_span sftpData;
+    ne7ssh_buffer assembled;
     uint32 len = 0;
     Botan::byte cmd;
 
-    mainBuffer.getInt();
-
-    if (!mainBuffer.getString(sftpBuffer))
+    if (!channelData.skip(sizeof(uint32)) || !channelData.getString(sftpData))
     {
         return false;
     }
-    if (!sftpBuffer.size())
+    if (!sftpData.length)
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "Abnormal. End of stream detected in SFTP subsystem.");
     }
 
-    adjustRecvWindow(sftpBuffer.size());
+    adjustRecvWindow(sftpData.length);
 
     if (_seq >= SFTP_MAX_SEQUENCE)
     {
         _seq = 0;
     }
 
-    mainBuffer.clear();
-
-    len = _commBuffer.length();
-
-    if (len)
+    // Only a message split over several channel packets is assembled in _commBuffer, otherwise it is parsed in place.
+    ne7ssh_reader sftpBuffer(sftpData);
+    if (_commBuffer.length())
     {
-        mainBuffer.addVector(_commBuffer.value());
+        _commBuffer.addBytes(sftpData.data, sftpData.length);
+        sftpBuffer = ne7ssh_reader(_commBuffer.value());
     }
 
-    _commBuffer.addVector(sftpBuffer);
-    mainBuffer.addVector(sftpBuffer);
-
-    len = mainBuffer.getInt();
-
-    if (len > mainBuffer.length())
+    if (!sftpBuffer.getInt(len) || (len > sftpBuffer.remaining()))
     {
+        if (!_commBuffer.length())
+        {
+            _commBuffer.addBytes(sftpData.data, sftpData.length);
+        }
         return true;
     }
-    else
+
+    // Handlers may reset _commBuffer, keep the assembled message alive while it is parsed.
+    assembled.swap(_commBuffer.value());
+
+    if (!sftpBuffer.getByte(cmd))
     {
-        _commBuffer.clear();
+        return false;
     }
 
-    cmd = mainBuffer.getByte();
-
     this->_sftpCmd = cmd;
     switch (cmd)
     {
         case SSH2_FXP_VERSION:
-            return handleVersion(mainBuffer.value());
+            return handleVersion(sftpBuffer);
 
         case SSH2_FXP_HANDLE:
-            return addOpenHandle(mainBuffer.value());
+            return addOpenHandle(sftpBuffer);
 
         case SSH2_FXP_STATUS:
-            return handleStatus(mainBuffer.value());
+            return handleStatus(sftpBuffer);
 
         case SSH2_FXP_DATA:
-            return handleSftpData(mainBuffer.value());
+            return handleSftpData(sftpBuffer);
 
         case SSH2_FXP_NAME:
-            return handleNames(mainBuffer.value());
+            return handleNames(sftpBuffer);
 
         case SSH2_FXP_ATTRS:
-            return processAttrs(mainBuffer.value());
+            return processAttrs(sftpBuffer);
 
         default:
             ne7ssh::errors()->push(_session->getSshChannel(), "Unhandled SFTP subsystem command: %i.", cmd);
@@ -158,25 +167,42 @@ bool Ne7sshSftp::handleData(Botan::SecureVector<Botan::byte>& packet)
 bool Ne7sshSftp::receiveWindowAdjust()
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
-    SecureVector<Botan::byte> packet;
+    ne7ssh_span payload;
 
-    if (!transport->waitForPacket(SSH2_MSG_CHANNEL_WINDOW_ADJUST))
+    // Packets for other channels on the connection are routed to them, anything else sent on this channel is handled as usual.
+    std::unique_lock<std::recursive_mutex> lock(transport->getMutex());
+    while (true)
     {
-        ne7ssh::errors()->push(_session->getSshChannel(), "Remote side could not adjust the Window.");
-        return false;
-    }
-    transport->getPacket(packet);
-    if (!handleReceived(packet))
-    {
-        return false;
+        if (transport->waitForPacket(0) <= 0)
+        {
+            ne7ssh::errors()->push(_session->getSshChannel(), "Remote side could not adjust the Window.");
+            return false;
+        }
+        if (!transport->getPayload(payload))
+        {
+            return false;
+        }
+        if (routeToOwner(payload) || !payload.length)
+        {
+            continue;
+        }
+        if (payload.data[0] == SSH2_MSG_CHANNEL_WINDOW_ADJUST)
+        {
+            return handleReceived(payload);
+        }
+        handleReceived(payload);
+        if (!isOpen())
+        {
+            ne7ssh::errors()->push(_session->getSshChannel(), "Channel closed while waiting for the Window adjustment.");
+            return false;
+        }
     }
-    return true;
 }
 
 bool Ne7sshSftp::receiveUntil(uint8 cmd, uint32 timeSec)
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
-    SecureVector<Botan::byte> packet;
+    ne7ssh_span payload;
     uint32 cutoff = timeSec * 1000000, timeout = 0;
     uint32 prevSize = 0;
     short status;
@@ -187,15 +213,16 @@ bool Ne7sshSftp::receiveUntil(uint8 cmd, uint32 timeSec)
 
     while (forever)
     {
+        std::unique_lock<std::recursive_mutex> lock(transport->getMutex());
         status = transport->waitForPacket(0, false);
         if (status > 0)
         {
-            transport->getPacket(packet);
-            if (!handleReceived(packet))
+            if (!transport->getPayload(payload) || !dispatch(payload))
             {
                 return false;
             }
         }
+        lock.unlock();
 
         if (_commBuffer.length() > prevSize)
         {
@@ -229,7 +256,7 @@ bool Ne7sshSftp::receiveUntil(uint8 cmd, uint32 timeSec)
 bool Ne7sshSftp::receiveWhile(uint8 cmd, uint32 timeSec)
 {
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
-    SecureVector<Botan::byte> packet;
+    ne7ssh_span payload;
     uint32 cutoff = timeSec * 1000000, timeout = 0;
     uint32 prevSize = 0;
     short status;
@@ -240,15 +267,16 @@ bool Ne7sshSftp::receiveWhile(uint8 cmd, uint32 timeSec)
 
     while (forever)
     {
+        std::unique_lock<std::recursive_mutex> lock(transport->getMutex());
         status = transport->waitForPacket(0, false);
         if (status > 0)
         {
-            transport->getPacket(packet);
-            if (!handleReceived(packet))
+            if (!transport->getPayload(payload) || !dispatch(payload))
             {
                 return false;
             }
         }
+        lock.unlock();
 
         if (_commBuffer.length() > prevSize)
         {
@@ -284,12 +312,11 @@ bool Ne7sshSftp::receiveWhile(uint8 cmd, uint32 timeSec)
     return false;
 }
 
-bool Ne7sshSftp::handleVersion(Botan::SecureVector<Botan::byte>& packet)
+bool Ne7sshSftp::handleVersion(ne7ssh_reader& packet)
 {
-    ne7ssh_string sftpBuffer(packet, 0);
-    uint32 version;
+    uint32 version = 0;
 
-    version = sftpBuffer.getInt();
+    packet.getInt(version);
 
     if (version != SFTP_VERSION)
     {
@@ -300,71 +327,65 @@ bool Ne7sshSftp::handleVersion(Botan::SecureVector<Botan::byte>& packet)
     return true;
 }
 
-bool Ne7sshSftp::handleStatus(Botan::SecureVector<Botan::byte>& packet)
+bool Ne7sshSftp::handleStatus(ne7ssh_reader& packet)
 {
-    ne7ssh_string sftpBuffer(packet, 0);
-    uint32 errorID;
-    SecureVector<Botan::byte> errorStr;
+    uint32 errorID = 0;
+    ne7ssh_buffer errorStr;
 
-    sftpBuffer.getInt();
-    errorID = sftpBuffer.getInt();
-    sftpBuffer.getString(errorStr);
+    packet.skip(sizeof(uint32));
+    packet.getInt(errorID);
+    packet.getString(errorStr);
 
     if (errorID)
     {
         _lastError = (uint8)errorID;
-        ne7ssh::errors()->push(_session->getSshChannel(), "SFTP Error code: <%i>, description: %s.", errorID, errorStr.begin());
+        ne7ssh::errors()->push(_session->getSshChannel(), "SFTP Error code: <%i>, description: %B.", errorID, &errorStr);
         return false;
     }
     return true;
 }
 
-bool Ne7sshSftp::addOpenHandle(Botan::SecureVector<Botan::byte>& packet)
+bool Ne7sshSftp::addOpenHandle(ne7ssh_reader& packet)
 {
-    ne7ssh_string sftpBuffer(packet, 0);
     uint32 requestID;
-    SecureVector<Botan::byte> handle;
+    ne7ssh_span handle;
 
-    requestID = sftpBuffer.getInt();
-    sftpBuffer.getString(handle);
+    if (!packet.getInt(requestID) || !packet.getString(handle))
+    {
+        return false;
+    }
 
     sftpFile file;
     file.fileID = requestID;
-    file._handle.assign((char*)handle.begin(), handle.size());
+    file._handle.assign((const char*)handle.data, handle.length);
     sftpFiles.push_back(file);
 
     return true;
 }
 
-bool Ne7sshSftp::handleSftpData(Botan::SecureVector<Botan::byte>& packet)
+bool Ne7sshSftp::handleSftpData(ne7ssh_reader& packet)
 {
-    ne7ssh_string sftpBuffer(packet, 0);
-    SecureVector<Botan::byte> data;
-
-    sftpBuffer.getInt();
-    sftpBuffer.getString(data);
+    ne7ssh_span data;
 
-    if (data.size() == 0)
+    if (!packet.skip(sizeof(uint32)) || !packet.getString(data) || (data.length == 0))
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "Abnormal. End of stream detected.");
         return false;
     }
 
     _commBuffer.clear();
-    _fileBuffer.clear();
-    _fileBuffer.swap(data);
+    _fileBuffer.set(data.data, data.length);
     return true;
 }
 
-bool Ne7sshSftp::handleNames(Botan::SecureVector<Botan::byte>& packet)
+bool Ne7sshSftp::handleNames(ne7ssh_reader& packet)
 {
-    Ne7sshSftpPacket sftpBuffer(packet, 0);
     ne7ssh_string tmpVar;
-    uint32 fileCount, i;
-    SecureVector<Botan::byte> fileName;
+    uint32 fileCount = 0, i;
+    ne7ssh_span fileName, longName;
 
-    sftpBuffer.getInt();
-    fileCount = sftpBuffer.getInt();
+    packet.skip(sizeof(uint32));
+    packet.getInt(fileCount);
     tmpVar.addInt(fileCount);
 
     if (!fileCount)
@@ -374,65 +395,63 @@ bool Ne7sshSftp::handleNames(Botan::SecureVector<Botan::byte>& packet)
 
     for (i = 0; i < fileCount; i++)
     {
-        sftpBuffer.getString(fileName);
-        tmpVar.addVectorField(fileName);
-        sftpBuffer.getString(fileName);
-        tmpVar.addVectorField(fileName);
-        _attrs.flags = sftpBuffer.getInt();
-        if (_attrs.flags & SSH2_FILEXFER_ATTR_SIZE)
-        {
-            _attrs.size = sftpBuffer.getInt64();
-        }
-
-        if (_attrs.flags & SSH2_FILEXFER_ATTR_UIDGID)
-        {
-            _attrs.owner = sftpBuffer.getInt();
-            _attrs.group = sftpBuffer.getInt();
-        }
-
-        if (_attrs.flags & SSH2_FILEXFER_ATTR_PERMISSIONS)
-        {
-            _attrs.permissions = sftpBuffer.getInt();
-        }
-
-        if (_attrs.flags & SSH2_FILEXFER_ATTR_ACMODTIME)
+        if (!packet.getString(fileName) || !packet.getString(longName) || !readAttrs(packet))
         {
-            _attrs.atime = sftpBuffer.getInt();
-            _attrs.mtime = sftpBuffer.getInt();
+            ne7ssh::errors()->push(_session->getSshChannel(), "Malformed SFTP NAME packet.");
+            return false;
         }
+        tmpVar.addInt(fileName.length);
+        tmpVar.addBytes(fileName.data, fileName.length);
+        tmpVar.addInt(longName.length);
+        tmpVar.addBytes(longName.data, longName.length);
     }
     _fileBuffer += tmpVar.value();
 
     return true;
 }
 
-bool Ne7sshSftp::processAttrs(Botan::SecureVector<Botan::byte>& packet)
+bool Ne7sshSftp::processAttrs(ne7ssh_reader& packet)
 {
-    Ne7sshSftpPacket sftpBuffer(packet, 0);
-    SecureVector<Botan::byte> data;
+    packet.skip(sizeof(uint32));
+    return readAttrs(packet);
+}
 
-    sftpBuffer.getInt();
-    _attrs.flags = sftpBuffer.getInt();
+bool Ne7sshSftp::readAttrs(ne7ssh_reader& packet)
+{
+    if (!packet.getInt(_attrs.flags))
+    {
+        return false;
+    }
     if (_attrs.flags & SSH2_FILEXFER_ATTR_SIZE)
     {
-        _attrs.size = sftpBuffer.getInt64();
+        if (!packet.getInt64(_attrs.size))
+        {
+            return false;
+        }
     }
 
     if (_attrs.flags & SSH2_FILEXFER_ATTR_UIDGID)
     {
-        _attrs.owner = sftpBuffer.getInt();
-        _attrs.group = sftpBuffer.getInt();
+        if (!packet.getInt(_attrs.owner) || !packet.getInt(_attrs.group))
+        {
+            return false;
+        }
     }
 
     if (_attrs.flags & SSH2_FILEXFER_ATTR_PERMISSIONS)
     {
-        _attrs.permissions = sftpBuffer.getInt();
+        if (!packet.getInt(_attrs.permissions))
+        {
+            return false;
+        }
     }
 
     if (_attrs.flags & SSH2_FILEXFER_ATTR_ACMODTIME)
     {
-        _attrs.atime = sftpBuffer.getInt();
-        _attrs.mtime = sftpBuffer.getInt();
+        if (!packet.getInt(_attrs.atime) || !packet.getInt(_attrs.mtime))
+        {
+            return false;
+        }
     }
 
     return true;
@@ -472,11 +491,7 @@ uint32 Ne7sshSftp::openFile(const char* filename, uint8 shortMode)
             return 0;
     }
 
-    packet.addChar(SSH2_FXP_OPEN);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
-    packet.addInt(mode);
-    packet.addInt(0);
+    sftpOpenMsg::encode(packet, this->_seq++, fullPath.value(), mode, 0);
 
     if (!packet.isChannelSet())
     {
@@ -484,12 +499,12 @@ uint32 Ne7sshSftp::openFile(const char* filename, uint8 shortMode)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return 0;
     }
 
-    _windowSend -= 21 + fullPath.length();
+    _windowSend -= packet.channelDataLength();
 
     status = receiveUntil(SSH2_FXP_HANDLE, this->_timeout);
 
@@ -515,9 +530,7 @@ uint32 Ne7sshSftp::openDir(const char* dirname)
         return 0;
     }
 
-    packet.addChar(SSH2_FXP_OPENDIR);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
+    sftpOpenDirMsg::encode(packet, this->_seq++, fullPath.value());
 
     if (!packet.isChannelSet())
     {
@@ -525,12 +538,12 @@ uint32 Ne7sshSftp::openDir(const char* dirname)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return 0;
     }
 
-    _windowSend -= 13 + fullPath.length();
+    _windowSend -= packet.channelDataLength();
 
     status = receiveUntil(SSH2_FXP_HANDLE, this->_timeout);
 
@@ -556,12 +569,7 @@ bool Ne7sshSftp::readFile(uint32 fileID, uint64 offset)
         return false;
     }
 
-    packet.addChar(SSH2_FXP_READ);
-    packet.addInt(this->_seq++);
-    packet.addInt(remoteFile->_handle.length());
-    packet.addBytes((Botan::byte*)remoteFile->_handle.c_str(), remoteFile->_handle.length());
-    packet.addInt64(offset);
-    packet.addInt(SFTP_MAX_MSG_SIZE);
+    sftpReadMsg::encode(packet, this->_seq++, remoteFile->_handle, offset, SFTP_MAX_MSG_SIZE);
 
     if (!packet.isChannelSet())
     {
@@ -569,12 +577,12 @@ bool Ne7sshSftp::readFile(uint32 fileID, uint64 offset)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= remoteFile->_handle.length() + 25;
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_DATA, this->_timeout);
 
@@ -583,12 +591,10 @@ bool Ne7sshSftp::readFile(uint32 fileID, uint64 offset)
 
 bool Ne7sshSftp::writeFile(uint32 fileID, const uint8* data, uint32 len, uint64 offset)
 {
-    Ne7sshSftpPacket packet(_session->getSendChannel());
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
     bool status;
     sftpFile* remoteFile = getFileHandle(fileID);
-    uint32 sent = 0, currentLen = 0;
-    Botan::SecureVector<Botan::byte> sendVector;
+    uint32 sent = 0, currentLen = 0, msgLen;
 
     if (len > SFTP_MAX_MSG_SIZE)
     {
@@ -601,19 +607,17 @@ bool Ne7sshSftp::writeFile(uint32 fileID, const uint8* data, uint32 len, uint64
         return false;
     }
 
-    packet.addChar(SSH2_FXP_WRITE);
-    packet.addInt(this->_seq++);
-    packet.addInt(remoteFile->_handle.length());
-    packet.addBytes((Botan::byte*)remoteFile->_handle.c_str(), remoteFile->_handle.length());
-    packet.addInt64(offset);
-    packet.addInt(len);
+    // Sized for the largest fragment, so every fragment reuses the same buffer.
+    Ne7sshSftpPacket packet(_session->getSendChannel(), SFTP_MAX_PACKET_SIZE);
+    sftpWriteMsg::encode(packet, this->_seq++, remoteFile->_handle, offset, len);
+    msgLen = sftpWriteMsg::size(0, remoteFile->_handle, offset, len) + len;
 
     if (!packet.isChannelSet())
     {
         ne7ssh::errors()->push(_session->getSshChannel(), "Channel not set in sftp packet class.");
         return false;
     }
-    _windowSend -= remoteFile->_handle.length() + 25;
+    _windowSend -= packet.channelDataLength();
 
     while (sent < len)
     {
@@ -622,25 +626,17 @@ bool Ne7sshSftp::writeFile(uint32 fileID, const uint8* data, uint32 len, uint64
 
         if (sent)
         {
-            packet.clear();
+            packet.beginFragment();
         }
         packet.addBytes(data + sent, currentLen);
 
-        if (sent)
-        {
-            sendVector = packet.valueFragment();
-        }
-        else
-        {
-            sendVector = packet.valueFragment(remoteFile->_handle.length() + 21 + len);
-        }
-
+        ne7ssh_buffer& sendVector = packet.valueFragment(msgLen);
         if (!sendVector.size())
         {
             return false;
         }
 
-        status = transport->sendPacket(sendVector);
+        status = transport->sendFrame(sendVector);
         if (!status)
         {
             return false;
@@ -675,10 +671,7 @@ bool Ne7sshSftp::closeFile(uint32 fileID)
         return false;
     }
 
-    packet.addChar(SSH2_FXP_CLOSE);
-    packet.addInt(this->_seq++);
-    packet.addInt(remoteFile->_handle.length());
-    packet.addBytes((Botan::byte*)remoteFile->_handle.c_str(), remoteFile->_handle.length());
+    sftpCloseMsg::encode(packet, this->_seq++, remoteFile->_handle);
 
     if (!packet.isChannelSet())
     {
@@ -686,12 +679,12 @@ bool Ne7sshSftp::closeFile(uint32 fileID)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= remoteFile->_handle.length() + 13;
+    _windowSend -= packet.channelDataLength();
 
     for (i = 0; i < sftpFiles.size(); i++)
     {
@@ -708,7 +701,7 @@ bool Ne7sshSftp::closeFile(uint32 fileID)
 
 ne7ssh_string Ne7sshSftp::getFullPath(const char* filename)
 {
-    Botan::SecureVector<Botan::byte> result;
+    ne7ssh_buffer result;
     std::string buffer;
     uint32 len, pos, last_char, i = 0;
 
@@ -762,11 +755,11 @@ ne7ssh_string Ne7sshSftp::getFullPath(const char* filename)
         {
             return ne7ssh_string();
         }
-        result += SecureVector<Botan::byte>((uint8*)_currentPath.c_str(), len);
+        result += ne7ssh_buffer((uint8*)_currentPath.c_str(), len);
         last_char = len - 1;
         if (_currentPath[last_char] && _currentPath[last_char] != '/')
         {
-            result += SecureVector<Botan::byte>((uint8*)"/", 1);
+            result += ne7ssh_buffer((uint8*)"/", 1);
         }
     }
     while (buffer[pos] == '/')
@@ -774,7 +767,7 @@ ne7ssh_string Ne7sshSftp::getFullPath(const char* filename)
         pos--;
     }
     buffer[++pos] = 0x00;
-    result += SecureVector<Botan::byte>((uint8*)buffer.c_str(), pos);
+    result += ne7ssh_buffer((uint8*)buffer.c_str(), pos);
     return ne7ssh_string(result, 0);
 }
 
@@ -798,7 +791,7 @@ bool Ne7sshSftp::getFileStats(const char* remoteFile, bool followSymLinks)
     Ne7sshSftpPacket packet(_session->getSendChannel());
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
     bool status;
-    uint8 cmd = followSymLinks ? SSH2_FXP_STAT : SSH2_FXP_LSTAT;
+    uint32 flags = SSH2_FILEXFER_ATTR_SIZE | SSH2_FILEXFER_ATTR_UIDGID | SSH2_FILEXFER_ATTR_PERMISSIONS | SSH2_FILEXFER_ATTR_ACMODTIME;
     ne7ssh_string fullPath = getFullPath(remoteFile);
 
     if (!fullPath.length())
@@ -811,10 +804,14 @@ bool Ne7sshSftp::getFileStats(const char* remoteFile, bool followSymLinks)
         return false;
     }
 
-    packet.addChar(cmd);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
-    packet.addInt(SSH2_FILEXFER_ATTR_SIZE | SSH2_FILEXFER_ATTR_UIDGID | SSH2_FILEXFER_ATTR_PERMISSIONS | SSH2_FILEXFER_ATTR_ACMODTIME);
+    if (followSymLinks)
+    {
+        sftpStatMsg::encode(packet, this->_seq++, fullPath.value(), flags);
+    }
+    else
+    {
+        sftpLStatMsg::encode(packet, this->_seq++, fullPath.value(), flags);
+    }
 
     if (!packet.isChannelSet())
     {
@@ -822,12 +819,12 @@ bool Ne7sshSftp::getFileStats(const char* remoteFile, bool followSymLinks)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= 17 + fullPath.length();
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_ATTRS, this->_timeout);
     return status;
@@ -844,10 +841,7 @@ bool Ne7sshSftp::getFStat(uint32 fileID)
     {
         return false;
     }
-    packet.addChar(SSH2_FXP_FSTAT);
-    packet.addInt(this->_seq++);
-    packet.addInt(remoteFile->_handle.length());
-    packet.addBytes((Botan::byte*)remoteFile->_handle.c_str(), remoteFile->_handle.length());
+    sftpFStatMsg::encode(packet, this->_seq++, remoteFile->_handle);
 
     if (!packet.isChannelSet())
     {
@@ -855,12 +849,12 @@ bool Ne7sshSftp::getFStat(uint32 fileID)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= remoteFile->_handle.length() + 13;
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_ATTRS, this->_timeout);
     return status;
@@ -906,7 +900,7 @@ bool Ne7sshSftp::getFileAttrs(Ne7SftpSubsystem::fileAttrs& attributes, const cha
     return true;
 }
 
-bool Ne7sshSftp::getFileAttrs(sftpFileAttrs& attributes, Botan::SecureVector<Botan::byte>& remoteFile, bool followSymLinks)
+bool Ne7sshSftp::getFileAttrs(sftpFileAttrs& attributes, ne7ssh_buffer& remoteFile, bool followSymLinks)
 {
     if (!remoteFile.size())
     {
@@ -972,7 +966,7 @@ bool Ne7sshSftp::get(const char* remoteFile, FILE* localFile)
 {
     uint64 size;
     uint64 offset = 0;
-    Botan::SecureVector<Botan::byte> localBuffer;
+    ne7ssh_buffer localBuffer;
     uint32 fileID;
 
     if (!localFile)
@@ -1025,7 +1019,7 @@ bool Ne7sshSftp::put(FILE* localFile, const char* remoteFile)
 {
     size_t size;
     size_t offset = 0;
-    Botan::SecureVector<Botan::byte> localBuffer;
+    ne7ssh_buffer localBuffer;
     uint32 fileID;
     size_t len;
 
@@ -1092,9 +1086,7 @@ bool Ne7sshSftp::rm(const char* remoteFile)
         return false;
     }
 
-    packet.addChar(SSH2_FXP_REMOVE);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
+    sftpRemoveMsg::encode(packet, this->_seq++, fullPath.value());
 
     if (!packet.isChannelSet())
     {
@@ -1102,12 +1094,12 @@ bool Ne7sshSftp::rm(const char* remoteFile)
         return false;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= 13 + fullPath.length();
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_STATUS, this->_timeout);
     return status;
@@ -1130,10 +1122,7 @@ bool Ne7sshSftp::mv(const char* oldFile, const char* newFile)
         return false;
     }
 
-    packet.addChar(SSH2_FXP_RENAME);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(oldPath.value());
-    packet.addVectorField(newPath.value());
+    sftpRenameMsg::encode(packet, this->_seq++, oldPath.value(), newPath.value());
 
     if (!packet.isChannelSet())
     {
@@ -1141,12 +1130,12 @@ bool Ne7sshSftp::mv(const char* oldFile, const char* newFile)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= oldPath.length() + newPath.length() + 17;
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_STATUS, this->_timeout);
     return status;
@@ -1168,10 +1157,7 @@ bool Ne7sshSftp::mkdir(const char* remoteDir)
         return false;
     }
 
-    packet.addChar(SSH2_FXP_MKDIR);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
-    packet.addInt(0);
+    sftpMkdirMsg::encode(packet, this->_seq++, fullPath.value(), 0);
 
     if (!packet.isChannelSet())
     {
@@ -1179,12 +1165,12 @@ bool Ne7sshSftp::mkdir(const char* remoteDir)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= fullPath.length() + 17;
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_STATUS, this->_timeout);
     return status;
@@ -1206,9 +1192,7 @@ bool Ne7sshSftp::rmdir(const char* remoteDir)
         return false;
     }
 
-    packet.addChar(SSH2_FXP_RMDIR);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
+    sftpRmdirMsg::encode(packet, this->_seq++, fullPath.value());
 
     if (!packet.isChannelSet())
     {
@@ -1216,12 +1200,12 @@ bool Ne7sshSftp::rmdir(const char* remoteDir)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= fullPath.length() + 13;
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_STATUS, this->_timeout);
     return status;
@@ -1232,7 +1216,7 @@ const char* Ne7sshSftp::ls(const char* remoteDir, bool longNames)
     Ne7sshSftpPacket packet(_session->getSendChannel());
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
     ne7ssh_string tmpVar;
-    SecureVector<Botan::byte> fileName;
+    ne7ssh_buffer fileName;
     bool status = true;
     uint32 fileID, fileCount, i;
     sftpFile* remoteFile;
@@ -1257,10 +1241,7 @@ const char* Ne7sshSftp::ls(const char* remoteDir, bool longNames)
     while (status)
     {
         packet.clear();
-        packet.addChar(SSH2_FXP_READDIR);
-        packet.addInt(this->_seq++);
-        packet.addInt(remoteFile->_handle.length());
-        packet.addBytes((Botan::byte*)remoteFile->_handle.c_str(), remoteFile->_handle.length());
+        sftpReadDirMsg::encode(packet, this->_seq++, remoteFile->_handle);
 
         if (!packet.isChannelSet())
         {
@@ -1268,12 +1249,12 @@ const char* Ne7sshSftp::ls(const char* remoteDir, bool longNames)
             return 0;
         }
 
-        if (!transport->sendPacket(packet.value()))
+        if (!transport->sendFrame(packet.value()))
         {
             return 0;
         }
 
-        _windowSend -= remoteFile->_handle.length() + 13;
+        _windowSend -= packet.channelDataLength();
 
         status = receiveWhile(SSH2_FXP_NAME, this->_timeout);
     }
@@ -1289,14 +1270,14 @@ const char* Ne7sshSftp::ls(const char* remoteDir, bool longNames)
     for (i = 0; i < fileCount; i++)
     {
         packet.getString(fileName);
-        fileName += SecureVector<Botan::byte>((const Botan::byte*)"\n", 1);
+        fileName += ne7ssh_buffer((const Botan::byte*)"\n", 1);
         if (!longNames)
         {
             tmpVar.addVector(fileName);
         }
 
         packet.getString(fileName);
-        fileName += SecureVector<Botan::byte>((const Botan::byte*)"\n", 1);
+        fileName += ne7ssh_buffer((const Botan::byte*)"\n", 1);
         if (longNames)
         {
             tmpVar.addVector(fileName);
@@ -1315,7 +1296,7 @@ bool Ne7sshSftp::cd(const char* remoteDir)
 {
     Ne7sshSftpPacket packet(_session->getSendChannel());
     std::shared_ptr<ne7ssh_transport> transport = _session->_transport;
-    SecureVector<Botan::byte> fileName;
+    ne7ssh_buffer fileName;
     uint32 fileCount;
     bool status;
     if (!remoteDir)
@@ -1331,9 +1312,7 @@ bool Ne7sshSftp::cd(const char* remoteDir)
 
     _fileBuffer.clear();
 
-    packet.addChar(SSH2_FXP_REALPATH);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
+    sftpRealPathMsg::encode(packet, this->_seq++, fullPath.value());
 
     if (!packet.isChannelSet())
     {
@@ -1341,12 +1320,12 @@ bool Ne7sshSftp::cd(const char* remoteDir)
         return false;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= fullPath.length() + 13;
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_NAME, this->_timeout);
     if (!status)
@@ -1610,11 +1589,7 @@ bool Ne7sshSftp::chmod(const char* remoteFile, const char* mode)
         }
     }
 
-    packet.addChar(SSH2_FXP_SETSTAT);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
-    packet.addInt(SSH2_FILEXFER_ATTR_PERMISSIONS);
-    packet.addInt(perms);
+    sftpSetPermissionsMsg::encode(packet, this->_seq++, fullPath.value(), SSH2_FILEXFER_ATTR_PERMISSIONS, perms);
 
     if (!packet.isChannelSet())
     {
@@ -1622,12 +1597,12 @@ bool Ne7sshSftp::chmod(const char* remoteFile, const char* mode)
         return 0;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= fullPath.length() + 21;
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_STATUS, this->_timeout);
     return status;
@@ -1658,26 +1633,7 @@ bool Ne7sshSftp::chown(const char* remoteFile, uint32 uid, uint32 gid)
     old_uid = _attrs.owner;
     old_gid = _attrs.group;
 
-    packet.addChar(SSH2_FXP_SETSTAT);
-    packet.addInt(this->_seq++);
-    packet.addVectorField(fullPath.value());
-    packet.addInt(SSH2_FILEXFER_ATTR_UIDGID);
-    if (uid)
-    {
-        packet.addInt(uid);
-    }
-    else
-    {
-        packet.addInt(old_uid);
-    }
-    if (gid)
-    {
-        packet.addInt(gid);
-    }
-    else
-    {
-        packet.addInt(old_gid);
-    }
+    sftpSetOwnerMsg::encode(packet, this->_seq++, fullPath.value(), SSH2_FILEXFER_ATTR_UIDGID, uid ? uid : old_uid, gid ? gid : old_gid);
 
     if (!packet.isChannelSet())
     {
@@ -1685,12 +1641,12 @@ bool Ne7sshSftp::chown(const char* remoteFile, uint32 uid, uint32 gid)
         return false;
     }
 
-    if (!transport->sendPacket(packet.value()))
+    if (!transport->sendFrame(packet.value()))
     {
         return false;
     }
 
-    _windowSend -= fullPath.length() + 25;
+    _windowSend -= packet.channelDataLength();
 
     status = receiveWhile(SSH2_FXP_STATUS, this->_timeout);
     return status;
@@ -18,6 +18,7 @@
 #define NE7SSHSFTP_H
 
 #include "ne7ssh_channel.h"
+#include "ne7ssh_reader.h"
 #include "ne7ssh.h"
 
 #ifdef WIN32
@@ -110,7 +111,7 @@ private:
     uint32 _seq;
     uint8 _sftpCmd;
     ne7ssh_string _commBuffer;
-    Botan::SecureVector<Botan::byte> _fileBuffer;
+    ne7ssh_buffer _fileBuffer;
     enum writeMode { READ, OVERWRITE, APPEND };
     uint8 _lastError;
     std::string _currentPath;
@@ -143,45 +144,45 @@ private:
 
     /**
     * Replacement for ne7ssh_channel handleData method. Processes SFTP specific packets.
-    * @param packet Reference to the newly received packet.
+    * @param packet Reader positioned behind the command byte of the newly received 'DATA' packet.
     * @return True if data successfully processed. False on any error.
     */
-    bool handleData(Botan::SecureVector<Botan::byte>& packet);
+    bool handleData(ne7ssh_reader& packet);
 
     /**
     * Processes the VERSION packet received from the server.
     * @param packet VERSION packet.
     * @return True if processing successful, otherwise false.
     */
-    bool handleVersion(Botan::SecureVector<Botan::byte>& packet);
+    bool handleVersion(ne7ssh_reader& packet);
 
     /**
     * Processes the STATUS packet received from the server.
     * @param packet STATUS packet.
     * @return True if processing successful, otherwise false.
     */
-    bool handleStatus(Botan::SecureVector<Botan::byte>& packet);
+    bool handleStatus(ne7ssh_reader& packet);
 
     /**
     * Method to add a new file to sftpFiles variable from the HANDLE packet.
     * @param packet HANDLE packet.
     * @return True if processing successful, otherwise false.
     */
-    bool addOpenHandle(Botan::SecureVector<Botan::byte>& packet);
+    bool addOpenHandle(ne7ssh_reader& packet);
 
     /**
     * Method to process DATA packets.
     * @param packet DATA packet.
     * @return True if processing successful, otherwise false.
     */
-    bool handleSftpData(Botan::SecureVector<Botan::byte>& packet);
+    bool handleSftpData(ne7ssh_reader& packet);
 
     /**
     * Method to process NAME packets.
     * @param packet NAME packet.
     * @return True if processing successful, otherwise false.
     */
-    bool handleNames(Botan::SecureVector<Botan::byte>& packet);
+    bool handleNames(ne7ssh_reader& packet);
 
     /**
     * This method is used to get a pointer to currently open file stored in sftpFile structure.
@@ -211,7 +212,14 @@ private:
     * @param packet ATTRS packet.
     * @return True if processing successful, otherwise false.
     */
-    bool processAttrs(Botan::SecureVector<Botan::byte>& packet);
+    bool processAttrs(ne7ssh_reader& packet);
+
+    /**
+    * Parses a file attributes structure into _attrs.
+    * @param packet Reader positioned at the start of the attributes.
+    * @return True if the attributes were complete, otherwise false.
+    */
+    bool readAttrs(ne7ssh_reader& packet);
 
     /**
     * Low level method to request file attributes.
@@ -228,7 +236,7 @@ private:
     * @param followSymLinks If set to true symbolic links will be followed. That is the default behavior. If following symbolic links is undesired set to "false".
     * @return True if the attributes successfully received. False on any error.
     */
-    bool getFileAttrs(sftpFileAttrs& attributes, Botan::SecureVector<Botan::byte>& remoteFile, bool followSymLinks = true);
+    bool getFileAttrs(sftpFileAttrs& attributes, ne7ssh_buffer& remoteFile, bool followSymLinks = true);
 
     /**
     * Works like getFileStats() method, except that it operates on a handle of already opened file instead of path.
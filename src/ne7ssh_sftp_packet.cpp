@@ -15,25 +15,44 @@
  ***************************************************************************/
 
 #include "ne7ssh_sftp_packet.h"
+#include "ne7ssh_transport.h"
 #include "ne7ssh_impl.h"
+#if !defined(WIN32) && !defined(__MINGW32__)
+#   include <arpa/inet.h>
+#else
+#   include <Winsock2.h>
+#endif
 
 using namespace Botan;
 
+// Channel data header: message type, channel ID, data length and, in the first packet of a message, the SFTP length.
+#define SFTP_HEADER_LEN 13
+#define SFTP_FRAGMENT_HEADER_LEN 9
+
 Ne7sshSftpPacket::Ne7sshSftpPacket ()
     : ne7ssh_string(),
-    _channel(-1)
+    _channel(-1),
+    _headerLen(0)
 {
 }
 
-Ne7sshSftpPacket::Ne7sshSftpPacket (int channel)
+Ne7sshSftpPacket::Ne7sshSftpPacket (int channel, uint32 expectedSize)
     : ne7ssh_string(),
-    _channel(channel)
+    _channel(channel),
+    _headerLen(0)
 {
+    if (_channel < 0)
+    {
+        return;
+    }
+    reserve(SSH_FRAME_HEADROOM + SFTP_HEADER_LEN + expectedSize + SSH_FRAME_TAILROOM);
+    reset(SFTP_HEADER_LEN);
 }
 
-Ne7sshSftpPacket::Ne7sshSftpPacket (Botan::SecureVector<Botan::byte>& var, uint32 position)
+Ne7sshSftpPacket::Ne7sshSftpPacket (const Botan::MemoryRegion<Botan::byte>& var, uint32 position)
     : ne7ssh_string(var, position),
-    _channel(-1)
+    _channel(-1),
+    _headerLen(0)
 {
 }
 
@@ -41,49 +60,72 @@ Ne7sshSftpPacket::~Ne7sshSftpPacket()
 {
 }
 
-Botan::SecureVector<Botan::byte> &Ne7sshSftpPacket::value()
+void Ne7sshSftpPacket::reset(uint32 headerLen)
 {
-    ne7ssh_string tmpVar;
-
-    if (this->_channel < 0)
+    _buffer.resize(0);
+    if (_channel < 0)
     {
-        _buffer.clear();
-        return _buffer;
+        _headerLen = 0;
+        return;
     }
+    _headerLen = headerLen;
+    grow(SSH_FRAME_HEADROOM + _headerLen);
+}
 
-    tmpVar.addChar(SSH2_MSG_CHANNEL_DATA);
-    tmpVar.addInt(_channel);
-    tmpVar.addInt(sizeof(uint32) + _buffer.size());
-    tmpVar.addVectorField(_buffer);
+void Ne7sshSftpPacket::clear()
+{
+    reset(SFTP_HEADER_LEN);
+}
 
-    _buffer.swap(tmpVar.value());
-    return _buffer;
+void Ne7sshSftpPacket::beginFragment()
+{
+    reset(SFTP_FRAGMENT_HEADER_LEN);
 }
 
-Botan::SecureVector<Botan::byte> Ne7sshSftpPacket::valueFragment(uint32 len)
+ne7ssh_buffer &Ne7sshSftpPacket::frame(uint32 len)
 {
-    ne7ssh_string tmpVar;
+    Botan::byte* header;
+    uint32 payloadLen, nVar;
 
-    if (this->_channel < 0)
+    if ((this->_channel < 0) || (_buffer.size() < SSH_FRAME_HEADROOM + _headerLen))
     {
         _buffer.clear();
-        return Botan::SecureVector<Botan::byte>();
+        return _buffer;
     }
 
-    tmpVar.addChar(SSH2_MSG_CHANNEL_DATA);
-    tmpVar.addInt(_channel);
-    if (len)
+    header = _buffer.begin() + SSH_FRAME_HEADROOM;
+    payloadLen = _buffer.size() - SSH_FRAME_HEADROOM - _headerLen;
+
+    header[0] = SSH2_MSG_CHANNEL_DATA;
+    nVar = htonl(_channel);
+    memcpy(header + 1, &nVar, sizeof(uint32));
+    nVar = htonl(_headerLen - SFTP_FRAGMENT_HEADER_LEN + payloadLen);
+    memcpy(header + 5, &nVar, sizeof(uint32));
+    if (_headerLen == SFTP_HEADER_LEN)
     {
-        tmpVar.addInt(sizeof(uint32) + _buffer.size());
-        tmpVar.addInt(len);
-        tmpVar.addVector(_buffer);
+        nVar = htonl(len);
+        memcpy(header + 9, &nVar, sizeof(uint32));
     }
-    else
+    return _buffer;
+}
+
+ne7ssh_buffer &Ne7sshSftpPacket::value()
+{
+    return frame(_buffer.size() - SSH_FRAME_HEADROOM - _headerLen);
+}
+
+ne7ssh_buffer &Ne7sshSftpPacket::valueFragment(uint32 len)
+{
+    return frame(len);
+}
+
+uint32 Ne7sshSftpPacket::channelDataLength()
+{
+    if (_buffer.size() < SSH_FRAME_HEADROOM + SFTP_FRAGMENT_HEADER_LEN)
     {
-        tmpVar.addVectorField(_buffer);
+        return 0;
     }
-
-    return Botan::SecureVector<Botan::byte> (tmpVar.value());
+    return _buffer.size() - SSH_FRAME_HEADROOM - SFTP_FRAGMENT_HEADER_LEN;
 }
 
 void Ne7sshSftpPacket::addInt64(const uint64 var)
@@ -104,7 +146,7 @@ void Ne7sshSftpPacket::addInt64(const uint64 var)
 
 uint64 Ne7sshSftpPacket::getInt64()
 {
-    SecureVector<Botan::byte> tmpVar(_buffer);
+    ne7ssh_buffer tmpVar(_buffer);
     uint64 result;
     uint8 converter[8];
     memcpy(converter, tmpVar.begin(), 8);
@@ -118,7 +160,7 @@ uint64 Ne7sshSftpPacket::getInt64()
     result |= (uint64)converter[6] << 8;
     result |= (uint64)converter[7];
 
-    _buffer = SecureVector<Botan::byte>(tmpVar.begin() + sizeof(uint64), tmpVar.size() - sizeof(uint64));
+    _buffer = ne7ssh_buffer(tmpVar.begin() + sizeof(uint64), tmpVar.size() - sizeof(uint64));
     return result;
 }
 
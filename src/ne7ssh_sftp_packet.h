@@ -27,6 +27,20 @@ class Ne7sshSftpPacket : public ne7ssh_string
 {
 private:
     int _channel;
+    uint32 _headerLen;
+
+    /**
+     * Discards the payload and leaves room for the SSH packet header and a channel data header of the given length.
+     * @param headerLen Length of the channel data header.
+     */
+    void reset(uint32 headerLen);
+
+    /**
+     * Writes the channel data header into the room in front of the payload.
+     * @param len SFTP message length to write, used only if the header has room for it.
+     * @return Reference to the complete frame, or empty vector if channel ID is not set.
+     */
+    ne7ssh_buffer &frame(uint32 len);
 
 public:
     /**
@@ -36,16 +50,18 @@ public:
     Ne7sshSftpPacket();
     /**
      * Constructor.
+     * <p>Room for the SSH packet header and the channel data header is left in front of the payload, so the packet is sent without copying it.
      * @param channel Channel ID, returned by connect methods.
+     * @param expectedSize Expected length of the SFTP message. If set, the whole frame is allocated once, up front.
      */
-    Ne7sshSftpPacket(int channel);
+    Ne7sshSftpPacket(int channel, uint32 expectedSize = 0);
 
     /**
      * Constructor. Intializes the class with packet data.
      * @param var Reference to packet data.
      * @param position Offset.
      */
-    Ne7sshSftpPacket(Botan::SecureVector<Botan::byte>& var, uint32 position);
+    Ne7sshSftpPacket(const Botan::MemoryRegion<Botan::byte>& var, uint32 position);
 
     /**
      * Default destructor.
@@ -53,17 +69,37 @@ public:
     ~Ne7sshSftpPacket();
 
     /**
-     * Returns buffer as a vector appending the SFTP subsystem specific packet headers.
-     * @return Reference to the buffer.
+     * Discards the payload, keeping the allocated buffer for the next message.
      */
-    Botan::SecureVector<Botan::byte> &value();
+    void clear();
 
     /**
-     * Returns buffer as a vector appending the SFTP subsystem specific packet headers, including the length in the first packet transmitted. Used in transmissions when it's necessary to split the message into multiple packets.
-     * @param len Length to append to the first packet in the message.
+     * Discards the payload and starts a continuation fragment of a message split into multiple packets.
+     * <p>Continuation fragments carry no SFTP length field.
+     */
+    void beginFragment();
+
+    /**
+     * Returns buffer as a vector with the SFTP subsystem specific packet headers written in front of the payload.
+     * <p>The result is a frame meant for ne7ssh_transport::sendFrame(). Headers are written in place, so calling it again is harmless.
+     * @return Reference to the buffer, or empty vector on error.
+     */
+    ne7ssh_buffer &value();
+
+    /**
+     * Returns buffer as a vector with the SFTP subsystem specific packet headers, including the length in the first packet transmitted. Used in transmissions when it's necessary to split the message into multiple packets.
+     * <p>The result is a frame meant for ne7ssh_transport::sendFrame().
+     * @param len Length of the whole message, written into the first packet. Ignored for fragments started with beginFragment().
      * @return Reference to SFTP packet or empty vector on error.
      */
-    Botan::SecureVector<Botan::byte> valueFragment(uint32 len = 0);
+    ne7ssh_buffer &valueFragment(uint32 len = 0);
+
+    /**
+     * Gets the number of bytes the packet consumes from the channel's send window.
+     * <p>That is the channel data, including the SFTP length field in the first packet of a message, without the SSH packet and channel data headers.
+     * @return Length of the channel data.
+     */
+    uint32 channelDataLength();
 
     /**
      * Appends 64 bit integer to the packet buffer.
@@ -24,43 +24,86 @@
 
 using namespace Botan;
 
-ne7ssh_string::ne7ssh_string() : _currentPart(0)
+template <class Buffer>
+ne7ssh_basic_string<Buffer>::ne7ssh_basic_string() : _currentPart(0), _capacity(0), _reservedFor(0)
 {
 }
 
-ne7ssh_string::ne7ssh_string(Botan::SecureVector<Botan::byte>& var, uint32 position)
+template <class Buffer>
+ne7ssh_basic_string<Buffer>::ne7ssh_basic_string(const Botan::MemoryRegion<Botan::byte>& var, uint32 position)
     : _currentPart(0),
-    _buffer(SecureVector<Botan::byte>((var.begin() + position), (var.size() - position)))
+    _capacity(0),
+    _reservedFor(0),
+    _buffer(var.begin() + position, var.size() - position)
 {
 }
 
-ne7ssh_string::ne7ssh_string(const char* var, uint32 position)
+template <class Buffer>
+ne7ssh_basic_string<Buffer>::ne7ssh_basic_string(const char* var, uint32 position)
     : _currentPart(0),
-    _buffer(SecureVector<Botan::byte>((Botan::byte*)(var + position), (u32bit) (strlen(var) - position)))
+    _capacity(0),
+    _reservedFor(0),
+    _buffer((Botan::byte*)(var + position), (u32bit) (strlen(var) - position))
 
 {
-    char null_char = 0x0;
-    _buffer += SecureVector<Botan::byte>((Botan::byte*) &null_char, 1);
+    addChar(0x00);
 }
 
-ne7ssh_string::~ne7ssh_string()
+template <class Buffer>
+ne7ssh_basic_string<Buffer>::~ne7ssh_basic_string()
 {
 }
 
-void ne7ssh_string::addString(const char* str)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::reserve(uint32 size)
+{
+    uint32 used = _buffer.size();
+
+    if ((_reservedFor == _buffer.begin()) && (size <= _capacity))
+    {
+        return;
+    }
+    if (size < used)
+    {
+        size = used;
+    }
+    // Shrinking a MemoryRegion keeps its allocation, so the spare room stays available for later appends.
+    _buffer.resize(size);
+    _buffer.resize(used);
+    _capacity = size;
+    _reservedFor = _buffer.begin();
+}
+
+template <class Buffer>
+Botan::byte* ne7ssh_basic_string<Buffer>::grow(uint32 len)
+{
+    uint32 used = _buffer.size();
+
+    // Capacity is only trusted while the buffer was not swapped or reallocated behind our back.
+    if ((_reservedFor != _buffer.begin()) || (used + len > _capacity))
+    {
+        reserve((used + len > used * 2) ? used + len : used * 2);
+    }
+    _buffer.resize(used + len);
+    return _buffer.begin() + used;
+}
+
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::addString(const char* str)
 {
-    Botan::byte* value = (Botan::byte*) str;
     size_t len = strlen(str);
     uint32 nLen = htonl((long) len);
+    Botan::byte* field = grow(sizeof(uint32) + (uint32)len);
 
-    _buffer += SecureVector<Botan::byte>((Botan::byte*)&nLen, sizeof(uint32));
-    _buffer += SecureVector<Botan::byte>(value, (u32bit)len);
+    memcpy(field, &nLen, sizeof(uint32));
+    memcpy(field + sizeof(uint32), str, len);
 }
 
-bool ne7ssh_string::addFile(const char* filename)
+template <class Buffer>
+bool ne7ssh_basic_string<Buffer>::addFile(const char* filename)
 {
     FILE* FI = fopen(filename, "rb");
-    size_t size;
+    size_t size, used = _buffer.size();
 
     if (!FI)
     {
@@ -72,56 +115,66 @@ bool ne7ssh_string::addFile(const char* filename)
     size = ftell(FI);
     rewind(FI);
 
-    std::unique_ptr<Botan::byte> data(new Botan::byte[size]);
-    fread(data.get(), size, 1, FI);
+    if (size && (fread(grow((uint32)size), size, 1, FI) != 1))
+    {
+        fclose(FI);
+        _buffer.resize(used);
+        ne7ssh::errors()->push(-1, "Could not read key file: %s.", filename);
+        return false;
+    }
     fclose(FI);
-    _buffer += SecureVector<Botan::byte>(data.get(), (u32bit)size);
     return true;
 }
 
-void ne7ssh_string::addBigInt(const Botan::BigInt& bn)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::addBigInt(const Botan::BigInt& bn)
 {
     SecureVector<Botan::byte> converted;
     bn2vector(converted, bn);
-    uint32 nLen = htonl(converted.size());
 
-    _buffer += SecureVector<Botan::byte>((Botan::byte*)&nLen, sizeof(uint32));
-    _buffer += SecureVector<Botan::byte>(converted);
+    addVectorField(converted);
 }
 
-void ne7ssh_string::addVectorField(const Botan::SecureVector<Botan::byte> &vector)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::addVectorField(const Botan::MemoryRegion<Botan::byte> &vector)
 {
     uint32 nLen = htonl(vector.size());
+    Botan::byte* field = grow(sizeof(uint32) + vector.size());
 
-    _buffer += SecureVector<Botan::byte>((Botan::byte*)&nLen, sizeof(uint32));
-    _buffer += vector;
+    memcpy(field, &nLen, sizeof(uint32));
+    memcpy(field + sizeof(uint32), vector.begin(), vector.size());
 }
 
-void ne7ssh_string::addBytes(const Botan::byte* buff, uint32 len)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::addBytes(const Botan::byte* buff, uint32 len)
 {
-    _buffer += SecureVector<Botan::byte>(buff, len);
+    memcpy(grow(len), buff, len);
 }
 
-void ne7ssh_string::addVector(Botan::SecureVector<Botan::byte> &secvec)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::addVector(const Botan::MemoryRegion<Botan::byte> &secvec)
 {
-    _buffer += SecureVector<Botan::byte>(secvec.begin(), secvec.size());
+    memcpy(grow(secvec.size()), secvec.begin(), secvec.size());
 }
 
-void ne7ssh_string::addChar(const char ch)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::addChar(const char ch)
 {
-    _buffer += SecureVector<Botan::byte>((Botan::byte*)&ch, 1);
+    *grow(1) = (Botan::byte)ch;
 }
 
-void ne7ssh_string::addInt(const uint32 var)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::addInt(const uint32 var)
 {
     uint32 nVar = htonl(var);
 
-    _buffer += SecureVector<Botan::byte>((Botan::byte*)&nVar, sizeof(uint32));
+    memcpy(grow(sizeof(uint32)), &nVar, sizeof(uint32));
 }
 
-bool ne7ssh_string::getString(Botan::SecureVector<Botan::byte>& result)
+template <class Buffer>
+bool ne7ssh_basic_string<Buffer>::getString(Botan::MemoryRegion<Botan::byte>& result)
 {
-    SecureVector<Botan::byte> tmpVar(_buffer);
+    Buffer tmpVar(_buffer);
     uint32 len;
 
     len = ntohl(*((uint32*)tmpVar.begin()));
@@ -130,14 +183,15 @@ bool ne7ssh_string::getString(Botan::SecureVector<Botan::byte>& result)
         return false;
     }
 
-    result = SecureVector<Botan::byte>(tmpVar.begin() + sizeof(uint32), len);
-    _buffer = SecureVector<Botan::byte>(tmpVar.begin() + sizeof(uint32) + len, tmpVar.size() - sizeof(uint32) - len);
+    result.set(tmpVar.begin() + sizeof(uint32), len);
+    _buffer = Buffer(tmpVar.begin() + sizeof(uint32) + len, tmpVar.size() - sizeof(uint32) - len);
     return true;
 }
 
-bool ne7ssh_string::getBigInt(Botan::BigInt& result)
+template <class Buffer>
+bool ne7ssh_basic_string<Buffer>::getBigInt(Botan::BigInt& result)
 {
-    SecureVector<Botan::byte> tmpVar(_buffer);
+    Buffer tmpVar(_buffer);
     uint32 len;
 
     len = ntohl(*((uint32*)tmpVar.begin()));
@@ -148,31 +202,34 @@ bool ne7ssh_string::getBigInt(Botan::BigInt& result)
 
     BigInt tmpBI(tmpVar.begin() + sizeof(uint32), len);
     result.swap(tmpBI);
-    _buffer = SecureVector<Botan::byte>(tmpVar.begin() + sizeof(uint32) + len, tmpVar.size() - sizeof(uint32) - len);
+    _buffer = Buffer(tmpVar.begin() + sizeof(uint32) + len, tmpVar.size() - sizeof(uint32) - len);
     return true;
 }
 
-uint32 ne7ssh_string::getInt()
+template <class Buffer>
+uint32 ne7ssh_basic_string<Buffer>::getInt()
 {
-    SecureVector<Botan::byte> tmpVar(_buffer);
+    Buffer tmpVar(_buffer);
     uint32 result;
 
     result = ntohl(*((uint32*)tmpVar.begin()));
-    _buffer = SecureVector<Botan::byte>(tmpVar.begin() + sizeof(uint32), tmpVar.size() - sizeof(uint32));
+    _buffer = Buffer(tmpVar.begin() + sizeof(uint32), tmpVar.size() - sizeof(uint32));
     return result;
 }
 
-Botan::byte ne7ssh_string::getByte()
+template <class Buffer>
+Botan::byte ne7ssh_basic_string<Buffer>::getByte()
 {
-    SecureVector<Botan::byte> tmpVar(_buffer);
+    Buffer tmpVar(_buffer);
     Botan::byte result;
 
     result = *(tmpVar.begin());
-    _buffer = SecureVector<Botan::byte>(tmpVar.begin() + 1, tmpVar.size() - 1);
+    _buffer = Buffer(tmpVar.begin() + 1, tmpVar.size() - 1);
     return result;
 }
 
-void ne7ssh_string::split(const char token)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::split(const char token)
 {
     Botan::byte* buffer = _buffer.begin();
     uint32 len = _buffer.size();
@@ -195,7 +252,8 @@ void ne7ssh_string::split(const char token)
     }
 }
 
-char* ne7ssh_string::nextPart()
+template <class Buffer>
+char* ne7ssh_basic_string<Buffer>::nextPart()
 {
     char* result;
     if (_currentPart >= _positions.size() || _positions.size() == 0)
@@ -209,13 +267,14 @@ char* ne7ssh_string::nextPart()
     return result;
 }
 
-void ne7ssh_string::chop(uint32 nBytes)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::chop(uint32 nBytes)
 {
-    SecureVector<Botan::byte> tmpVar(_buffer);
-    _buffer = SecureVector<Botan::byte>(tmpVar.begin(), tmpVar.size() - nBytes);
+    _buffer.resize(_buffer.size() - nBytes);
 }
 
-void ne7ssh_string::bn2vector(Botan::SecureVector<Botan::byte>& result, const Botan::BigInt& bi)
+template <class Buffer>
+void ne7ssh_basic_string<Buffer>::bn2vector(Botan::SecureVector<Botan::byte>& result, const Botan::BigInt& bi)
 {
     int high;
     Botan::byte zero = '\0';
@@ -235,3 +294,6 @@ void ne7ssh_string::bn2vector(Botan::SecureVector<Botan::byte>& result, const Bo
     result += strVector;
 }
 
+
+template class ne7ssh_basic_string<ne7ssh_buffer>;
+template class ne7ssh_basic_string<Botan::SecureVector<Botan::byte> >;
@@ -21,23 +21,35 @@
 #include <botan/bigint.h>
 
 /**
+ * Buffer for payload and transport data.
+ * <p>Backed by Botan's plain heap allocator instead of the locking pool behind SecureVector, so bulk transfers neither pay for page locking nor run into mlock limits.
+ * SecureVector is kept for key exchange secrets, session keys, passwords and private key material.
+ */
+typedef Botan::MemoryVector<Botan::byte> ne7ssh_buffer;
+
+/**
+ * Packet builder and parser, storing its data in a vector of type Buffer.
+ * <p>Use ne7ssh_string for packets and payload, ne7ssh_secure_string for anything holding secret material.
 @author Andrew Useckas
 */
-class ne7ssh_string
+template <class Buffer>
+class ne7ssh_basic_string
 {
 private:
     std::vector<Botan::byte*> _positions;
     uint32 _currentPart;
+    uint32 _capacity;
+    const Botan::byte* _reservedFor;
 
 protected:
-    Botan::SecureVector<Botan::byte> _buffer;
+    Buffer _buffer;
 
 public:
     /**
      * ne7ssh_string class default consturctor.
      *<p> Zeros out 'positions' and 'parts'.
      */
-    ne7ssh_string();
+    ne7ssh_basic_string();
 
     /**
      * ne7ssh_string class consturctor.
@@ -45,28 +57,43 @@ public:
      * @param var Reference to a vector containing a string.
      * @param position Position in the vector to start reading from. If '0', the entire vector is dumped into 'buffer'.
      */
-    ne7ssh_string(Botan::SecureVector<Botan::byte>& var, uint32 position);
+    ne7ssh_basic_string(const Botan::MemoryRegion<Botan::byte>& var, uint32 position);
 
     /**
      * Same as above costructor, but instead of vector it works with a string (const char*).
      * @param var  Pointer to a string terminated by '/0'.
      * @param position  Read from this position onwards.
      */
-    ne7ssh_string(const char* var, uint32 position);
+    ne7ssh_basic_string(const char* var, uint32 position);
 
     /**
      * ne7ssh_string class destructor.
      */
-    virtual ~ne7ssh_string();
+    virtual ~ne7ssh_basic_string();
 
     /**
      * Zeros out the buffer
      */
-    void clear()
+    virtual void clear()
     {
         _buffer.clear();
     }
 
+    /**
+     * Preallocates the buffer, so it can grow up to the given size without any reallocation.
+     * @param size Expected final length of the buffer, in bytes.
+     */
+    void reserve(uint32 size);
+
+    /**
+     * Extends the buffer by the given number of bytes, without building temporary vectors.
+     * <p>Used by message encoders, which write their fields straight into the returned room.
+     * <p>If the buffer is full, capacity is at least doubled, so a sequence of appends reallocates only a logarithmic number of times.
+     * @param len Number of bytes to append.
+     * @return Pointer to the first appended byte. Only valid until the buffer is modified again.
+     */
+    Botan::byte* grow(uint32 len);
+
     /**
      * Adds a string to the buffer.
      * <p>Adds an integer representing the length of the string, converted to the network format, before the actual string data.
@@ -93,7 +120,7 @@ public:
      * Adds a vector to the buffer.
      * @param secvec Reference to the vector.
      */
-    void addVector(Botan::SecureVector<Botan::byte>& secvec);
+    void addVector(const Botan::MemoryRegion<Botan::byte>& secvec);
 
     /**
      * Adds a vector to the buffer.
@@ -101,7 +128,7 @@ public:
      * Required by SSH protocol specifications.
      * @param vector Reference to a vector.
      */
-    void addVectorField(const Botan::SecureVector<Botan::byte>& vector);
+    void addVectorField(const Botan::MemoryRegion<Botan::byte>& vector);
 
     /**
      * Adds a single character to the buffer.
@@ -128,7 +155,7 @@ public:
      * Returns the buffer as a vector.
      * @return Reference to the 'buffer' vector.
      */
-    virtual Botan::SecureVector<Botan::byte> &value()
+    virtual Buffer &value()
     {
         return _buffer;
     }
@@ -147,7 +174,7 @@ public:
      * @param result Reference to a buffer where the result will be stored.
      * @return True if string field was found and successfully parsed, otherwise false is returned.
      */
-    bool getString(Botan::SecureVector<Botan::byte>& result);
+    bool getString(Botan::MemoryRegion<Botan::byte>& result);
 
     /**
      * Extracts a single BigInt variable from the payload field of SSH packet.
@@ -203,4 +230,7 @@ public:
     static void bn2vector(Botan::SecureVector<Botan::byte>& result, const Botan::BigInt& bi);
 };
 
+typedef ne7ssh_basic_string<ne7ssh_buffer> ne7ssh_string;
+typedef ne7ssh_basic_string<Botan::SecureVector<Botan::byte> > ne7ssh_secure_string;
+
 #endif
@@ -17,6 +17,7 @@
 #include "ne7ssh_transport.h"
 #include "ne7ssh.h"
 #include "ne7ssh_session.h"
+#include <botan/mem_ops.h>
 
 #if defined(WIN32) || defined(__MINGW32__)
 #   define SOCKET_BUFFER_TYPE char
@@ -61,13 +62,13 @@ using namespace Botan;
 
 class ne7ssh_packet {
 public:
-    ne7ssh_packet(SecureVector<Botan::byte> *encryptedPacket)
+    ne7ssh_packet(ne7ssh_buffer *encryptedPacket)
         : _buffer(encryptedPacket)
     {
 
     }
 
-    ne7ssh_packet& operator=(SecureVector<Botan::byte> *encryptedPacket)
+    ne7ssh_packet& operator=(ne7ssh_buffer *encryptedPacket)
     {
         _buffer = encryptedPacket;
         return *this;
@@ -123,15 +124,23 @@ public:
     }
 
 private:
-    SecureVector<Botan::byte>* _buffer;
+    ne7ssh_buffer* _buffer;
 };
 
 ne7ssh_transport::ne7ssh_transport(std::shared_ptr<ne7ssh_session> session)
     : _seq(0),
     _rSeq(0),
     _session(session),
-    _sock((SOCKET)-1)
+    _sock((SOCKET)-1),
+    _inStart(0),
+    _decoderState(AWAIT_LENGTH),
+    _cryptoLen(0),
+    _corked(false),
+    _pool(SSH_POOL_BUFFER_SIZE)
 {
+    // Decoded packets are swapped between these two, and from there in and out of the pool, so both have to come from it.
+    _pool.acquire(_decoded);
+    _pool.acquire(_inBuffer);
 }
 
 ne7ssh_transport::~ne7ssh_transport()
@@ -317,10 +326,9 @@ bool ne7ssh_transport::wait(SOCKET socket, int rw, int timeout)
     }
 }
 
-bool ne7ssh_transport::send(Botan::SecureVector<Botan::byte>& buffer)
+bool ne7ssh_transport::send(ne7ssh_buffer& buffer)
 {
-    size_t byteCount;
-    uint32 sent = 0;
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
 
     if (buffer.size() > MAX_PACKET_LEN)
     {
@@ -328,11 +336,75 @@ bool ne7ssh_transport::send(Botan::SecureVector<Botan::byte>& buffer)
         return false;
     }
 
-    while (sent < buffer.size())
+    if (_corked)
+    {
+        _corkBuffer += buffer;
+        return true;
+    }
+    return write(buffer.begin(), buffer.size());
+}
+
+void ne7ssh_transport::cork()
+{
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+    _corked = true;
+}
+
+bool ne7ssh_transport::uncork()
+{
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
+    bool status;
+
+    _corked = false;
+    if (_corkBuffer.empty())
+    {
+        return true;
+    }
+    status = write(_corkBuffer.begin(), _corkBuffer.size());
+    _corkBuffer.clear();
+    return status;
+}
+
+void ne7ssh_transport::pushBack(const ne7ssh_buffer& data)
+{
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
+    ne7ssh_buffer tmpVar(data);
+    uint32 pending = _in.size() - _inStart;
+
+    tmpVar.resize(data.size() + pending);
+    memcpy(tmpVar.begin() + data.size(), _in.begin() + _inStart, pending);
+    _in.swap(tmpVar);
+    _inStart = 0;
+}
+
+void ne7ssh_transport::compactInput()
+{
+    uint32 pending = _in.size() - _inStart;
+
+    if (!_inStart)
+    {
+        return;
+    }
+    // Only the tail of a partially received packet is moved, everything before it was consumed by the decoder.
+    if (pending)
+    {
+        memmove(_in.begin(), _in.begin() + _inStart, pending);
+    }
+    _in.resize(pending);
+    _inStart = 0;
+}
+
+bool ne7ssh_transport::write(const Botan::byte* data, size_t len)
+{
+    int byteCount;
+    size_t sent = 0;
+
+    while (sent < len)
     {
         if (wait(_sock, 1))
         {
-            byteCount = ::send(_sock, (const SOCKET_BUFFER_TYPE*)(buffer.begin() + sent), buffer.size() - sent, 0);
+            byteCount = (int)::send(_sock, (const SOCKET_BUFFER_TYPE*)(data + sent), len - sent, 0);
         }
         else
         {
@@ -348,52 +420,88 @@ bool ne7ssh_transport::send(Botan::SecureVector<Botan::byte>& buffer)
     return true;
 }
 
-bool ne7ssh_transport::receive(Botan::SecureVector<Botan::byte>& buffer)
+bool ne7ssh_transport::receive(ne7ssh_buffer& buffer)
 {
-    Botan::byte in_buffer[MAX_PACKET_LEN];
+    size_t used = buffer.size();
     int len = 0;
 
+    // Read straight into the tail of the buffer, it keeps its allocation between calls.
+    buffer.resize(used + MAX_PACKET_LEN);
     if (wait(_sock, 0))
     {
-        len = ::recv(_sock, (char*)in_buffer, MAX_PACKET_LEN, 0);
+        len = ::recv(_sock, (char*)buffer.begin() + used, MAX_PACKET_LEN, 0);
     }
 
     if (!len)
     {
+        buffer.resize(used);
         ne7ssh::errors()->push(_session->getSshChannel(), "Received a packet of zero length.");
         return false;
     }
 
     if (len > MAX_PACKET_LEN)
     {
+        buffer.resize(used);
         ne7ssh::errors()->push(_session->getSshChannel(), "Received packet exceeds the maximum size");
         return false;
     }
 
     if (len < 0)
     {
+        buffer.resize(used);
         ne7ssh::errors()->push(_session->getSshChannel(), "Connection dropped");
         return false;
     }
 
-    buffer += SecureVector<Botan::byte>(in_buffer, len);
+    buffer.resize(used + len);
 
     return true;
 }
 
-bool ne7ssh_transport::sendPacket(Botan::SecureVector<Botan::byte> &buffer)
+bool ne7ssh_transport::sendPacket(ne7ssh_buffer &buffer)
+{
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
+    ne7ssh_pooled_buffer pooled(_pool);
+    ne7ssh_buffer& frame = pooled.value();
+
+    frame.resize(SSH_FRAME_HEADROOM + buffer.size());
+    memcpy(frame.begin() + SSH_FRAME_HEADROOM, buffer.begin(), buffer.size());
+    return sendFrame(frame);
+}
+
+bool ne7ssh_transport::sendSecurePacket(const Botan::SecureVector<Botan::byte> &buffer)
 {
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
+    ne7ssh_pooled_buffer pooled(_pool);
+    ne7ssh_buffer& frame = pooled.value();
+    bool status;
+
+    frame.resize(SSH_FRAME_HEADROOM + buffer.size());
+    memcpy(frame.begin() + SSH_FRAME_HEADROOM, buffer.begin(), buffer.size());
+    status = sendFrame(frame);
+    Botan::clear_mem(frame.begin(), frame.size());
+    return status;
+}
+
+bool ne7ssh_transport::sendFrame(ne7ssh_buffer &frame)
+{
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
     std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
-    ne7ssh_string out;
     uint32 crypt_block;
-    char padLen;
-    uint32 packetLen;
+    Botan::byte padLen;
+    uint32 packetLen, nLen;
     uint32 length;
-    SecureVector<Botan::byte> crypted, hmac;
+    bool status;
+
+    if (frame.size() < SSH_FRAME_HEADROOM)
+    {
+        ne7ssh::errors()->push(_session->getSshChannel(), "Packet frame without header room.");
+        return false;
+    }
 
 // No Zlib support right now
 //  if (crypto->isInited()) crypto->compressData (buffer);
-    length = buffer.size();
+    length = frame.size() - SSH_FRAME_HEADROOM;
 
     crypt_block = crypto->getEncryptBlock();
     if (!crypt_block)
@@ -401,32 +509,34 @@ bool ne7ssh_transport::sendPacket(Botan::SecureVector<Botan::byte> &buffer)
         crypt_block = 8;
     }
 
-    padLen = (char)(3 + crypt_block - ((length + 8) % crypt_block));
+    padLen = (Botan::byte)(3 + crypt_block - ((length + 8) % crypt_block));
     packetLen = 1 + length + padLen;
 
-    out.addInt(packetLen);
-    out.addChar(padLen);
-    out.addVector(buffer);
-
-    std::unique_ptr<Botan::byte> padBytes(new Botan::byte[padLen]);
-    memset(padBytes.get(), 0x00, padLen);
-    out.addBytes(padBytes.get(), padLen);
-    padBytes.reset();
+    nLen = htonl(packetLen);
+    memcpy(frame.begin(), &nLen, sizeof(uint32));
+    frame[sizeof(uint32)] = padLen;
+    frame.resize(SSH_FRAME_HEADROOM + length + padLen);
+    memset(frame.begin() + SSH_FRAME_HEADROOM + length, 0x00, padLen);
 
     if (crypto->isInited())
     {
-        if (!crypto->encryptPacket(crypted, hmac, out.value(), _seq))
+        ne7ssh_pooled_buffer crypted(_pool);
+        status = crypto->encryptPacket(crypted.value(), frame, _seq);
+        if (!status)
         {
             ne7ssh::errors()->push(_session->getSshChannel(), "Failure to encrypt the payload.");
-            return false;
         }
-        crypted += hmac;
-        if (!send(crypted))
+        else
         {
-            return false;
+            status = send(crypted.value());
         }
     }
-    else if (!send(out.value()))
+    else
+    {
+        status = send(frame);
+    }
+    frame.resize(SSH_FRAME_HEADROOM + length);
+    if (!status)
     {
         return false;
     }
@@ -441,104 +551,140 @@ bool ne7ssh_transport::sendPacket(Botan::SecureVector<Botan::byte> &buffer)
     return true;
 }
 
-short ne7ssh_transport::waitForPacket(Botan::byte command, bool bufferOnly)
+short ne7ssh_transport::decodePacket()
 {
     std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
-    Botan::byte cmd;
-    SecureVector<Botan::byte> decrypted;
-    ne7ssh_packet packet(&_in);
-    uint32 cryptoLen = 0;
-    int macLen = 0;
+    uint32 block, needed, macLen;
 
-    if (bufferOnly == false)
+    switch (_decoderState)
     {
-        size_t size = 4;
-        if (crypto->isInited() == true)
-        {
-            size = crypto->getDecryptBlock();
-        }
-        while (_in.size() < size)
-        {
-            if (receive(_in) == false)
+        case AWAIT_LENGTH:
+            block = crypto->isInited() ? crypto->getDecryptBlock() : (uint32)NE7SSH_PACKET_LENGTH_SIZE;
+            if ((_in.size() - _inStart) < block)
             {
-                return -1;
+                return 0;
             }
-        }
-    }
-    if ((crypto->isInited() == true) && (_in.size() >= crypto->getDecryptBlock()))
-    {
-        crypto->decryptPacket(decrypted, _in, crypto->getDecryptBlock());
-        packet = &decrypted;
-        macLen = crypto->getMacInLen();
-    }
-    cryptoLen = packet.getCryptoLength();
-    if ((bufferOnly == false) || ((crypto->isInited() == true) && (packet.getCommand() > 0) && (packet.getCommand() < 0xff)))
-    {
-        while ((cryptoLen + macLen) > _in.size())
-        {
-            if (receive(_in) == false)
+            _decoded.clear();
+            if (crypto->isInited())
             {
+                if (!crypto->decryptAppend(_decoded, _in.begin() + _inStart, block))
+                {
+                    ne7ssh::errors()->push(_session->getSshChannel(), "Failure to decrypt the packet.");
+                    return -1;
+                }
+            }
+            else
+            {
+                _decoded.set(_in.begin() + _inStart, block);
+            }
+            _inStart += block;
+            _cryptoLen = ne7ssh_packet(&_decoded).getCryptoLength();
+            if ((_cryptoLen < block) || (_cryptoLen > MAX_INCOMING_PACKET_LEN))
+            {
+                ne7ssh::errors()->push(_session->getSshChannel(), "Received packet exceeds the maximum size");
                 return -1;
             }
-        }
-    }
+            // The rest of the packet may already be buffered.
+            _decoderState = AWAIT_BODY;
+        // Fall through.
 
-    if (crypto->isInited() == true)
-    {
-        if (cryptoLen > crypto->getDecryptBlock())
-        {
-            SecureVector<Botan::byte> tmpVar;
-            tmpVar = SecureVector<Botan::byte>(_in.begin() + crypto->getDecryptBlock(), (cryptoLen - crypto->getDecryptBlock()));
-            crypto->decryptPacket(tmpVar, tmpVar, tmpVar.size());
-            decrypted += tmpVar;
-        }
-        if (crypto->getMacInLen() && (_in.size() > 0) && (_in.size() >= (cryptoLen + crypto->getMacInLen())))
-        {
-            SecureVector<Botan::byte> ourMac, hMac;
-            crypto->computeMac(ourMac, decrypted, _rSeq);
-            hMac = SecureVector<Botan::byte>(_in.begin() + cryptoLen, crypto->getMacInLen());
-            if (hMac != ourMac)
+        case AWAIT_BODY:
+            needed = _cryptoLen - _decoded.size();
+            if ((_in.size() - _inStart) < needed)
             {
-                ne7ssh::errors()->push(_session->getSshChannel(), "Mismatched HMACs.");
-                return -1;
+                return 0;
             }
-            cryptoLen += crypto->getMacInLen();
-        }
+            if (needed)
+            {
+                if (crypto->isInited())
+                {
+                    if (!crypto->decryptAppend(_decoded, _in.begin() + _inStart, needed))
+                    {
+                        ne7ssh::errors()->push(_session->getSshChannel(), "Failure to decrypt the packet.");
+                        return -1;
+                    }
+                }
+                else
+                {
+                    _decoded.resize(_cryptoLen);
+                    memcpy(_decoded.begin() + _cryptoLen - needed, _in.begin() + _inStart, needed);
+                }
+                _inStart += needed;
+            }
+            _decoderState = AWAIT_MAC;
+        // Fall through.
+
+        case AWAIT_MAC:
+            macLen = crypto->isInited() ? crypto->getMacInLen() : 0;
+            if ((_in.size() - _inStart) < macLen)
+            {
+                return 0;
+            }
+            if (macLen)
+            {
+                crypto->computeMac(_mac, _decoded, _rSeq);
+                if ((_mac.size() != macLen) || !same_mem(_mac.begin(), _in.begin() + _inStart, macLen))
+                {
+                    ne7ssh::errors()->push(_session->getSshChannel(), "Mismatched HMACs.");
+                    return -1;
+                }
+                _inStart += macLen;
+            }
+            _decoderState = AWAIT_LENGTH;
+            return 1;
     }
-    else
+    return -1;
+}
+
+short ne7ssh_transport::waitForPacket(Botan::byte command, bool bufferOnly)
+{
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
+    Botan::byte cmd;
+    short status;
+
+    // Output held back by cork() has to reach the peer before an answer can be expected.
+    if (!bufferOnly && _corked && !uncork())
     {
-        decrypted = _in;
+        return -1;
     }
-    if (decrypted.empty() == false)
+
+    // Only one packet is decoded per call, the next one may already need the keys this one negotiates.
+    while ((status = decodePacket()) == 0)
     {
-        _rSeq++;
-        cmd = packet.getCommand();
-        if ((command == cmd) || (command == 0))
+        if (bufferOnly)
         {
-            _inBuffer = decrypted;
-            if (_in.size() == cryptoLen)
-            {
-                _in.clear();
-            }
-            else
-            {
-                SecureVector<Botan::byte> tmpVar;
-                tmpVar.swap(_in);
-                _in = SecureVector<Botan::byte>(tmpVar.begin() + cryptoLen, tmpVar.size() - cryptoLen);
-            }
-            return cmd;
+            return 0;
         }
-        else
+        compactInput();
+        if (receive(_in) == false)
         {
-            return 0;
+            return -1;
         }
     }
+    if (status < 0)
+    {
+        return -1;
+    }
+    if (_inStart == _in.size())
+    {
+        _in.clear();
+        _inStart = 0;
+    }
 
-    return command;
+    _rSeq++;
+    // The previous packet's buffer is reused for decoding the next one.
+    _inBuffer.swap(_decoded);
+    cmd = ne7ssh_packet(&_inBuffer).getCommand();
+    if ((command == cmd) || (command == 0))
+    {
+        return cmd;
+    }
+    return 0;
 }
 
-uint32 ne7ssh_transport::getPacket(Botan::SecureVector<Botan::byte> &result)
+uint32 ne7ssh_transport::getPacket(ne7ssh_buffer &result)
 {
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
     std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
     ne7ssh_packet packet(&_inBuffer);
     uint32 len = packet.getPacketLength();
@@ -560,11 +706,67 @@ uint32 ne7ssh_transport::getPacket(Botan::SecureVector<Botan::byte> &result)
         }
     }
 
-    _inBuffer += SecureVector<Botan::byte>((Botan::byte*)"\0", 1);
-    result = SecureVector<Botan::byte>(packet.getPayload(), len);
+    _inBuffer.push_back(0);
+    result.set(packet.getPayload(), len);
     crypto->decompressData(result);
 
     _inBuffer.clear();
     return padLen;
 
 }
+
+bool ne7ssh_transport::getPayload(ne7ssh_span& payload)
+{
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
+    std::shared_ptr<ne7ssh_crypt> crypto = _session->_crypto;
+    ne7ssh_packet packet(&_inBuffer);
+    uint32 len = packet.getPacketLength();
+    Botan::byte padLen = packet.getPadLength();
+
+    payload.data = NULL;
+    payload.length = 0;
+    if ((_inBuffer.size() < NE7SSH_PACKET_PAYLOAD_OFFS) || (len < (uint32)padLen + NE7SSH_PACKET_PAD_SIZE) ||
+        ((len - padLen - NE7SSH_PACKET_PAD_SIZE) > (_inBuffer.size() - NE7SSH_PACKET_PAYLOAD_OFFS)))
+    {
+        return false;
+    }
+
+    payload.data = _inBuffer.begin() + NE7SSH_PACKET_PAYLOAD_OFFS;
+    payload.length = len - padLen - NE7SSH_PACKET_PAD_SIZE;
+    if (crypto->isCompressed())
+    {
+        // Decompressed data cannot be parsed in place, it is the only case where the payload is copied.
+        _payload.set(payload.data, payload.length);
+        crypto->decompressData(_payload);
+        payload.data = _payload.begin();
+        payload.length = _payload.size();
+    }
+    return true;
+}
+
+std::shared_ptr<ne7ssh_channel> ne7ssh_transport::findChannel(uint32 channelID)
+{
+    std::map<uint32, std::weak_ptr<ne7ssh_channel> >::iterator found = _channels.find(channelID);
+
+    if (found == _channels.end())
+    {
+        return std::shared_ptr<ne7ssh_channel>();
+    }
+    return found->second.lock();
+}
+
+std::vector<std::shared_ptr<ne7ssh_channel> > ne7ssh_transport::getChannels()
+{
+    std::vector<std::shared_ptr<ne7ssh_channel> > result;
+    std::map<uint32, std::weak_ptr<ne7ssh_channel> >::iterator it;
+
+    for (it = _channels.begin(); it != _channels.end(); it++)
+    {
+        std::shared_ptr<ne7ssh_channel> channel = it->second.lock();
+        if (channel)
+        {
+            result.push_back(channel);
+        }
+    }
+    return result;
+}
@@ -18,22 +18,36 @@
 #define NE7SSH_TRANSPORT_H
 
 #include "ne7ssh_types.h"
-#include <botan/secmem.h>
+#include "ne7ssh_string.h"
+#include "ne7ssh_buffer_pool.h"
+#include "ne7ssh_reader.h"
 #if defined(WIN32) || defined(__MINGW32__)
 #   include <winsock.h>
 #endif
 #include <sys/types.h>
 #include <memory>
+#include <mutex>
+#include <map>
+#include <vector>
 
 //#define MAX_PACKET_LEN 35000
 #define MAX_PACKET_LEN 34816
 #define MAX_SEQUENCE 4294967295U
+// Largest packet accepted from the remote side, the same limit OpenSSH uses.
+#define MAX_INCOMING_PACKET_LEN 262144
+// Room a packet builder leaves in front of the payload for the packet length and padding length fields.
+#define SSH_FRAME_HEADROOM 5
+// Room a packet builder leaves behind the payload for the largest padding sendFrame() may append.
+#define SSH_FRAME_TAILROOM 36
+// Capacity of pooled packet buffers: a full frame plus room for a MAC of up to 64 bytes.
+#define SSH_POOL_BUFFER_SIZE (MAX_PACKET_LEN + SSH_FRAME_HEADROOM + SSH_FRAME_TAILROOM + 64)
 
 #if !defined(WIN32) && !defined(__MINGW32__)
 #  define SOCKET int
 #endif
 
 class ne7ssh_session;
+class ne7ssh_channel;
 
 /**
 @author Andrew Useckas
@@ -41,12 +55,29 @@ class ne7ssh_session;
 class ne7ssh_transport
 {
 private:
+    /**
+     * States of the incoming packet decoder.
+     */
+    enum decoderStates { AWAIT_LENGTH, AWAIT_BODY, AWAIT_MAC };
+
     uint32 _seq;
     uint32 _rSeq;
     const std::shared_ptr<ne7ssh_session> _session;
     SOCKET _sock;
-    Botan::SecureVector<Botan::byte> _in;
-    Botan::SecureVector<Botan::byte> _inBuffer;
+    ne7ssh_buffer _in;
+    uint32 _inStart;
+    decoderStates _decoderState;
+    uint32 _cryptoLen;
+    ne7ssh_buffer _decoded;
+    ne7ssh_buffer _inBuffer;
+    bool _corked;
+    ne7ssh_buffer _corkBuffer;
+    ne7ssh_buffer_pool _pool;
+    ne7ssh_buffer _mac;
+    ne7ssh_buffer _payload;
+    std::map<uint32, std::weak_ptr<ne7ssh_channel> > _channels;
+    // Serializes socket I/O, decoder state and the buffer pool between all channels multiplexed over the connection.
+    std::recursive_mutex _mutex;
 
     /**
      * Switches socket's NonBlocking option on or off.
@@ -65,6 +96,27 @@ private:
      */
     bool wait(SOCKET socket, int rw, int timeout = -1);
 
+    /**
+     * Writes raw bytes to the socket, looping until everything is written.
+     * @param data Data to be written.
+     * @param len Length of the data.
+     * @return True if data successful sent, otherwise false is returned.
+     */
+    bool write(const Botan::byte* data, size_t len);
+
+    /**
+     * Advances the incoming packet decoder over the bytes buffered in _in.
+     * <p> The first cipher block, the rest of the packet and the MAC are each consumed as soon as they are complete, so every received byte is decrypted once and the receive buffer is never rebuilt.
+     * A partially received packet is kept in the decoder state until more data arrives.
+     * @return 1 if a complete packet was decoded into _decoded, 0 if more data is needed, or -1 on a malformed packet or mismatched HMACs.
+     */
+    short decodePacket();
+
+    /**
+     * Moves the bytes not yet consumed by the decoder to the front of the receive buffer.
+     */
+    void compactInput();
+
 public:
     /**
      * ne7ssh_transport class constructor.
@@ -92,29 +144,64 @@ public:
      * @param buffer The data will be placed here.
      * @return True if data successfuly read, otherwise false is returned.
      */
-    bool receive(Botan::SecureVector<Botan::byte>& buffer);
+    bool receive(ne7ssh_buffer& buffer);
 
     /**
      * Writes a buffer to the socket.
      * @param buffer Data to be written to the socket.
      * @return True if data successful sent, otherwise false is returned.
      */
-    bool send(Botan::SecureVector<Botan::byte>& buffer);
+    bool send(ne7ssh_buffer& buffer);
+
+    /**
+     * Holds back everything passed to send() until uncork() is called, so several packets leave in a single write.
+     */
+    void cork();
+
+    /**
+     * Writes all data held back since cork() was called, and resumes writing directly to the socket.
+     * @return True if data successful sent, otherwise false is returned.
+     */
+    bool uncork();
+
+    /**
+     * Returns data that was read from the socket, but not consumed, to the front of the receive buffer.
+     * <p> Used when the remote version string arrives in the same read as the first binary packet.
+     * @param data Data to be processed by the next waitForPacket() call.
+     */
+    void pushBack(const ne7ssh_buffer& data);
 
     /**
      * Assembles an SSH packet, as specified in SSH standards and passes the buffer to send() function.
      * @param buffer Payload to be sent.
      * @return True if send successful, otherwise false is returned.
      */
-    bool sendPacket(Botan::SecureVector<Botan::byte>& buffer);
+    bool sendPacket(ne7ssh_buffer& buffer);
+
+    /**
+     * Assembles and sends an SSH packet carrying secret material, such as a password.
+     * <p> The plain text frame is wiped before its buffer goes back to the pool.
+     * @param buffer Payload to be sent.
+     * @return True if send successful, otherwise false is returned.
+     */
+    bool sendSecurePacket(const Botan::SecureVector<Botan::byte>& buffer);
+
+    /**
+     * Sends a payload that was built with SSH_FRAME_HEADROOM bytes of room in front of it.
+     * <p> Packet header and padding are written in place, so if the builder also reserved SSH_FRAME_TAILROOM bytes the payload is never copied or reallocated.
+     * The frame is restored to its original length before returning.
+     * @param frame Reference to a vector holding the headroom followed by the payload.
+     * @return True if send successful, otherwise false is returned.
+     */
+    bool sendFrame(ne7ssh_buffer& frame);
 
     /**
      * Waits until specified type of packet is received.
      * <p> If cmd is 0, waits for the first available packet of any kind.
-     * <p> Once the desired packet is received, it is decrypted / decommpressed, the hMac is checked, and dropped into inBuffer class variable.
+     * <p> Once a packet is received, it is decrypted, the hMac is checked, and it is dropped into inBuffer class variable, even if it is not of the desired type.
      * @param cmd SSH2 packet to wait for. If 0, first available packet will be read into inBuffer class variable.
-     * @param bufferOnly Does not wait to receive a new packet, only checks existing receive buffer for unprocessed packets.
-     * @return 1 if desired packet is received, 0 if there another packet is received, or -1 if HMAC checking is enabled, and remote and local HMACs do not match.
+     * @param bufferOnly Does not wait to receive a new packet, only checks existing receive buffer for unprocessed packets. A packet that is not complete yet is picked up by a later call.
+     * @return The packet's message number if desired packet is received, 0 if another packet or no complete packet is received, or -1 on a receive error, a malformed packet, or if HMAC checking is enabled, and remote and local HMACs do not match.
      */
     short waitForPacket(Botan::byte cmd, bool bufferOnly = false);
 
@@ -123,13 +210,83 @@ public:
      * @param result The payload will be stored here.
      * @return The SSH packet passing length.
      */
-    uint32 getPacket(Botan::SecureVector<Botan::byte>& result);
+    uint32 getPacket(ne7ssh_buffer& result);
+
+    /**
+     * Gets a view of the payload of the SSH packet received by waitForPacket() function, without copying it.
+     * <p> The view points into the transport's receive buffer, and is only valid until the next call to waitForPacket().
+     * @param payload Set to the payload, starting with the message number and excluding the padding.
+     * @return True if a packet is available, otherwise false is returned.
+     */
+    bool getPayload(ne7ssh_span& payload);
 
     /**
      * Checks to see if there is more data to be read from the socket.
      * @return True if there is data to be read, otherwise false is returned.
      */
     bool haveData();
+
+    /**
+     * Gets the lock serializing all I/O on this connection.
+     * <p>Every sending and receiving function takes it on its own. A caller holds it across a sequence of calls, such as waitForPacket() followed by getPayload(), that must not be interleaved with another thread's I/O.
+     * @return Reference to the connection's lock.
+     */
+    std::recursive_mutex& getMutex()
+    {
+        return _mutex;
+    }
+
+    /**
+     * Gets the number of packet buffers served from the connection's buffer pool without allocating.
+     * @return Number of pool hits.
+     */
+    uint64 getPoolHits() const
+    {
+        return _pool.getHits();
+    }
+
+    /**
+     * Gets the number of packet buffers the connection's buffer pool had to allocate.
+     * <p>Stops growing once the pool is warmed up, a steadily increasing count means buffers are not returned.
+     * @return Number of pool misses.
+     */
+    uint64 getPoolMisses() const
+    {
+        return _pool.getMisses();
+    }
+
+    /**
+     * Registers a channel multiplexed over this connection, so packets addressed to it can be routed to it.
+     * <p>Registering a channel under an ID already in use replaces the previous owner.
+     * @param channelID Local channel ID, as sent in 'CHANNEL_OPEN'.
+     * @param channel Channel handling the packets.
+     */
+    void registerChannel(uint32 channelID, std::shared_ptr<ne7ssh_channel> channel)
+    {
+        _channels[channelID] = channel;
+    }
+
+    /**
+     * Removes a channel from the routing table.
+     * @param channelID Local channel ID.
+     */
+    void unregisterChannel(uint32 channelID)
+    {
+        _channels.erase(channelID);
+    }
+
+    /**
+     * Looks up the channel packets addressed to a local channel ID are routed to.
+     * @param channelID Local channel ID.
+     * @return The channel, or an empty pointer if no channel with this ID is open on the connection.
+     */
+    std::shared_ptr<ne7ssh_channel> findChannel(uint32 channelID);
+
+    /**
+     * Gets all channels multiplexed over this connection.
+     * @return List of the registered channels.
+     */
+    std::vector<std::shared_ptr<ne7ssh_channel> > getChannels();
 };
 
 #endif
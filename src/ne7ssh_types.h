@@ -18,6 +18,7 @@
 #define NE7SSH_TYPES_H
 
 #include <cstdint>
+#include <cstddef>
 
 #if defined(WIN32) || defined(__MINGW32)
 #   if defined(_WINDLL) || defined(_USRDLL) || defined(_CONSOLE) || defined(_WINDOWS)
@@ -82,6 +83,15 @@ typedef uint8_t uint8;
 typedef uint8_t Byte;
 #endif
 
+/**
+ * Describes one block of data passed to ne7ssh::sendv().
+ */
+typedef struct
+{
+    const void* data;
+    size_t length;
+} ne7ssh_iovec;
+
 #if defined(WIN32) || defined(__MINGW32__)
 #  define UNREF_PARAM(x) x
 #else